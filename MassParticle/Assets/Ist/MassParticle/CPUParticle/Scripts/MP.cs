@@ -81,6 +81,15 @@ namespace Ist
         public float SPHDensityCoef;
         public float SPHGradPressureCoef;
         public float SPHLapViscosityCoef;
+
+        public int sparse_grid;
+        public int neighbor_list;
+        public float neighbor_list_skin;
+        public int half_stencil;
+        public int adaptive_substeps;
+        public float substep_cfl;
+        public int max_substeps;
+        public int render_format;
     };
 
     public enum MPSolverType
@@ -89,14 +98,48 @@ namespace Ist
         SPH = 1,
         SPHEstimate = 2,
     }
+    public enum MPRenderFormat
+    {
+        Full = 0,       // 3 RGBAFloat texels per particle
+        Compact = 1,    // 2 RGBAHalf texels per particle
+    }
     public enum MPUpdateMode
     {
         Immediate = 0,
         Deferred = 1,
     }
 
+    public enum MPProfilePhase
+    {
+        Update,
+        GenHash,
+        Compact,
+        Sort,
+        BuildCells,
+        Gather,
+        NeighborList,
+        Broadphase,
+        Interaction,
+        Integrate,
+        GPUClone,
+        CallHandlers,
+        HitHandlers,
+        ForceHandlers,
+        Num,
+    }
+
+    public struct MPProfileStats
+    {
+        public float min_ms;
+        public float avg_ms;
+        public float max_ms;
+        public float avg_tasks;
+        public int num_samples;
+    }
+
     public delegate void MPHitHandler(ref MPParticle particle);
     public delegate void MPForceHandler(ref MPParticleForce force);
+    public unsafe delegate void MPBatchHitHandler(int owner_id, MPParticle** particles, int num);
 
     public struct MPColliderProperties
     {
@@ -104,6 +147,7 @@ namespace Ist
         public float stiffness;
         public MPHitHandler hit_handler;
         public MPForceHandler force_handler;
+        public MPBatchHitHandler batch_hit_handler;
 
         public void SetDefaultValues()
         {
@@ -111,6 +155,7 @@ namespace Ist
             stiffness = 1500.0f;
             hit_handler = null;
             force_handler = null;
+            batch_hit_handler = null;
         }
     }
 
@@ -129,6 +174,9 @@ namespace Ist
         Radial,
         RadialCapsule,
         VectorField,
+        Vortex,
+        Spline,
+        BakedField,
     }
 
     public struct MPForceProperties
@@ -195,6 +243,14 @@ namespace Ist
         public static extern void mpEndUpdate(int context);
         [DllImport("MassParticle")]
         public static extern void mpCallHandlers(int context);
+        [DllImport("MassParticle")]
+        public static extern void mpUpdateHitLists(int context);
+        [DllImport("MassParticle")]
+        unsafe public static extern int mpGetHitList(int context, int owner_id, out MPParticle** particles);
+        [DllImport("MassParticle")]
+        public static extern void mpSetMaxThreads(int context, int num_threads);
+        [DllImport("MassParticle")]
+        public static extern int mpGetNumSubsteps(int context);
 
         [DllImport("MassParticle")]
         public static extern void mpClearParticles(int context);
@@ -213,6 +269,12 @@ namespace Ist
         [DllImport("MassParticle")]
         unsafe public static extern MPParticle* mpGetParticles(int context);
         [DllImport("MassParticle")]
+        public static extern void mpAddParticles(int context, MPParticle[] particles, int num); // never drops particles that don't fit in spawn queue while updating. they are added at mpEndUpdate()
+        [DllImport("MassParticle")]
+        public static extern int mpEnqueueParticles(int context, MPParticle[] particles, int num); // returns number accepted. the rest are dropped when spawn queue is full
+        [DllImport("MassParticle")]
+        public static extern void mpSetSpawnQueueCapacity(int context, int capacity);
+        [DllImport("MassParticle")]
         public static extern void mpScatterParticlesSphere(int context, ref Vector3 center, float radius, int num, ref MPSpawnParams sp);
         [DllImport("MassParticle")]
         public static extern void mpScatterParticlesBox(int context, ref Vector3 center, ref Vector3 size, int num, ref MPSpawnParams sp);
@@ -220,6 +282,8 @@ namespace Ist
         public static extern void mpScatterParticlesSphereTransform(int context, ref Matrix4x4 trans, int num, ref MPSpawnParams sp);
         [DllImport("MassParticle")]
         public static extern void mpScatterParticlesBoxTransform(int context, ref Matrix4x4 trans, int num, ref MPSpawnParams sp);
+        [DllImport("MassParticle")]
+        public static extern void mpSetSpawnSeed(int context, uint seed);
 
         [DllImport("MassParticle")]
         public static extern void mpAddSphereCollider(int context, ref MPColliderProperties props, ref Vector3 center, float radius);
@@ -229,9 +293,52 @@ namespace Ist
         public static extern void mpAddBoxCollider(int context, ref MPColliderProperties props, ref Matrix4x4 transform, ref Vector3 center, ref Vector3 size);
         [DllImport("MassParticle")]
         public static extern void mpRemoveCollider(int context, ref MPColliderProperties props);
+        [DllImport("MassParticle")]
+        public static extern void mpAddSphereColliders(int context, MPColliderProperties[] props, Vector3[] centers, float[] radii, int num);
+        [DllImport("MassParticle")]
+        public static extern void mpAddCapsuleColliders(int context, MPColliderProperties[] props, Vector3[] pos1, Vector3[] pos2, float[] radii, int num);
+        [DllImport("MassParticle")]
+        public static extern void mpAddBoxColliders(int context, MPColliderProperties[] props, Matrix4x4[] transforms, Vector3[] centers, Vector3[] sizes, int num);
+        [DllImport("MassParticle")]
+        public static extern void mpCreateSphereColliders(int context, MPColliderProperties[] props, Vector3[] centers, float[] radii, int num, [Out] int[] handles);
+        [DllImport("MassParticle")]
+        public static extern void mpCreateCapsuleColliders(int context, MPColliderProperties[] props, Vector3[] pos1, Vector3[] pos2, float[] radii, int num, [Out] int[] handles);
+        [DllImport("MassParticle")]
+        public static extern void mpCreateBoxColliders(int context, MPColliderProperties[] props, Matrix4x4[] transforms, Vector3[] centers, Vector3[] sizes, int num, [Out] int[] handles);
+        [DllImport("MassParticle")]
+        public static extern void mpUpdateSphereColliders(int context, int[] handles, MPColliderProperties[] props, Vector3[] centers, float[] radii, int num);
+        [DllImport("MassParticle")]
+        public static extern void mpUpdateCapsuleColliders(int context, int[] handles, MPColliderProperties[] props, Vector3[] pos1, Vector3[] pos2, float[] radii, int num);
+        [DllImport("MassParticle")]
+        public static extern void mpUpdateBoxColliders(int context, int[] handles, MPColliderProperties[] props, Matrix4x4[] transforms, Vector3[] centers, Vector3[] sizes, int num);
+        [DllImport("MassParticle")]
+        public static extern void mpDestroyColliders(int context, int[] handles, int num);
+        [DllImport("MassParticle")]
+        public static extern int mpIsValidColliderHandle(int context, int handle);
+        [DllImport("MassParticle")]
+        public static extern int mpCreateSDF(float[] distances, int[] div, ref Vector3 origin, float cell_size);
+        [DllImport("MassParticle")]
+        public static extern int mpCreateSDFFromMesh(Vector3[] vertices, int num_vertices, int[] indices, int num_indices, float cell_size);
+        [DllImport("MassParticle")]
+        public static extern void mpDestroySDF(int sdf);
+        [DllImport("MassParticle")]
+        public static extern void mpAddSDFCollider(int context, ref MPColliderProperties props, ref Matrix4x4 transform, int sdf);
 
         [DllImport("MassParticle")]
         public static extern void mpAddForce(int context, ref MPForceProperties props, ref Matrix4x4 mat);
+        [DllImport("MassParticle")]
+        public static extern void mpAddForces(int context, MPForceProperties[] props, Matrix4x4[] mats, int num);
+        [DllImport("MassParticle")]
+        public static extern void mpAddSplineForce(int context, ref MPForceProperties props, ref Matrix4x4 mat, Vector3[] points, int num_points);
+        [DllImport("MassParticle")]
+        public static extern int mpCreateBakedField(Vector3[] vectors, int[] div, ref Vector3 origin, float cell_size);
+        [DllImport("MassParticle")]
+        [return: MarshalAs(UnmanagedType.I1)]
+        public static extern bool mpUpdateBakedField(int field, Vector3[] vectors, int[] offset, int[] size);
+        [DllImport("MassParticle")]
+        public static extern void mpDestroyBakedField(int field);
+        [DllImport("MassParticle")]
+        public static extern void mpAddBakedFieldForce(int context, ref MPForceProperties props, ref Matrix4x4 mat, int field);
 
         [DllImport("MassParticle")]
         public static extern void mpScanSphere(int context, MPHitHandler h, ref Vector3 center, float radius);
@@ -248,6 +355,16 @@ namespace Ist
 
         [DllImport("MassParticle")]
         public static extern void mpMoveAll(int context, ref Vector3 move_amount);
+
+        [DllImport("MassParticle")]
+        public static extern int mpGetProfileStats(int context, [Out] MPProfileStats[] stats, int num_stats);
+        [DllImport("MassParticle")]
+        public static extern IntPtr mpGetProfilePhaseName(MPProfilePhase phase);
+        [DllImport("MassParticle")]
+        public static extern void mpResetProfileStats(int context);
+        [DllImport("MassParticle")]
+        [return: MarshalAs(UnmanagedType.I1)]
+        public static extern bool mpDumpProfileTrace(int context, string path);
     }
 
 
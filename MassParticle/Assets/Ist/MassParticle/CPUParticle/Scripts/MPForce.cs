@@ -24,8 +24,11 @@ namespace Ist
         public float m_random_diffuse = 1.0f;
         public Vector3 m_direction = new Vector3(0.0f, -1.0f, 0.0f);
         public Vector3 m_cellsize = new Vector3(0.5f, 0.5f, 0.5f);
+        public Vector3[] m_spline_points = new Vector3[0]; // control points of Spline in local space
+        [System.NonSerialized] public int m_baked_field; // id from MPAPI.mpCreateBakedField(). used by BakedField
 
         MPForceProperties m_mpprops;
+        Vector3[] m_spline_world;
 
         delegate void TargetEnumerator(MPWorld world);
         void EachTargets(TargetEnumerator e)
@@ -62,10 +65,35 @@ namespace Ist
             m_mpprops.center = transform.position;
             m_mpprops.rcp_cellsize = new Vector3(1.0f / m_cellsize.x, 1.0f / m_cellsize.y, 1.0f / m_cellsize.z);
             Matrix4x4 mat = transform.localToWorldMatrix;
-            EachTargets((w) =>
+            if (m_direction_type == MPForceDirection.Spline)
             {
-                MPAPI.mpAddForce(w.GetContext(), ref m_mpprops, ref mat);
-            });
+                if (m_spline_world == null || m_spline_world.Length != m_spline_points.Length)
+                {
+                    m_spline_world = new Vector3[m_spline_points.Length];
+                }
+                for (int i = 0; i < m_spline_points.Length; ++i)
+                {
+                    m_spline_world[i] = mat.MultiplyPoint3x4(m_spline_points[i]);
+                }
+                EachTargets((w) =>
+                {
+                    MPAPI.mpAddSplineForce(w.GetContext(), ref m_mpprops, ref mat, m_spline_world, m_spline_world.Length);
+                });
+            }
+            else if (m_direction_type == MPForceDirection.BakedField)
+            {
+                EachTargets((w) =>
+                {
+                    MPAPI.mpAddBakedFieldForce(w.GetContext(), ref m_mpprops, ref mat, m_baked_field);
+                });
+            }
+            else
+            {
+                EachTargets((w) =>
+                {
+                    MPAPI.mpAddForce(w.GetContext(), ref m_mpprops, ref mat);
+                });
+            }
         }
 
         public static void MPUpdateAll()
@@ -102,10 +130,22 @@ namespace Ist
                         Gizmos.DrawWireSphere(Vector3.zero, 0.5f);
                         break;
 
+                    case MPForceShape.Capsule:
+                        Gizmos.DrawWireSphere(new Vector3(0.0f, 0.5f, 0.0f), 0.5f);
+                        Gizmos.DrawWireSphere(new Vector3(0.0f, -0.5f, 0.0f), 0.5f);
+                        break;
+
                     case MPForceShape.Box:
                         Gizmos.DrawWireCube(Vector3.zero, Vector3.one);
                         break;
                 }
+                if (m_direction_type == MPForceDirection.Spline)
+                {
+                    for (int i = 0; i + 1 < m_spline_points.Length; ++i)
+                    {
+                        Gizmos.DrawLine(m_spline_points[i], m_spline_points[i + 1]);
+                    }
+                }
                 Gizmos.matrix = Matrix4x4.identity;
             }
         }
@@ -34,6 +34,7 @@ namespace Ist
             Material m = new Material(src);
             m.SetInt("g_batch_begin", nth * m_instances_par_batch);
             m.SetTexture("g_instance_data", instance_texture);
+            m.SetInt("g_instance_texels", m_world.GetInstanceTexels());
 
             Vector4 ts = new Vector4(
                 1.0f / instance_texture.width,
@@ -71,6 +72,12 @@ namespace Ist
 
             ForEachEveryMaterials((v) =>
             {
+                if (m_world != null)
+                {
+                    // instance texture is re-created when render format is changed
+                    v.SetTexture("g_instance_data", m_world.GetInstanceTexture());
+                    v.SetInt("g_instance_texels", m_world.GetInstanceTexels());
+                }
                 v.SetInt("g_num_max_instances", m_max_instances);
                 v.SetInt("g_num_instances", m_instance_count);
             });
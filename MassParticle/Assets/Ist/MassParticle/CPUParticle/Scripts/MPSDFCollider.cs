@@ -0,0 +1,76 @@
+﻿using UnityEngine;
+using System.Collections;
+using System.Collections.Generic;
+
+namespace Ist
+{
+    [AddComponentMenu("MassParticle/CPU Particle/SDF Collider")]
+    public class MPSDFCollider : MPCollider
+    {
+        public Mesh m_mesh; // mesh of MeshFilter is used if null. must be closed
+        public float m_cell_size = 0.1f;
+
+        int m_sdf;
+
+
+        public void Bake()
+        {
+            Release();
+            Mesh mesh = m_mesh;
+            if (mesh == null)
+            {
+                var mf = GetComponent<MeshFilter>();
+                if (mf != null) mesh = mf.sharedMesh;
+            }
+            if (mesh == null) return;
+
+            Vector3[] vertices = mesh.vertices;
+            int[] indices = mesh.triangles;
+            m_sdf = MPAPI.mpCreateSDFFromMesh(vertices, vertices.Length, indices, indices.Length, m_cell_size);
+        }
+
+        public void Release()
+        {
+            if (m_sdf != 0)
+            {
+                MPAPI.mpDestroySDF(m_sdf);
+                m_sdf = 0;
+            }
+        }
+
+        public override void MPUpdate()
+        {
+            base.MPUpdate();
+            if (m_sdf == 0) Bake();
+            if (m_sdf == 0) return;
+
+            Matrix4x4 mat = m_trans.localToWorldMatrix;
+            EachTargets((w) =>
+            {
+                MPAPI.mpAddSDFCollider(w.GetContext(), ref m_cprops, ref mat, m_sdf);
+            });
+        }
+
+        void OnDestroy()
+        {
+            Release();
+        }
+
+        void OnDrawGizmos()
+        {
+            if (!enabled) return;
+            Mesh mesh = m_mesh;
+            if (mesh == null)
+            {
+                var mf = GetComponent<MeshFilter>();
+                if (mf != null) mesh = mf.sharedMesh;
+            }
+            if (mesh == null) return;
+            Transform t = GetComponent<Transform>();
+            Gizmos.color = MPImpl.ColliderGizmoColor;
+            Gizmos.matrix = t.localToWorldMatrix;
+            Gizmos.DrawWireCube(mesh.bounds.center, mesh.bounds.size);
+            Gizmos.matrix = Matrix4x4.identity;
+        }
+    }
+}
@@ -30,6 +30,7 @@ namespace Ist
 
         public MPUpdateMode m_update_mode = MPUpdateMode.Deferred;
         public MPSolverType m_solver = MPSolverType.Impulse;
+        public MPRenderFormat m_render_format = MPRenderFormat.Full;
         public bool m_enable_interaction = true;
         public bool m_enable_colliders = true;
         public bool m_enable_forces = true;
@@ -45,6 +46,13 @@ namespace Ist
         public int m_world_div_x = 256;
         public int m_world_div_y = 1;
         public int m_world_div_z = 256;
+        public bool m_sparse_grid = false;
+        public bool m_neighbor_list = false;
+        public float m_neighbor_list_skin = 0.02f;
+        public bool m_half_stencil = false;
+        public bool m_adaptive_substeps = false;
+        public float m_substep_cfl = 0.5f;
+        public int m_max_substeps = 8;
         public Vector3 m_active_region_center = Vector3.zero;
         public Vector3 m_active_region_extent = Vector3.zero;
         public int m_particle_num = 0;
@@ -68,11 +76,23 @@ namespace Ist
             return m_instance_texture;
         }
 
+        // texels of a particle in instance texture
+        public int GetInstanceTexels()
+        {
+            return m_render_format == MPRenderFormat.Compact ? 2 : 3;
+        }
+
         public void UpdateInstanceTexture()
         {
+            var format = m_render_format == MPRenderFormat.Compact ? RenderTextureFormat.ARGBHalf : RenderTextureFormat.ARGBFloat;
+            if (m_instance_texture != null && m_instance_texture.format != format)
+            {
+                m_instance_texture.Release();
+                m_instance_texture = null;
+            }
             if (m_instance_texture == null)
             {
-                m_instance_texture = new RenderTexture(MPWorld.DataTextureWidth, MPWorld.DataTextureHeight, 0, RenderTextureFormat.ARGBFloat, RenderTextureReadWrite.Default);
+                m_instance_texture = new RenderTexture(MPWorld.DataTextureWidth, MPWorld.DataTextureHeight, 0, format, RenderTextureReadWrite.Default);
                 m_instance_texture.filterMode = FilterMode.Point;
                 m_instance_texture.Create();
             }
@@ -152,7 +172,8 @@ namespace Ist
             UpdateMPObjects();
             foreach (MPWorld w in s_instances)
             {
-                MPAPI.mpUpdate(w.GetContext(), Time.deltaTime);
+                // with adaptive substeps, dt is integrated instead of timestep. scale it same as timestep.
+                MPAPI.mpUpdate(w.GetContext(), w.m_adaptive_substeps ? Time.deltaTime * w.m_timescale : Time.deltaTime);
                 s_current = w;
                 MPAPI.mpCallHandlers(w.GetContext());
                 MPAPI.mpClearCollidersAndForces(w.GetContext());
@@ -213,6 +234,14 @@ namespace Ist
             p.world_div_x = m_world_div_x;
             p.world_div_y = m_world_div_y;
             p.world_div_z = m_world_div_z;
+            p.sparse_grid = m_sparse_grid ? 1 : 0;
+            p.neighbor_list = m_neighbor_list ? 1 : 0;
+            p.neighbor_list_skin = m_neighbor_list_skin;
+            p.half_stencil = m_half_stencil ? 1 : 0;
+            p.adaptive_substeps = m_adaptive_substeps ? 1 : 0;
+            p.substep_cfl = m_substep_cfl;
+            p.max_substeps = m_max_substeps;
+            p.render_format = (int)m_render_format;
             p.active_region_center = transform.position + m_active_region_center;
             p.active_region_extent = m_active_region_extent;
             p.solver_type = (int)m_solver;
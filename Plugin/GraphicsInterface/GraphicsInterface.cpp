@@ -7,6 +7,21 @@ GraphicsInterface::~GraphicsInterface()
 {
 }
 
+Result GraphicsInterface::enqueueWriteTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size)
+{
+    return writeTexture2D(dst_tex, width, height, format, src, write_size);
+}
+
+Result GraphicsInterface::enqueueWriteTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src)
+{
+    return writeTexture2D(dst_tex, x, y, width, height, format, src);
+}
+
+Result GraphicsInterface::enqueueWriteBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type)
+{
+    return writeBuffer(dst_buf, src, write_size, type);
+}
+
 int GraphicsInterface::GetTexelSize(TextureFormat format)
 {
     switch (format)
@@ -80,12 +80,21 @@ public:
     virtual void    releaseTexture2D(void *tex) = 0;
     virtual Result  readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format) = 0;
     virtual Result  writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) = 0;
+    // writes rectangle (x, y, width, height) of dst_tex. rest of dst_tex is kept. src is packed: its pitch is width * texel size.
+    virtual Result  writeTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src) = 0;
 
     virtual Result  createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags = ResourceFlags::None) = 0;
     virtual void    releaseBuffer(void *buf) = 0;
     virtual Result  readBuffer(void *dst, void *src_buf, size_t read_size, BufferType type) = 0;
     virtual Result  writeBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type) = 0;
 
+    // same as writeTexture2D() / writeBuffer() except these return as soon as src is copied to staging memory.
+    // GPU copies it to dst later, in order with other enqueued writes. the calling thread waits only when
+    // staging memory is full of writes GPU has not read yet. backends without staging ring write synchronously.
+    virtual Result  enqueueWriteTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size);
+    virtual Result  enqueueWriteTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src);
+    virtual Result  enqueueWriteBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type);
+
     static int GetTexelSize(TextureFormat format);
 };
 
@@ -23,6 +23,7 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) override;
+    Result writeTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
@@ -238,6 +239,38 @@ Result GraphicsInterfaceD3D11::writeTexture2D(void *dst_tex_, int width, int hei
     return TranslateReturnCode(hr);
 }
 
+Result GraphicsInterfaceD3D11::writeTexture2D(void *dst_tex_, int x, int y, int width, int height, TextureFormat format, const void *src)
+{
+    if (width <= 0 || height <= 0) { return Result::OK; }
+    if (!dst_tex_ || !src) { return Result::InvalidParameter; }
+
+    auto *dst_tex = (ID3D11Texture2D*)dst_tex_;
+    int src_pitch = width * GetTexelSize(format);
+
+    D3D11_TEXTURE2D_DESC desc;
+    dst_tex->GetDesc(&desc);
+
+    if (desc.Usage == D3D11_USAGE_DEFAULT) {
+        // driver uploads only the box
+        D3D11_BOX box = { (UINT)x, (UINT)y, 0, (UINT)(x + width), (UINT)(y + height), 1 };
+        m_context->UpdateSubresource(dst_tex, 0, &box, src, src_pitch, 0);
+        return Result::OK;
+    }
+
+    // dynamic texture can be mapped only with discard, that loses rest of the texture. copy via staging of rect size.
+    auto staging = createStagingTexture(width, height, format, StagingFlag::Upload);
+    if (!staging) { return Result::OutOfMemory; }
+
+    D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
+    auto hr = m_context->Map(staging.Get(), 0, D3D11_MAP_WRITE, 0, &mapped);
+    if (FAILED(hr)) { return TranslateReturnCode(hr); }
+    CopyRegion(mapped.pData, mapped.RowPitch, src, src_pitch, height);
+    m_context->Unmap(staging.Get(), 0);
+
+    m_context->CopySubresourceRegion(dst_tex, 0, (UINT)x, (UINT)y, 0, staging.Get(), 0, nullptr);
+    return Result::OK;
+}
+
 
 
 Result GraphicsInterfaceD3D11::createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags)
@@ -1,7 +1,9 @@
 #include "pch.h"
 #include "giInternal.h"
+#include "giStagingRing.h"
 
 #ifdef giSupportD3D12
+#include <deque>
 #include <d3d12.h>
 #include <d3dx12.h>
 
@@ -9,7 +11,7 @@ using Microsoft::WRL::ComPtr;
 
 namespace gi {
 
-class GraphicsInterfaceD3D12 : public GraphicsInterface
+class GraphicsInterfaceD3D12 : public GraphicsInterface, private StagingFence
 {
 public:
     GraphicsInterfaceD3D12(void *device);
@@ -24,29 +26,58 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *o_buf, size_t bufsize, void *tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *o_tex, int width, int height, TextureFormat format, const void *buf, size_t bufsize) override;
+    Result writeTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
     Result readBuffer(void *dst, void *src_buf, size_t read_size, BufferType type) override;
     Result writeBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type) override;
 
+    Result enqueueWriteTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) override;
+    Result enqueueWriteTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src) override;
+    Result enqueueWriteBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type) override;
+
 private:
+    // StagingFence
+    uint64_t getCompletedValue() override;
+    void     wait(uint64_t value) override;
+
     enum class StagingFlag {
         Upload,
         Readback,
     };
     ComPtr<ID3D12Resource> createStagingBuffer(size_t size, StagingFlag flag);
+    bool prepareStagingRing();
+
+    ComPtr<ID3D12CommandAllocator> acquireCommandAllocator();
 
     // Body: [](ID3D12GraphicsCommandList *clist) -> void
+    // returns right after submitting. GPU signals o_fence_value when it has executed the commands.
+    template<class Body> HRESULT submitCommands(const Body& body, uint64_t &o_fence_value);
+    // submitCommands() and wait for completion
     template<class Body> HRESULT executeCommands(const Body& body);
 
 private:
+    struct CommandsInFlight
+    {
+        uint64_t fence_value;
+        ComPtr<ID3D12CommandAllocator> calloc;
+        ComPtr<ID3D12GraphicsCommandList> clist;
+    };
+
+    // staging ring is placed on an upload heap buffer of this size. the buffer stays mapped.
+    static const size_t StagingRingSize = 8 * 1024 * 1024;
+
     ComPtr<ID3D12Device> m_device;
     ComPtr<ID3D12CommandQueue> m_cqueue;
-    ComPtr<ID3D12CommandAllocator> m_calloc;
+    std::vector<ComPtr<ID3D12CommandAllocator>> m_calloc_pool;
+    std::deque<CommandsInFlight> m_commands_in_flight; // in order of fence value
     ComPtr<ID3D12Fence> m_fence;
-    uint64_t m_fence_value = 0;
+    uint64_t m_fence_value = 1; // fence is created signaled with this
     HANDLE m_fence_event;
+
+    ComPtr<ID3D12Resource> m_staging_buffer;
+    StagingRing m_staging_ring;
 };
 
 
@@ -59,6 +90,7 @@ GraphicsInterface* CreateGraphicsInterfaceD3D12(void *device)
 
 GraphicsInterfaceD3D12::GraphicsInterfaceD3D12(void *device)
     : m_device((ID3D12Device*)device)
+    , m_staging_ring(*this)
 {
     // create command queue
     {
@@ -69,20 +101,22 @@ GraphicsInterfaceD3D12::GraphicsInterfaceD3D12(void *device)
         auto hr = m_device->CreateCommandQueue(&desc, IID_PPV_ARGS(&m_cqueue));
     }
 
-    // create command allocator & list
-    {
-        auto hr = m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&m_calloc));
-    }
-
     // create signal
     m_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence));
-    m_fence->Signal(1);
+    m_fence->Signal(m_fence_value);
 
     m_fence_event = CreateEvent(nullptr, false, false, nullptr);
 }
 
 GraphicsInterfaceD3D12::~GraphicsInterfaceD3D12()
 {
+    // GPU may still be reading staging ring and command allocators
+    wait(m_fence_value);
+    m_staging_ring.reset(nullptr, 0);
+    if (m_staging_buffer) {
+        m_staging_buffer->Unmap(0, nullptr);
+    }
+
     if (m_fence_event) {
         CloseHandle(m_fence_event);
     }
@@ -103,14 +137,55 @@ DeviceType GraphicsInterfaceD3D12::getDeviceType()
     return DeviceType::D3D12;
 }
 
+uint64_t GraphicsInterfaceD3D12::getCompletedValue()
+{
+    return m_fence->GetCompletedValue();
+}
+
+void GraphicsInterfaceD3D12::wait(uint64_t value)
+{
+    if (m_fence->GetCompletedValue() >= value) { return; }
+
+    auto hr = m_fence->SetEventOnCompletion(value, m_fence_event);
+    if (FAILED(hr)) { return; }
+
+    WaitForSingleObject(m_fence_event, INFINITE);
+}
+
+ComPtr<ID3D12CommandAllocator> GraphicsInterfaceD3D12::acquireCommandAllocator()
+{
+    // allocator can be reset only after GPU has executed commands recorded on it
+    uint64_t completed = m_fence->GetCompletedValue();
+    while (!m_commands_in_flight.empty() && m_commands_in_flight.front().fence_value <= completed) {
+        auto& c = m_commands_in_flight.front();
+        if (SUCCEEDED(c.calloc->Reset())) {
+            m_calloc_pool.push_back(c.calloc);
+        }
+        m_commands_in_flight.pop_front();
+    }
+
+    ComPtr<ID3D12CommandAllocator> ret;
+    if (!m_calloc_pool.empty()) {
+        ret = m_calloc_pool.back();
+        m_calloc_pool.pop_back();
+    }
+    else {
+        m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&ret));
+    }
+    return ret;
+}
+
 // Body: [](ID3D12GraphicsCommandList *clist) -> void
 template<class Body>
-HRESULT GraphicsInterfaceD3D12::executeCommands(const Body& body)
+HRESULT GraphicsInterfaceD3D12::submitCommands(const Body& body, uint64_t &o_fence_value)
 {
     HRESULT hr;
 
+    auto calloc = acquireCommandAllocator();
+    if (!calloc) { return E_OUTOFMEMORY; }
+
     ComPtr<ID3D12GraphicsCommandList> clist;
-    hr = m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, m_calloc.Get(), nullptr, IID_PPV_ARGS(&clist));
+    hr = m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, calloc.Get(), nullptr, IID_PPV_ARGS(&clist));
     if (FAILED(hr)) { return hr; }
 
     body(clist.Get());
@@ -120,21 +195,33 @@ HRESULT GraphicsInterfaceD3D12::executeCommands(const Body& body)
 
     m_cqueue->ExecuteCommandLists(1, (ID3D12CommandList**)clist.GetAddressOf());
 
-    ++m_fence_value;
-    hr = m_cqueue->Signal(m_fence.Get(), m_fence_value);
+    hr = m_cqueue->Signal(m_fence.Get(), m_fence_value + 1);
     if (FAILED(hr)) { return hr; }
+    ++m_fence_value;
 
-    hr = m_fence->SetEventOnCompletion(m_fence_value, m_fence_event);
-    if (FAILED(hr)) { return hr; }
+    CommandsInFlight c = { m_fence_value, calloc, clist };
+    m_commands_in_flight.push_back(c);
 
-    WaitForSingleObject(m_fence_event, INFINITE);
+    o_fence_value = m_fence_value;
+    return S_OK;
+}
 
+// Body: [](ID3D12GraphicsCommandList *clist) -> void
+template<class Body>
+HRESULT GraphicsInterfaceD3D12::executeCommands(const Body& body)
+{
+    uint64_t fence_value;
+    auto hr = submitCommands(body, fence_value);
+    if (FAILED(hr)) { return hr; }
+
+    wait(fence_value);
     return S_OK;
 }
 
 
 void GraphicsInterfaceD3D12::sync()
 {
+    wait(m_fence_value);
 }
 
 ComPtr<ID3D12Resource> GraphicsInterfaceD3D12::createStagingBuffer(size_t size, StagingFlag flag)
@@ -173,6 +260,23 @@ ComPtr<ID3D12Resource> GraphicsInterfaceD3D12::createStagingBuffer(size_t size,
     return ret;
 }
 
+bool GraphicsInterfaceD3D12::prepareStagingRing()
+{
+    if (m_staging_buffer) { return true; }
+
+    auto buf = createStagingBuffer(StagingRingSize, StagingFlag::Upload);
+    if (!buf) { return false; }
+
+    void *mapped_data = nullptr;
+    D3D12_RANGE read_range = { 0, 0 };
+    auto hr = buf->Map(0, &read_range, &mapped_data);
+    if (FAILED(hr)) { return false; }
+
+    m_staging_buffer = buf;
+    m_staging_ring.reset((char*)mapped_data, StagingRingSize);
+    return true;
+}
+
 Result GraphicsInterfaceD3D12::createTexture2D(void **dst_tex, int width, int height, TextureFormat format, const void *data, ResourceFlags flags)
 {
     D3D12_HEAP_PROPERTIES heap  = {};
@@ -325,6 +429,92 @@ Result GraphicsInterfaceD3D12::writeTexture2D(void *dst_tex_, int width, int hei
     return Result::OK;
 }
 
+// footprint of rectangle placed on a buffer at offset. rows are aligned as copy requires.
+static D3D12_PLACED_SUBRESOURCE_FOOTPRINT GetRectFootprint(DXGI_FORMAT format, int width, int height, TextureFormat tformat, UINT64 offset)
+{
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT ret = {};
+    ret.Offset              = offset;
+    ret.Footprint.Format    = format;
+    ret.Footprint.Width     = (UINT)width;
+    ret.Footprint.Height    = (UINT)height;
+    ret.Footprint.Depth     = 1;
+    ret.Footprint.RowPitch  = ceildiv<UINT>(width * GraphicsInterface::GetTexelSize(tformat), D3D12_TEXTURE_DATA_PITCH_ALIGNMENT) * D3D12_TEXTURE_DATA_PITCH_ALIGNMENT;
+    return ret;
+}
+
+Result GraphicsInterfaceD3D12::writeTexture2D(void *dst_tex_, int x, int y, int width, int height, TextureFormat format, const void *src)
+{
+    if (width <= 0 || height <= 0) { return Result::OK; }
+    if (!dst_tex_ || !src) { return Result::InvalidParameter; }
+
+    auto *dst_tex = (ID3D12Resource*)dst_tex_;
+    auto src_layout = GetRectFootprint(dst_tex->GetDesc().Format, width, height, format, 0);
+
+    auto staging = createStagingBuffer((size_t)src_layout.Footprint.RowPitch * height, StagingFlag::Upload);
+    if (!staging) { return Result::OutOfMemory; }
+
+    void *mapped_data = nullptr;
+    auto hr = staging->Map(0, nullptr, &mapped_data);
+    if (FAILED(hr)) { return TranslateReturnCode(hr); }
+    CopyRegion(mapped_data, src_layout.Footprint.RowPitch, src, width * GetTexelSize(format), height);
+    staging->Unmap(0, nullptr);
+
+    hr = executeCommands([&](ID3D12GraphicsCommandList *clist) {
+        CD3DX12_TEXTURE_COPY_LOCATION dst_region(dst_tex, 0);
+        CD3DX12_TEXTURE_COPY_LOCATION src_region(staging.Get(), src_layout);
+
+        clist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(dst_tex, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+        clist->CopyTextureRegion(&dst_region, (UINT)x, (UINT)y, 0, &src_region, nullptr);
+        clist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(dst_tex, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON));
+    });
+    return TranslateReturnCode(hr);
+}
+
+Result GraphicsInterfaceD3D12::enqueueWriteTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size)
+{
+    if (write_size == 0) { return Result::OK; }
+
+    // only rows that contain src are placed on staging ring and copied
+    int pitch = width * GetTexelSize(format);
+    int num_rows = std::min<int>(height, (int)ceildiv<size_t>(write_size, pitch));
+    return enqueueWriteTexture2D(dst_tex, 0, 0, width, num_rows, format, src);
+}
+
+Result GraphicsInterfaceD3D12::enqueueWriteTexture2D(void *dst_tex_, int x, int y, int width, int height, TextureFormat format, const void *src)
+{
+    if (width <= 0 || height <= 0) { return Result::OK; }
+    if (!dst_tex_ || !src) { return Result::InvalidParameter; }
+
+    auto *dst_tex = (ID3D12Resource*)dst_tex_;
+    auto src_layout = GetRectFootprint(dst_tex->GetDesc().Format, width, height, format, 0);
+
+    size_t offset = 0;
+    char *staging = nullptr;
+    if (prepareStagingRing()) {
+        staging = m_staging_ring.allocate((size_t)src_layout.Footprint.RowPitch * height, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT, offset);
+    }
+    if (!staging) {
+        // too large for staging ring
+        return writeTexture2D(dst_tex_, x, y, width, height, format, src);
+    }
+    CopyRegion(staging, src_layout.Footprint.RowPitch, src, width * GetTexelSize(format), height);
+    src_layout.Offset = offset;
+
+    uint64_t fence_value = 0;
+    auto hr = submitCommands([&](ID3D12GraphicsCommandList *clist) {
+        CD3DX12_TEXTURE_COPY_LOCATION dst_region(dst_tex, 0);
+        CD3DX12_TEXTURE_COPY_LOCATION src_region(m_staging_buffer.Get(), src_layout);
+
+        clist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(dst_tex, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+        clist->CopyTextureRegion(&dst_region, (UINT)x, (UINT)y, 0, &src_region, nullptr);
+        clist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(dst_tex, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON));
+    }, fence_value);
+    // on failure GPU never reads the allocation. last issued fence releases it.
+    m_staging_ring.submit(SUCCEEDED(hr) ? fence_value : m_fence_value);
+
+    return TranslateReturnCode(hr);
+}
+
 
 
 Result GraphicsInterfaceD3D12::createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags)
@@ -460,5 +650,40 @@ Result GraphicsInterfaceD3D12::writeBuffer(void *dst_buf, const void *src, size_
     return Result::OK;
 }
 
+Result GraphicsInterfaceD3D12::enqueueWriteBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type)
+{
+    if (write_size == 0) { return Result::OK; }
+    if (!dst_buf || !src) { return Result::InvalidParameter; }
+
+    auto *buf = (ID3D12Resource*)dst_buf;
+
+    // buffers on upload heap are written directly. there is nothing to enqueue.
+    D3D12_HEAP_PROPERTIES heap;
+    if (SUCCEEDED(buf->GetHeapProperties(&heap, nullptr)) && heap.Type != D3D12_HEAP_TYPE_DEFAULT) {
+        return writeBuffer(dst_buf, src, write_size, type);
+    }
+
+    size_t offset = 0;
+    char *staging = nullptr;
+    if (prepareStagingRing()) {
+        staging = m_staging_ring.allocate(write_size, 256, offset);
+    }
+    if (!staging) {
+        // too large for staging ring
+        return writeBuffer(dst_buf, src, write_size, type);
+    }
+    memcpy(staging, src, write_size);
+
+    uint64_t fence_value = 0;
+    auto hr = submitCommands([&](ID3D12GraphicsCommandList *clist) {
+        clist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(buf, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+        clist->CopyBufferRegion(buf, 0, m_staging_buffer.Get(), offset, write_size);
+        clist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(buf, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON));
+    }, fence_value);
+    m_staging_ring.submit(SUCCEEDED(hr) ? fence_value : m_fence_value);
+
+    return TranslateReturnCode(hr);
+}
+
 } // namespace gi
 #endif // giSupportD3D12
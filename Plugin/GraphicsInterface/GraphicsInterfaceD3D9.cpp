@@ -23,6 +23,7 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) override;
+    Result writeTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
@@ -224,10 +225,11 @@ Result GraphicsInterfaceD3D9::readTexture2D(void *dst, size_t read_size, void *s
     return TranslateReturnCode(hr);
 }
 
-static HRESULT LockSurfaceAndWrite(IDirect3DSurface9 *surf, int width, int height, TextureFormat format, const void *src, size_t write_size)
+// rect: nullptr to write whole surface. width & height are size of rect.
+static HRESULT LockSurfaceAndWrite(IDirect3DSurface9 *surf, const RECT *rect, DWORD flags, int width, int height, TextureFormat format, const void *src, size_t write_size)
 {
     D3DLOCKED_RECT locked;
-    auto hr = surf->LockRect(&locked, nullptr, D3DLOCK_DISCARD);
+    auto hr = surf->LockRect(&locked, rect, flags);
     if (SUCCEEDED(hr))
     {
         auto *dst_pixels = (char*)locked.pBits;
@@ -260,7 +262,7 @@ Result GraphicsInterfaceD3D9::writeTexture2D(void *dst_tex, int width, int heigh
     if (FAILED(hr)) { return TranslateReturnCode(hr); }
 
     // try direct access
-    hr = LockSurfaceAndWrite(surf_dst.Get(), width, height, format, src, write_size);
+    hr = LockSurfaceAndWrite(surf_dst.Get(), nullptr, D3DLOCK_DISCARD, width, height, format, src, write_size);
     if (SUCCEEDED(hr)) { return Result::OK; }
 
 
@@ -268,7 +270,7 @@ Result GraphicsInterfaceD3D9::writeTexture2D(void *dst_tex, int width, int heigh
     auto staging = createStagingSurface(width, height, format);
     if (staging == nullptr) { return Result::Unknown; }
 
-    hr = LockSurfaceAndWrite(staging.Get(), width, height, format, src, write_size);
+    hr = LockSurfaceAndWrite(staging.Get(), nullptr, D3DLOCK_DISCARD, width, height, format, src, write_size);
     if (SUCCEEDED(hr))
     {
         hr = m_device->UpdateSurface(staging.Get(), nullptr, surf_dst.Get(), nullptr);
@@ -278,6 +280,39 @@ Result GraphicsInterfaceD3D9::writeTexture2D(void *dst_tex, int width, int heigh
     return TranslateReturnCode(hr);
 }
 
+Result GraphicsInterfaceD3D9::writeTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src)
+{
+    if (width <= 0 || height <= 0) { return Result::OK; }
+    if (!dst_tex || !src) { return Result::InvalidParameter; }
+
+    IDirect3DTexture9 *tex = (IDirect3DTexture9*)dst_tex;
+    size_t write_size = GetTexelSize(format) * width * height;
+
+    ComPtr<IDirect3DSurface9> surf_dst;
+    auto hr = tex->GetSurfaceLevel(0, &surf_dst);
+    if (FAILED(hr)) { return TranslateReturnCode(hr); }
+
+    // try direct access. rest of the surface must be kept, so no discard.
+    RECT rect = { x, y, x + width, y + height };
+    hr = LockSurfaceAndWrite(surf_dst.Get(), &rect, 0, width, height, format, src, write_size);
+    if (SUCCEEDED(hr)) { return Result::OK; }
+
+
+    // try copy-via-staging of rect size
+    auto staging = createStagingSurface(width, height, format);
+    if (staging == nullptr) { return Result::Unknown; }
+
+    hr = LockSurfaceAndWrite(staging.Get(), nullptr, D3DLOCK_DISCARD, width, height, format, src, write_size);
+    if (SUCCEEDED(hr))
+    {
+        POINT dst_point = { x, y };
+        hr = m_device->UpdateSurface(staging.Get(), nullptr, surf_dst.Get(), &dst_point);
+        if (SUCCEEDED(hr)) { return Result::OK; }
+    }
+
+    return TranslateReturnCode(hr);
+}
+
 
 enum class MapMode {
     Read,
@@ -1,5 +1,6 @@
 ﻿#include "pch.h"
 #include "giInternal.h"
+#include "giStagingRing.h"
 
 #ifdef giSupportOpenGL
 #ifdef _WIN32
@@ -24,6 +25,12 @@ static PFNGLBINDBUFFERPROC      _glBindBuffer;
 static PFNGLBUFFERDATAPROC      _glBufferData;
 static PFNGLMAPBUFFERPROC       _glMapBuffer;
 static PFNGLUNMAPBUFFERPROC     _glUnmapBuffer;
+static PFNGLMAPBUFFERRANGEPROC  _glMapBufferRange;
+static PFNGLBUFFERSTORAGEPROC   _glBufferStorage;
+static PFNGLCOPYBUFFERSUBDATAPROC _glCopyBufferSubData;
+static PFNGLFENCESYNCPROC       _glFenceSync;
+static PFNGLCLIENTWAITSYNCPROC  _glClientWaitSync;
+static PFNGLDELETESYNCPROC      _glDeleteSync;
 
 static void InitializeOpenGL()
 {
@@ -35,12 +42,18 @@ static void InitializeOpenGL()
     GetProc(glBufferData);
     GetProc(glMapBuffer);
     GetProc(glUnmapBuffer);
+    GetProc(glMapBufferRange);
+    GetProc(glBufferStorage);
+    GetProc(glCopyBufferSubData);
+    GetProc(glFenceSync);
+    GetProc(glClientWaitSync);
+    GetProc(glDeleteSync);
 #undef GetProc
 }
 
 namespace gi {
 
-class GraphicsInterfaceOpenGL : public GraphicsInterface
+class GraphicsInterfaceOpenGL : public GraphicsInterface, private StagingFence
 {
 public:
     GraphicsInterfaceOpenGL(void *device);
@@ -55,11 +68,39 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *dst, size_t read_size, void *src_tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) override;
+    Result writeTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
     Result readBuffer(void *dst, void *src_buf, size_t read_size, BufferType type) override;
     Result writeBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type) override;
+
+private:
+    // StagingFence. GL has no fence values, so each submit inserts a sync object that stands for the next value.
+    uint64_t getCompletedValue() override;
+    void     wait(uint64_t value) override;
+
+    // staging ring is placed on a persistently mapped buffer. writes are copied into it and GL reads them
+    // from there, instead of taking client memory synchronously.
+    bool    isStagingAvailable();
+    char*   allocateStaging(size_t size, size_t &o_offset); // nullptr if staging is not available
+    void    submitStaging(); // must be called after the commands that read allocations are issued
+    void    releaseStaging();
+
+    static const int StagingSegments = 3; // staging can hold this many writes of largest size in flight
+
+    struct SyncInFlight
+    {
+        uint64_t fence_value;
+        GLsync sync;
+    };
+
+    int     m_staging_available = -1; // -1: not checked yet
+    GLuint  m_staging_buf = 0;
+    StagingRing m_staging_ring;
+    std::deque<SyncInFlight> m_syncs_in_flight; // in order of fence value
+    uint64_t m_fence_value = 0;     // last submitted
+    uint64_t m_completed_value = 0;
 };
 
 
@@ -73,12 +114,14 @@ void* GraphicsInterfaceOpenGL::getDevicePtr() { return nullptr; }
 DeviceType GraphicsInterfaceOpenGL::getDeviceType() { return DeviceType::OpenGL; }
 
 GraphicsInterfaceOpenGL::GraphicsInterfaceOpenGL(void *device)
+    : m_staging_ring(*this)
 {
     InitializeOpenGL();
 }
 
 GraphicsInterfaceOpenGL::~GraphicsInterfaceOpenGL()
 {
+    releaseStaging();
 }
 
 void GraphicsInterfaceOpenGL::release()
@@ -132,6 +175,92 @@ void GraphicsInterfaceOpenGL::sync()
     glFinish();
 }
 
+
+uint64_t GraphicsInterfaceOpenGL::getCompletedValue()
+{
+    // GL passes syncs in order
+    while (!m_syncs_in_flight.empty()) {
+        auto& s = m_syncs_in_flight.front();
+        GLenum r = _glClientWaitSync(s.sync, 0, 0);
+        if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED) { break; }
+        _glDeleteSync(s.sync);
+        m_completed_value = s.fence_value;
+        m_syncs_in_flight.pop_front();
+    }
+    return m_completed_value;
+}
+
+void GraphicsInterfaceOpenGL::wait(uint64_t value)
+{
+    while (!m_syncs_in_flight.empty() && m_syncs_in_flight.front().fence_value <= value) {
+        auto& s = m_syncs_in_flight.front();
+        _glClientWaitSync(s.sync, GL_SYNC_FLUSH_COMMANDS_BIT, ~GLuint64(0));
+        _glDeleteSync(s.sync);
+        m_completed_value = s.fence_value;
+        m_syncs_in_flight.pop_front();
+    }
+}
+
+bool GraphicsInterfaceOpenGL::isStagingAvailable()
+{
+    if (m_staging_available < 0) {
+        // persistent mapping requires OpenGL 4.4 or ARB_buffer_storage
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool has_version = major > 4 || (major == 4 && minor >= 4);
+        bool has_procs = _glBufferStorage && _glMapBufferRange && _glCopyBufferSubData && _glFenceSync && _glClientWaitSync && _glDeleteSync;
+        m_staging_available = has_version && has_procs ? 1 : 0;
+    }
+    return m_staging_available == 1;
+}
+
+char* GraphicsInterfaceOpenGL::allocateStaging(size_t size, size_t &o_offset)
+{
+    if (!isStagingAvailable()) { return nullptr; }
+
+    if (size > m_staging_ring.getCapacity() / StagingSegments) {
+        releaseStaging();
+
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        size_t capacity = roundup<4096>(size) * StagingSegments;
+        _glGenBuffers(1, &m_staging_buf);
+        _glBindBuffer(GL_COPY_WRITE_BUFFER, m_staging_buf);
+        _glBufferStorage(GL_COPY_WRITE_BUFFER, capacity, nullptr, flags);
+        char *mapped_data = (char*)_glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity, flags);
+        _glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if (!mapped_data) {
+            releaseStaging();
+            m_staging_available = 0;
+            return nullptr;
+        }
+        m_staging_ring.reset(mapped_data, capacity);
+    }
+
+    // 256: keep offsets aligned for any texel & element type
+    return m_staging_ring.allocate(size, 256, o_offset);
+}
+
+void GraphicsInterfaceOpenGL::submitStaging()
+{
+    SyncInFlight s = { ++m_fence_value, _glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) };
+    m_syncs_in_flight.push_back(s);
+    m_staging_ring.submit(s.fence_value);
+}
+
+void GraphicsInterfaceOpenGL::releaseStaging()
+{
+    // GPU may still be reading the buffer
+    m_staging_ring.reset(nullptr, 0);
+    wait(m_fence_value);
+
+    if (m_staging_buf) {
+        // deleting buffer unmaps it
+        _glDeleteBuffers(1, &m_staging_buf);
+        m_staging_buf = 0;
+    }
+}
+
 Result GraphicsInterfaceOpenGL::createTexture2D(void **dst_tex, int width, int height, TextureFormat format, const void *data, ResourceFlags flags)
 {
     GLenum gl_format = 0;
@@ -178,20 +307,47 @@ Result GraphicsInterfaceOpenGL::readTexture2D(void *dst, size_t /*read_size*/, v
     return ret;
 }
 
-Result GraphicsInterfaceOpenGL::writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t /*write_size*/)
+Result GraphicsInterfaceOpenGL::writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size)
 {
+    if (write_size == 0) { return Result::OK; }
+
+    // rows that contain write_size bytes
+    int pitch = width * GetTexelSize(format);
+    int num_rows = std::min<int>(height, (int)ceildiv<size_t>(write_size, pitch));
+    return writeTexture2D(dst_tex, 0, 0, width, num_rows, format, src);
+}
+
+Result GraphicsInterfaceOpenGL::writeTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src)
+{
+    if (width <= 0 || height <= 0) { return Result::OK; }
+    if (!src) { return Result::InvalidParameter; }
+
     GLenum gl_format = 0;
     GLenum gl_type = 0;
     GLenum gl_iformat = 0;
     GetGLTextureType(format, gl_format, gl_type, gl_iformat);
 
+    size_t copy_size = size_t(width) * height * GetTexelSize(format);
+
     // available OpenGL 4.5 or later
-    // glTextureSubImage2D((GLuint)(size_t)o_tex, 0, 0, 0, width, height, internal_format, internal_type, buf);
+    // glTextureSubImage2D((GLuint)(size_t)o_tex, 0, x, y, width, height, internal_format, internal_type, buf);
 
     auto ret = Result::OK;
+    size_t offset = 0;
+    char *staging = allocateStaging(copy_size, offset);
     glBindTexture(GL_TEXTURE_2D, (GLuint)(size_t)dst_tex);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, gl_format, gl_type, src);
-    ret = GetGLError();
+    if (staging) {
+        memcpy(staging, src, copy_size);
+        _glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_staging_buf);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, gl_format, gl_type, (const void*)offset);
+        ret = GetGLError();
+        _glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        submitStaging();
+    }
+    else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, gl_format, gl_type, src);
+        ret = GetGLError();
+    }
     glBindTexture(GL_TEXTURE_2D, 0);
     return ret;
 }
@@ -268,10 +424,29 @@ Result GraphicsInterfaceOpenGL::readBuffer(void *dst, void *src_buf, size_t read
 
 Result GraphicsInterfaceOpenGL::writeBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type)
 {
+    if (write_size == 0) { return Result::OK; }
+    if (!src) { return Result::InvalidParameter; }
+
     GLuint buf = (GLuint)(size_t)dst_buf;
     GLenum gltype = GetGLBufferType(type);
 
     Result ret = Result::OK;
+
+    // copy on GPU from staging. mapping dst_buf would wait until GPU is done with it.
+    size_t offset = 0;
+    char *staging = allocateStaging(write_size, offset);
+    if (staging) {
+        memcpy(staging, src, write_size);
+        _glBindBuffer(GL_COPY_READ_BUFFER, m_staging_buf);
+        _glBindBuffer(GL_COPY_WRITE_BUFFER, buf);
+        _glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, write_size);
+        ret = GetGLError();
+        _glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        _glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        submitStaging();
+        return ret;
+    }
+
     _glBindBuffer(gltype, buf);
     void *mapped_data = _glMapBuffer(gltype, GL_WRITE_ONLY);
     if (mapped_data) {
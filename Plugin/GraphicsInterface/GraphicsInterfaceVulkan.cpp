@@ -1,7 +1,9 @@
 #include "pch.h"
 #include "giInternal.h"
+#include "giStagingRing.h"
 
 #ifdef giSupportVulkan
+#include <deque>
 #ifdef _WIN32
     #define VK_USE_PLATFORM_WIN32_KHR
 #endif // _WIN32
@@ -54,7 +56,7 @@ private:
 
 
 
-class GraphicsInterfaceVulkan : public GraphicsInterface
+class GraphicsInterfaceVulkan : public GraphicsInterface, private StagingFence
 {
 public:
     GraphicsInterfaceVulkan(void *device);
@@ -69,20 +71,30 @@ public:
     void   releaseTexture2D(void *tex) override;
     Result readTexture2D(void *dst, size_t read_size, void *tex, int width, int height, TextureFormat format) override;
     Result writeTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *buf, size_t bufsize) override;
+    Result writeTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src) override;
 
     Result createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags) override;
     void   releaseBuffer(void *buf) override;
     Result readBuffer(void *dst, void *src_buf, size_t read_size, BufferType type) override;
     Result writeBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type) override;
 
+    Result enqueueWriteTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size) override;
+    Result enqueueWriteTexture2D(void *dst_tex, int x, int y, int width, int height, TextureFormat format, const void *src) override;
+    Result enqueueWriteBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type) override;
+
 private:
+    // StagingFence
+    uint64_t getCompletedValue() override;
+    void     wait(uint64_t value) override;
+
     uint32_t getMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties);
 
     enum class StagingFlag {
         Upload,
         Readback,
     };
-    VkResult createStagingBuffer(size_t size, StagingFlag flag, VkBuffer &buffer, VkDeviceMemory &memory);
+    VkResult createStagingBuffer(size_t size, StagingFlag flag, VkBuffer &buffer, VkDeviceMemory &memory,
+        VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
     VkResult createStagingBuffer(VkBuffer target, StagingFlag flag, VkBuffer &buffer, VkDeviceMemory &memory);
 #ifdef _M_X64
     VkResult createStagingBuffer(VkImage target, StagingFlag flag, VkBuffer &buffer, VkDeviceMemory &memory);
@@ -91,16 +103,41 @@ private:
     // Body: [](void *mapped_memory) -> void
     template<class Body> VkResult map(VkDeviceMemory device_memory, const Body& body);
 
+    bool prepareStagingRing();
+
     // Body: [](VkCommandBuffer clist) -> void
+    // returns right after submitting. o_fence_value is passed when GPU has executed the commands.
+    template<class Body> VkResult submitCommands(const Body& body, uint64_t &o_fence_value);
+    // submitCommands() and wait for completion
     template<class Body> VkResult executeCommands(const Body& body);
+    // release command buffers GPU has executed. if wait_value is not 0, wait until it is passed.
+    void retireCommands(uint64_t wait_value);
 
 private:
+    struct CommandsInFlight
+    {
+        uint64_t fence_value;
+        VkFence fence;
+        VkCommandBuffer clist;
+    };
+
+    // staging ring is placed on a host coherent buffer of this size. the buffer stays mapped.
+    static const size_t StagingRingSize = 8 * 1024 * 1024;
+
     VkPhysicalDevice m_physical_device = nullptr;
     VkDevice m_device = nullptr;
     VkQueue m_cqueue = nullptr;
     unique_handle<VkCommandPool> m_cpool = unique_handle<VkCommandPool>(nullptr);
 
     VkPhysicalDeviceMemoryProperties m_memory_properties;
+
+    std::deque<CommandsInFlight> m_commands_in_flight; // in order of fence value
+    uint64_t m_fence_value = 0;
+    uint64_t m_completed_value = 0;
+
+    VkBuffer m_staging_buffer = VK_NULL_HANDLE;
+    VkDeviceMemory m_staging_memory = VK_NULL_HANDLE;
+    StagingRing m_staging_ring;
 };
 
 
@@ -117,6 +154,7 @@ struct VulkanParams
 
 
 GraphicsInterfaceVulkan::GraphicsInterfaceVulkan(void *device)
+    : m_staging_ring(*this)
 {
     auto& vkparams = *(VulkanParams*)device;
     m_physical_device = vkparams.physical_device;
@@ -137,6 +175,18 @@ GraphicsInterfaceVulkan::GraphicsInterfaceVulkan(void *device)
 
 GraphicsInterfaceVulkan::~GraphicsInterfaceVulkan()
 {
+    // GPU may still be reading staging ring and command buffers
+    retireCommands(m_fence_value);
+    m_staging_ring.reset(nullptr, 0);
+    if (m_staging_memory) {
+        vkUnmapMemory(m_device, m_staging_memory);
+    }
+    if (m_staging_buffer) {
+        vkDestroyBuffer(m_device, m_staging_buffer, nullptr);
+    }
+    if (m_staging_memory) {
+        vkFreeMemory(m_device, m_staging_memory, nullptr);
+    }
 }
 
 void GraphicsInterfaceVulkan::release()
@@ -178,7 +228,7 @@ uint32_t GraphicsInterfaceVulkan::getMemoryType(uint32_t type_bits, VkMemoryProp
     return 0;
 }
 
-VkResult GraphicsInterfaceVulkan::createStagingBuffer(size_t size, StagingFlag flag, VkBuffer &buffer, VkDeviceMemory &memory)
+VkResult GraphicsInterfaceVulkan::createStagingBuffer(size_t size, StagingFlag flag, VkBuffer &buffer, VkDeviceMemory &memory, VkMemoryPropertyFlags properties)
 {
     VkBufferCreateInfo buf_info = {};
     buf_info.sType      = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -201,7 +251,7 @@ VkResult GraphicsInterfaceVulkan::createStagingBuffer(size_t size, StagingFlag f
     VkMemoryAllocateInfo mem_info = {};
     mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     mem_info.allocationSize = mem_required.size;
-    mem_info.memoryTypeIndex = getMemoryType(mem_required.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    mem_info.memoryTypeIndex = getMemoryType(mem_required.memoryTypeBits, properties);
 
     vr = vkAllocateMemory(m_device, &mem_info, nullptr, &memory);
     if (vr != VK_SUCCESS) { return vr; }
@@ -246,8 +296,61 @@ VkResult GraphicsInterfaceVulkan::map(VkDeviceMemory device_memory, const Body&
     return VK_SUCCESS;
 }
 
+bool GraphicsInterfaceVulkan::prepareStagingRing()
+{
+    if (m_staging_buffer) { return true; }
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void *mapped_memory = nullptr;
+    // coherent memory doesn't need flush after each write
+    auto vr = createStagingBuffer(StagingRingSize, StagingFlag::Upload, buffer, memory,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (vr == VK_SUCCESS) {
+        vr = vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, &mapped_memory);
+    }
+    if (vr != VK_SUCCESS) {
+        if (buffer) { vkDestroyBuffer(m_device, buffer, nullptr); }
+        if (memory) { vkFreeMemory(m_device, memory, nullptr); }
+        return false;
+    }
+
+    m_staging_buffer = buffer;
+    m_staging_memory = memory;
+    m_staging_ring.reset((char*)mapped_memory, StagingRingSize);
+    return true;
+}
+
+void GraphicsInterfaceVulkan::retireCommands(uint64_t wait_value)
+{
+    while (!m_commands_in_flight.empty()) {
+        auto& c = m_commands_in_flight.front();
+        if (c.fence_value <= wait_value) {
+            vkWaitForFences(m_device, 1, &c.fence, VK_TRUE, UINT64_MAX);
+        }
+        else if (vkGetFenceStatus(m_device, c.fence) != VK_SUCCESS) {
+            break;
+        }
+        m_completed_value = c.fence_value;
+        vkDestroyFence(m_device, c.fence, nullptr);
+        vkFreeCommandBuffers(m_device, m_cpool.get(), 1, &c.clist);
+        m_commands_in_flight.pop_front();
+    }
+}
+
+uint64_t GraphicsInterfaceVulkan::getCompletedValue()
+{
+    retireCommands(0);
+    return m_completed_value;
+}
+
+void GraphicsInterfaceVulkan::wait(uint64_t value)
+{
+    retireCommands(value);
+}
+
 template<class Body>
-VkResult GraphicsInterfaceVulkan::executeCommands(const Body& body)
+VkResult GraphicsInterfaceVulkan::submitCommands(const Body& body, uint64_t &o_fence_value)
 {
     auto clist = unique_handle<VkCommandBuffer>(m_device, m_cpool.get());
 
@@ -269,16 +372,39 @@ VkResult GraphicsInterfaceVulkan::executeCommands(const Body& body)
     vr = vkEndCommandBuffer(clist.get());
     if (vr != VK_SUCCESS) { return vr; }
 
+    VkFence fence = VK_NULL_HANDLE;
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    vr = vkCreateFence(m_device, &fence_info, nullptr, &fence);
+    if (vr != VK_SUCCESS) { return vr; }
+
     VkSubmitInfo submit_info = {};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = clist.addr();
-    vr = vkQueueSubmit(m_cqueue, 1, &submit_info, VK_NULL_HANDLE);
-    if (vr != VK_SUCCESS) { return vr; }
+    vr = vkQueueSubmit(m_cqueue, 1, &submit_info, fence);
+    if (vr != VK_SUCCESS) {
+        vkDestroyFence(m_device, fence, nullptr);
+        return vr;
+    }
 
-    vr = vkQueueWaitIdle(m_cqueue);
+    // command buffer is freed when GPU has executed it
+    CommandsInFlight c = { ++m_fence_value, fence, clist.get() };
+    m_commands_in_flight.push_back(c);
+    clist.detach();
+
+    o_fence_value = m_fence_value;
+    return VK_SUCCESS;
+}
+
+template<class Body>
+VkResult GraphicsInterfaceVulkan::executeCommands(const Body& body)
+{
+    uint64_t fence_value;
+    auto vr = submitCommands(body, fence_value);
     if (vr != VK_SUCCESS) { return vr; }
 
+    wait(fence_value);
     return VK_SUCCESS;
 }
 
@@ -287,6 +413,7 @@ VkResult GraphicsInterfaceVulkan::executeCommands(const Body& body)
 void GraphicsInterfaceVulkan::sync()
 {
     auto vr = vkQueueWaitIdle(m_cqueue);
+    retireCommands(0);
 }
 
 
@@ -441,6 +568,90 @@ Result GraphicsInterfaceVulkan::writeTexture2D(void *dst_tex_, int width, int he
     return Result::OK;
 }
 
+Result GraphicsInterfaceVulkan::writeTexture2D(void *dst_tex_, int x, int y, int width, int height, TextureFormat format, const void *src)
+{
+    if (width <= 0 || height <= 0) { return Result::OK; }
+    if (!dst_tex_ || !src) { return Result::InvalidParameter; }
+
+    auto dst_tex = (VkImage)dst_tex_;
+    size_t write_size = size_t(width) * height * GetTexelSize(format);
+
+    auto staging_buffer = unique_handle<VkBuffer>(m_device);
+    auto staging_memory = unique_handle<VkDeviceMemory>(m_device);
+    auto vr = createStagingBuffer(write_size, StagingFlag::Upload, staging_buffer.ref(), staging_memory.ref());
+    if (vr != VK_SUCCESS) { return TranslateReturnCode(vr); }
+
+    vr = map(staging_memory.get(), [&](void *mapped_memory) {
+        memcpy(mapped_memory, src, write_size);
+    });
+    if (vr != VK_SUCCESS) { return TranslateReturnCode(vr); }
+
+    vr = executeCommands([&](VkCommandBuffer clist) {
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { x, y, 0 };
+        region.imageExtent.width = width;
+        region.imageExtent.height = height;
+        region.imageExtent.depth = 1;
+        vkCmdCopyBufferToImage(clist, staging_buffer.get(), dst_tex, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    });
+    if (vr != VK_SUCCESS) { return TranslateReturnCode(vr); }
+
+    return Result::OK;
+}
+
+Result GraphicsInterfaceVulkan::enqueueWriteTexture2D(void *dst_tex, int width, int height, TextureFormat format, const void *src, size_t write_size)
+{
+    if (write_size == 0) { return Result::OK; }
+
+    // only rows that contain src are placed on staging ring and copied
+    size_t pitch = width * GetTexelSize(format);
+    int num_rows = std::min<int>(height, (int)ceildiv<size_t>(write_size, pitch));
+    return enqueueWriteTexture2D(dst_tex, 0, 0, width, num_rows, format, src);
+}
+
+Result GraphicsInterfaceVulkan::enqueueWriteTexture2D(void *dst_tex_, int x, int y, int width, int height, TextureFormat format, const void *src)
+{
+    if (width <= 0 || height <= 0) { return Result::OK; }
+    if (!dst_tex_ || !src) { return Result::InvalidParameter; }
+
+    auto dst_tex = (VkImage)dst_tex_;
+    size_t copy_size = size_t(width) * height * GetTexelSize(format);
+
+    size_t offset = 0;
+    char *staging = nullptr;
+    if (prepareStagingRing()) {
+        staging = m_staging_ring.allocate(copy_size, 256, offset);
+    }
+    if (!staging) {
+        // too large for staging ring
+        return writeTexture2D(dst_tex_, x, y, width, height, format, src);
+    }
+    memcpy(staging, src, copy_size);
+
+    uint64_t fence_value = 0;
+    auto vr = submitCommands([&](VkCommandBuffer clist) {
+        VkBufferImageCopy region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { x, y, 0 };
+        region.imageExtent.width = width;
+        region.imageExtent.height = height;
+        region.imageExtent.depth = 1;
+        vkCmdCopyBufferToImage(clist, m_staging_buffer, dst_tex, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }, fence_value);
+    // on failure GPU never reads the allocation. last issued fence releases it.
+    m_staging_ring.submit(vr == VK_SUCCESS ? fence_value : m_fence_value);
+
+    return TranslateReturnCode(vr);
+}
+
 
 Result GraphicsInterfaceVulkan::createBuffer(void **dst_buf, size_t size, BufferType type, const void *data, ResourceFlags flags)
 {
@@ -558,5 +769,33 @@ Result GraphicsInterfaceVulkan::writeBuffer(void *dst_buf, const void *src, size
     return Result::OK;
 }
 
+Result GraphicsInterfaceVulkan::enqueueWriteBuffer(void *dst_buf, const void *src, size_t write_size, BufferType type)
+{
+    if (write_size == 0) { return Result::OK; }
+    if (!dst_buf || !src) { return Result::InvalidParameter; }
+
+    auto buf = (VkBuffer)dst_buf;
+
+    size_t offset = 0;
+    char *staging = nullptr;
+    if (prepareStagingRing()) {
+        staging = m_staging_ring.allocate(write_size, 256, offset);
+    }
+    if (!staging) {
+        // too large for staging ring
+        return writeBuffer(dst_buf, src, write_size, type);
+    }
+    memcpy(staging, src, write_size);
+
+    uint64_t fence_value = 0;
+    auto vr = submitCommands([&](VkCommandBuffer clist) {
+        VkBufferCopy region = { offset, 0, write_size };
+        vkCmdCopyBuffer(clist, m_staging_buffer, buf, 1, &region);
+    }, fence_value);
+    m_staging_ring.submit(vr == VK_SUCCESS ? fence_value : m_fence_value);
+
+    return TranslateReturnCode(vr);
+}
+
 } // namespace gi
 #endif // giSupportVulkan
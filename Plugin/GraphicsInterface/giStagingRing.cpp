@@ -0,0 +1,87 @@
+#include "pch.h"
+#include "giStagingRing.h"
+
+namespace gi {
+
+StagingRing::StagingRing(StagingFence &fence)
+    : m_fence(fence)
+{
+}
+
+void StagingRing::reset(char *memory, size_t capacity)
+{
+    waitAll();
+    m_blocks.clear();
+    m_memory = memory;
+    m_capacity = memory ? capacity : 0;
+    m_head = 0;
+}
+
+size_t StagingRing::getCapacity() const { return m_capacity; }
+size_t StagingRing::getNumInFlight() const { return m_blocks.size(); }
+
+bool StagingRing::overlaps(size_t begin, size_t end) const
+{
+    for (auto& b : m_blocks) {
+        if (b.begin < end && begin < b.end) { return true; }
+    }
+    return false;
+}
+
+char* StagingRing::allocate(size_t size, size_t alignment, size_t &o_offset)
+{
+    if (!m_memory || size == 0 || size > m_capacity) { return nullptr; }
+
+    reclaim();
+    if (m_blocks.empty()) { m_head = 0; }
+
+    size_t begin = (m_head + alignment - 1) & ~(alignment - 1);
+    if (begin + size > m_capacity) { begin = 0; }
+    size_t end = begin + size;
+
+    // wait for oldest writes until the range is free. GPU passes fences in order.
+    while (overlaps(begin, end)) {
+        const Block &b = m_blocks.front();
+        if (!b.submitted) { return nullptr; }
+        m_fence.wait(b.fence);
+        m_blocks.pop_front();
+    }
+
+    Block block = { begin, end, 0, false };
+    m_blocks.push_back(block);
+    m_head = end;
+    o_offset = begin;
+    return m_memory + begin;
+}
+
+void StagingRing::submit(uint64_t fence_value)
+{
+    for (auto i = m_blocks.rbegin(); i != m_blocks.rend() && !i->submitted; ++i) {
+        i->fence = fence_value;
+        i->submitted = true;
+    }
+}
+
+void StagingRing::reclaim()
+{
+    if (m_blocks.empty() || !m_blocks.front().submitted) { return; }
+
+    uint64_t completed = m_fence.getCompletedValue();
+    while (!m_blocks.empty() && m_blocks.front().submitted && m_blocks.front().fence <= completed) {
+        m_blocks.pop_front();
+    }
+}
+
+void StagingRing::waitAll()
+{
+    // allocations not submitted are never read by GPU
+    while (!m_blocks.empty() && !m_blocks.back().submitted) {
+        m_blocks.pop_back();
+    }
+    if (!m_blocks.empty()) {
+        m_fence.wait(m_blocks.back().fence);
+        m_blocks.clear();
+    }
+}
+
+} // namespace gi
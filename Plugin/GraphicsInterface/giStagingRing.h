@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+namespace gi {
+
+// fence of the queue that reads staging memory. backends issue fence values in increasing order.
+class StagingFence
+{
+public:
+    virtual ~StagingFence() {}
+    virtual uint64_t getCompletedValue() = 0;   // GPU has passed every fence value <= this
+    virtual void     wait(uint64_t value) = 0;  // blocks until GPU passes value
+};
+
+
+// upload memory shared by writes in flight, used as a ring. backends map it once and hand it to reset().
+// space of an allocation is reused only after GPU has passed the fence given to submit() after it,
+// so the calling thread waits only when the ring is full of writes GPU has not read yet.
+class StagingRing
+{
+public:
+    explicit StagingRing(StagingFence &fence);
+
+    // memory is used from now on. waits for writes in flight on old memory.
+    void    reset(char *memory, size_t capacity);
+    size_t  getCapacity() const;
+
+    // returns nullptr if size doesn't fit, or if the ring is full of allocations not submitted yet.
+    // alignment must be power of 2. o_offset is from start of memory.
+    char*   allocate(size_t size, size_t alignment, size_t &o_offset);
+    // allocations made since last submit() are read by GPU commands that are followed by fence_value.
+    void    submit(uint64_t fence_value);
+    // releases allocations GPU has passed. never waits.
+    void    reclaim();
+    void    waitAll();
+    size_t  getNumInFlight() const;
+
+private:
+    struct Block
+    {
+        size_t begin, end;
+        uint64_t fence;
+        bool submitted;
+    };
+    bool overlaps(size_t begin, size_t end) const;
+
+    StagingFence &m_fence;
+    char *m_memory = nullptr;
+    size_t m_capacity = 0;
+    size_t m_head = 0;
+    std::deque<Block> m_blocks; // in order of allocation
+};
+
+} // namespace gi
@@ -1,11 +1,26 @@
 #include "pch.h"
 #include "mpInternal.h"
 #include "mpWorld.h"
+#include "mpSDF.h"
+#include "mpBakedField.h"
 #include "MassParticle.h"
 #include "GraphicsInterface.h"
 
 namespace {
     std::vector<mpWorld*> g_worlds;
+    std::vector<std::shared_ptr<mpSDFData>> g_sdfs;
+    std::vector<std::shared_ptr<mpBakedFieldData>> g_fields;
+
+    // builds colliders of batch APIs. body(i, collider) fills shape of i-th collider.
+    template<class Collider, class Body>
+    inline void mpBuildColliders(std::vector<Collider> &o, const mpColliderProperties *props, int num, const Body &body)
+    {
+        o.resize(std::max<int>(num, 0));
+        for (int i = 0; i < num; ++i) {
+            o[i].props = props[i];
+            body(i, o[i]);
+        }
+    }
 }
 
 extern "C" {
@@ -70,6 +85,30 @@ mpAPI void mpCallHandlers(int context)
     g_worlds[context]->callHandlers();
 }
 
+mpAPI void mpUpdateHitLists(int context)
+{
+    mpTraceFunc();
+    g_worlds[context]->updateHitLists();
+}
+
+mpAPI int mpGetHitList(int context, int owner_id, mpParticle ***particles)
+{
+    mpTraceFunc();
+    return g_worlds[context]->getHitList(owner_id, particles);
+}
+
+mpAPI void mpSetMaxThreads(int context, int num_threads)
+{
+    mpTraceFunc();
+    g_worlds[context]->setMaxThreads(num_threads);
+}
+
+mpAPI int mpGetNumSubsteps(int context)
+{
+    mpTraceFunc();
+    return g_worlds[context]->getNumSubsteps();
+}
+
 
 mpAPI void mpClearParticles(int context)
 {
@@ -122,97 +161,67 @@ mpAPI mpParticle* mpGetParticles(int context)
     return g_worlds[context]->getParticles();
 }
 
+mpAPI void mpAddParticles(int context, mpParticle *particles, int num_particles)
+{
+    mpTraceFunc();
+    if (num_particles <= 0) { return; }
+    g_worlds[context]->addParticles(particles, num_particles);
+}
 
-inline void mpApplySpawnParams(mpParticleCont &particles, const mpSpawnParams *params)
+mpAPI int mpEnqueueParticles(int context, const mpParticle *particles, int num_particles)
 {
     mpTraceFunc();
-    if (params == nullptr) return;
+    if (num_particles <= 0) { return 0; }
+    return g_worlds[context]->enqueueParticles(particles, num_particles);
+}
 
-    vec3 vel = params->velocity_base;
-    float vel_diffuse = params->velocity_random_diffuse;
-    float lifetime = params->lifetime;
-    float lifetime_diffuse = params->lifetime_random_diffuse;
-    int userdata = params->userdata;
-    mpHitHandler handler = params->handler;
+mpAPI void mpSetSpawnQueueCapacity(int context, int capacity)
+{
+    mpTraceFunc();
+    g_worlds[context]->setSpawnQueueCapacity(capacity);
+}
 
-    for (auto &p : particles) {
-        (vec3&)p.velocity = vec3(
-            vel.x + mpGenRand()*vel_diffuse,
-            vel.y + mpGenRand()*vel_diffuse,
-            vel.z + mpGenRand()*vel_diffuse);
-        p.lifetime = lifetime + mpGenRand()*lifetime_diffuse;
-        p.userdata = userdata;
-    }
-    if (handler) {
-        for (auto &p : particles) {
-            handler(&p);
-        }
-    }
+
+// unit shape -> shape of center & radius (or half size)
+inline mat4 mpScatterTransform(const vec3 &center, const vec3 &scale)
+{
+    mat4 r;
+    r[0][0] = scale.x;
+    r[1][1] = scale.y;
+    r[2][2] = scale.z;
+    r[3] = vec4(center, 1.0f);
+    return r;
 }
 
 mpAPI void mpScatterParticlesSphere(int context, vec3 *center, float radius, int32_t num, const mpSpawnParams *params)
 {
     mpTraceFunc();
-    if (num <= 0) { return; }
-
-    mpParticleCont particles(num);
-    for (auto &p : particles) {
-        float l = mpGenRand()*radius;
-        vec3 dir = glm::normalize(vec3(mpGenRand(), mpGenRand(), mpGenRand()));
-        vec3 pos = *center + dir*l;
-        (vec3&)p.position = pos;
-    }
-    mpApplySpawnParams(particles, params);
-    g_worlds[context]->addParticles(particles.data(), particles.size());
+    g_worlds[context]->scatterParticles(mpScatterShape_Sphere, mpScatterTransform(*center, vec3(radius * 2.0f)), num, params);
 }
 
 mpAPI void mpScatterParticlesBox(int context, vec3 *center, vec3 *size, int32_t num, const mpSpawnParams *params)
 {
     mpTraceFunc();
-    if (num <= 0) { return; }
-
-    mpParticleCont particles(num);
-    for (auto &p : particles) {
-        vec3 pos = *center + vec3(mpGenRand()*size->x, mpGenRand()*size->y, mpGenRand()*size->z);
-        (vec3&)p.position = pos;
-    }
-    mpApplySpawnParams(particles, params);
-    g_worlds[context]->addParticles(particles.data(), particles.size());
+    g_worlds[context]->scatterParticles(mpScatterShape_Box, mpScatterTransform(*center, *size * 2.0f), num, params);
 }
 
 
 mpAPI void mpScatterParticlesSphereTransform(int context, mat4 *transform, int32_t num, const mpSpawnParams *params)
 {
     mpTraceFunc();
-    if (num <= 0) { return; }
-
-    mpParticleCont particles(num);
-    simdmat4 mat(*transform);
-    for (auto &p : particles) {
-        vec3 dir = glm::normalize(vec3(mpGenRand(), mpGenRand(), mpGenRand()));
-        float l = mpGenRand()*0.5f;
-        simdvec4 pos = simdvec4(dir*l, 1.0f);
-        pos = mat * pos;
-        (vec3&)p.position = (vec3&)pos;
-    }
-    mpApplySpawnParams(particles, params);
-    g_worlds[context]->addParticles(particles.data(), particles.size());
+    g_worlds[context]->scatterParticles(mpScatterShape_Sphere, *transform, num, params);
 }
 
 mpAPI void mpScatterParticlesBoxTransform(int context, mat4 *transform, int32_t num, const mpSpawnParams *params)
 {
     mpTraceFunc();
-    if (num <= 0) { return; }
+    g_worlds[context]->scatterParticles(mpScatterShape_Box, *transform, num, params);
+}
 
-    mpParticleCont particles(num);
-    simdmat4 mat(*transform);
-    for (auto &p : particles) {
-        simdvec4 pos(mpGenRand()*0.5f, mpGenRand()*0.5f, mpGenRand()*0.5f, 1.0f);
-        pos = mat * pos;
-        (vec3&)p.position = (vec3&)pos;
-    }
-    mpApplySpawnParams(particles, params);
-    g_worlds[context]->addParticles(particles.data(), particles.size());
+mpAPI void mpSetSpawnSeed(int context, uint32_t seed)
+{
+    mpTraceFunc();
+    g_worlds[context]->setSpawnSeed(seed);
 }
 
 
@@ -302,6 +311,39 @@ inline void mpBuildCapsuleCollider(int context, mpCapsuleCollider &o, vec3 pos1,
     (vec3&)o.bounds.ur = glm::max((vec3&)shape.pos1 + er, (vec3&)(shape.pos2) + er);
 }
 
+inline void mpBuildSDFCollider(int context, mpSDFCollider &o, const mat4 &transform, const mpSDFData &sdf)
+{
+    mpTraceFunc();
+
+    float psize = g_worlds[context]->getKernelParams().particle_size;
+    mat4 to_local = glm::inverse(transform);
+
+    mpSDF &shape = o.shape;
+    shape.distances = (float*)sdf.distances.data();
+    (ivec3&)shape.div = sdf.div;
+    (vec3&)shape.origin = sdf.origin;
+    shape.rcp_cell_size = 1.0f / sdf.cell_size;
+    for (int r = 0; r < 3; ++r) {
+        (vec3&)shape.to_local[r] = vec3(to_local[0][r], to_local[1][r], to_local[2][r]);
+        (vec3&)shape.to_world[r] = vec3(transform[0][r], transform[1][r], transform[2][r]);
+    }
+    (vec3&)shape.to_local[3] = vec3(to_local[3]);
+    shape.scale = (glm::length(vec3(transform[0])) + glm::length(vec3(transform[1])) + glm::length(vec3(transform[2]))) / 3.0f;
+    shape.offset = psize;
+
+    vec3 size = vec3(sdf.div - 1) * sdf.cell_size;
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = sdf.origin + size * vec3(float(i & 1), float((i >> 1) & 1), float((i >> 2) & 1));
+        vec3 p = vec3(transform * vec4(corner, 1.0f));
+        if (i == 0) {
+            (vec3&)o.bounds.bl = p;
+            (vec3&)o.bounds.ur = p;
+        }
+        (vec3&)o.bounds.bl = glm::min((vec3&)o.bounds.bl, p - psize);
+        (vec3&)o.bounds.ur = glm::max((vec3&)o.bounds.ur, p + psize);
+    }
+}
+
 
 mpAPI void mpAddBoxCollider(int context, mpColliderProperties *props, mat4 *transform, vec3 *size, vec3 *center)
 {
@@ -337,14 +379,161 @@ mpAPI void mpAddCapsuleCollider(int context, mpColliderProperties *props, vec3 *
     g_worlds[context]->addCapsuleColliders(&col, 1);
 }
 
-mpAPI void mpAddForce(int context, mpForceProperties *props, mat4 *_trans)
+mpAPI void mpAddSphereColliders(int context, const mpColliderProperties *props, const vec3 *centers, const float *radii, int num)
 {
     mpTraceFunc();
-    mat4 &trans = *_trans;
-    mpForce force;
-    force.props = *props;
+    std::vector<mpSphereCollider> cols;
+    mpBuildColliders(cols, props, num, [&](int i, mpSphereCollider &col) { mpBuildSphereCollider(context, col, centers[i], radii[i]); });
+    g_worlds[context]->addSphereColliders(cols.data(), cols.size());
+}
+
+mpAPI void mpAddCapsuleColliders(int context, const mpColliderProperties *props, const vec3 *pos1, const vec3 *pos2, const float *radii, int num)
+{
+    mpTraceFunc();
+    std::vector<mpCapsuleCollider> cols;
+    mpBuildColliders(cols, props, num, [&](int i, mpCapsuleCollider &col) { mpBuildCapsuleCollider(context, col, pos1[i], pos2[i], radii[i]); });
+    g_worlds[context]->addCapsuleColliders(cols.data(), cols.size());
+}
 
-    switch ((mpForceShape)force.props.shape_type) {
+mpAPI void mpAddBoxColliders(int context, const mpColliderProperties *props, const mat4 *transforms, const vec3 *centers, const vec3 *sizes, int num)
+{
+    mpTraceFunc();
+    std::vector<mpBoxCollider> cols;
+    mpBuildColliders(cols, props, num, [&](int i, mpBoxCollider &col) { mpBuildBoxCollider(context, col, transforms[i], centers[i], sizes[i]); });
+    g_worlds[context]->addBoxColliders(cols.data(), cols.size());
+}
+
+mpAPI void mpCreateSphereColliders(int context, const mpColliderProperties *props, const vec3 *centers, const float *radii, int num, int *o_handles)
+{
+    mpTraceFunc();
+    std::vector<mpSphereCollider> cols;
+    mpBuildColliders(cols, props, num, [&](int i, mpSphereCollider &col) { mpBuildSphereCollider(context, col, centers[i], radii[i]); });
+    g_worlds[context]->createColliders(cols.data(), cols.size(), o_handles);
+}
+
+mpAPI void mpCreateCapsuleColliders(int context, const mpColliderProperties *props, const vec3 *pos1, const vec3 *pos2, const float *radii, int num, int *o_handles)
+{
+    mpTraceFunc();
+    std::vector<mpCapsuleCollider> cols;
+    mpBuildColliders(cols, props, num, [&](int i, mpCapsuleCollider &col) { mpBuildCapsuleCollider(context, col, pos1[i], pos2[i], radii[i]); });
+    g_worlds[context]->createColliders(cols.data(), cols.size(), o_handles);
+}
+
+mpAPI void mpCreateBoxColliders(int context, const mpColliderProperties *props, const mat4 *transforms, const vec3 *centers, const vec3 *sizes, int num, int *o_handles)
+{
+    mpTraceFunc();
+    std::vector<mpBoxCollider> cols;
+    mpBuildColliders(cols, props, num, [&](int i, mpBoxCollider &col) { mpBuildBoxCollider(context, col, transforms[i], centers[i], sizes[i]); });
+    g_worlds[context]->createColliders(cols.data(), cols.size(), o_handles);
+}
+
+mpAPI void mpUpdateSphereColliders(int context, const int *handles, const mpColliderProperties *props, const vec3 *centers, const float *radii, int num)
+{
+    mpTraceFunc();
+    std::vector<mpSphereCollider> cols;
+    mpBuildColliders(cols, props, num, [&](int i, mpSphereCollider &col) { mpBuildSphereCollider(context, col, centers[i], radii[i]); });
+    g_worlds[context]->updateColliders(handles, cols.data(), cols.size());
+}
+
+mpAPI void mpUpdateCapsuleColliders(int context, const int *handles, const mpColliderProperties *props, const vec3 *pos1, const vec3 *pos2, const float *radii, int num)
+{
+    mpTraceFunc();
+    std::vector<mpCapsuleCollider> cols;
+    mpBuildColliders(cols, props, num, [&](int i, mpCapsuleCollider &col) { mpBuildCapsuleCollider(context, col, pos1[i], pos2[i], radii[i]); });
+    g_worlds[context]->updateColliders(handles, cols.data(), cols.size());
+}
+
+mpAPI void mpUpdateBoxColliders(int context, const int *handles, const mpColliderProperties *props, const mat4 *transforms, const vec3 *centers, const vec3 *sizes, int num)
+{
+    mpTraceFunc();
+    std::vector<mpBoxCollider> cols;
+    mpBuildColliders(cols, props, num, [&](int i, mpBoxCollider &col) { mpBuildBoxCollider(context, col, transforms[i], centers[i], sizes[i]); });
+    g_worlds[context]->updateColliders(handles, cols.data(), cols.size());
+}
+
+mpAPI void mpDestroyColliders(int context, const int *handles, int num)
+{
+    mpTraceFunc();
+    g_worlds[context]->destroyColliders(handles, std::max<int>(num, 0));
+}
+
+mpAPI int mpIsValidColliderHandle(int context, int handle)
+{
+    mpTraceFunc();
+    return g_worlds[context]->isValidHandle(handle) ? 1 : 0;
+}
+
+inline int mpRegisterSDF(const std::shared_ptr<mpSDFData> &sdf)
+{
+    if (g_sdfs.empty()) {
+        g_sdfs.push_back(nullptr);
+    }
+    for (int i = 1; i < (int)g_sdfs.size(); ++i) {
+        if (g_sdfs[i] == nullptr) {
+            g_sdfs[i] = sdf;
+            return i;
+        }
+    }
+    g_sdfs.push_back(sdf);
+    return (int)g_sdfs.size() - 1;
+}
+
+mpAPI int mpCreateSDF(const float *distances, ivec3 *div, vec3 *origin, float cell_size)
+{
+    mpTraceFunc();
+    std::shared_ptr<mpSDFData> sdf(new mpSDFData());
+    if (!sdf->assign(distances, *div, *origin, cell_size)) { return 0; }
+    return mpRegisterSDF(sdf);
+}
+
+mpAPI int mpCreateSDFFromMesh(const vec3 *vertices, int num_vertices, const int *indices, int num_indices, float cell_size)
+{
+    mpTraceFunc();
+    std::shared_ptr<mpSDFData> sdf(new mpSDFData());
+    if (!sdf->bake(vertices, num_vertices, indices, num_indices, cell_size)) { return 0; }
+    return mpRegisterSDF(sdf);
+}
+
+mpAPI void mpDestroySDF(int sdf)
+{
+    mpTraceFunc();
+    if (sdf <= 0 || sdf >= (int)g_sdfs.size()) { return; }
+    g_sdfs[sdf].reset();
+}
+
+mpAPI void mpAddSDFCollider(int context, mpColliderProperties *props, mat4 *transform, int sdf)
+{
+    mpTraceFunc();
+    if (sdf <= 0 || sdf >= (int)g_sdfs.size() || g_sdfs[sdf] == nullptr) { return; }
+    mpSDFCollider col;
+    col.props = *props;
+    mpBuildSDFCollider(context, col, *transform, *g_sdfs[sdf]);
+    g_worlds[context]->addSDFColliders(&col, 1, g_sdfs[sdf]);
+}
+
+inline void mpBuildForce(int context, mpForce &force, const mpForceProperties &props, const mat4 &trans)
+{
+    mpTraceFunc();
+    force.props = props;
+    force.spline_begin = 0;
+    force.spline_num = 0;
+    force.field.vectors = nullptr;
+
+    // local y axis of the transform. used by Capsule shape and RadialCapsule direction.
+    {
+        mpCapsuleCollider col;
+        vec3 pos = (vec3&)trans[3];
+        vec3 axis = (vec3&)trans[1] * 0.5f;
+        float radius = (glm::length((vec3&)trans[0]) + glm::length((vec3&)trans[2])) * 0.5f * 0.5f;
+        mpBuildCapsuleCollider(context, col, pos - axis, pos + axis, radius);
+        if (glm::length_sq(axis) == 0.0f) { col.shape.rcp_lensq = 0.0f; }
+        force.capsule = col.shape;
+        if ((mpForceShape)props.shape_type == mpForceShape::Capsule) {
+            force.bounds = col.bounds;
+        }
+    }
+
+    switch ((mpForceShape)props.shape_type) {
     case mpForceShape::Sphere:
         {
             mpSphereCollider col;
@@ -357,18 +546,6 @@ mpAPI void mpAddForce(int context, mpForceProperties *props, mat4 *_trans)
         }
         break;
 
-    case mpForceShape::Capsule:
-        {
-            mpCapsuleCollider col;
-            vec3 pos = (vec3&)trans[3];
-            float radius = (trans[0][0] + trans[2][2]) * 0.5f * 0.5f;
-            mpBuildCapsuleCollider(context, col, pos, pos, radius);
-            force.bounds = col.bounds;
-            force.sphere.center = col.shape.center;
-            force.sphere.radius = col.shape.radius;
-        }
-        break;
-
     case mpForceShape::Box:
         {
             mpBoxCollider col;
@@ -382,9 +559,139 @@ mpAPI void mpAddForce(int context, mpForceProperties *props, mat4 *_trans)
         break;
 
     }
+}
+
+// samples catmull-rom spline that passes through all points. end points are repeated.
+// coincident points are skipped so that every segment of the polyline has length.
+inline void mpBuildSplinePolyline(std::vector<vec3> &o, const vec3 *points, int num_points)
+{
+    const int div = 8;
+    std::vector<vec3> cps;
+    for (int i = 0; i < num_points; ++i) {
+        if (cps.empty() || glm::length_sq(points[i] - cps.back()) > 0.0f) { cps.push_back(points[i]); }
+    }
+    const int num_cps = (int)cps.size();
+
+    o.clear();
+    auto push = [&](const vec3 &p) {
+        if (o.empty() || glm::length_sq(p - o.back()) > 0.0f) { o.push_back(p); }
+    };
+    for (int i = 0; i + 1 < num_cps; ++i) {
+        const vec3 &p0 = cps[std::max<int>(i - 1, 0)];
+        const vec3 &p1 = cps[i];
+        const vec3 &p2 = cps[i + 1];
+        const vec3 &p3 = cps[std::min<int>(i + 2, num_cps - 1)];
+        for (int j = 0; j < div; ++j) {
+            float t = float(j) / float(div);
+            float t2 = t * t;
+            float t3 = t2 * t;
+            push(((p1 * 2.0f) + (p2 - p0) * t + (p0 * 2.0f - p1 * 5.0f + p2 * 4.0f - p3) * t2 + (p1 * 3.0f - p0 - p2 * 3.0f + p3) * t3) * 0.5f);
+        }
+    }
+    if (num_cps > 0) { push(cps.back()); }
+}
+
+mpAPI void mpAddForce(int context, mpForceProperties *props, mat4 *_trans)
+{
+    mpTraceFunc();
+    mpForce force;
+    mpBuildForce(context, force, *props, *_trans);
     g_worlds[context]->addForces(&force, 1);
 }
 
+inline void mpBuildBakedField(mpBakedField &o, const mat4 &transform, const mpBakedFieldData &field)
+{
+    mpTraceFunc();
+
+    mat4 to_local = glm::inverse(transform);
+    vec3 axes[3];
+    for (int c = 0; c < 3; ++c) {
+        float len = glm::length(vec3(transform[c]));
+        axes[c] = len > 0.0f ? vec3(transform[c]) / len : vec3(0.0f);
+    }
+
+    o.vectors = (float*)field.vectors.data();
+    (ivec3&)o.div = field.div;
+    (ivec3&)o.bricks = field.bricks;
+    (vec3&)o.origin = field.origin;
+    o.rcp_cell_size = 1.0f / field.cell_size;
+    for (int r = 0; r < 3; ++r) {
+        (vec3&)o.to_local[r] = vec3(to_local[0][r], to_local[1][r], to_local[2][r]);
+        (vec3&)o.to_world[r] = vec3(axes[0][r], axes[1][r], axes[2][r]);
+    }
+    (vec3&)o.to_local[3] = vec3(to_local[3]);
+}
+
+inline int mpRegisterBakedField(const std::shared_ptr<mpBakedFieldData> &field)
+{
+    if (g_fields.empty()) {
+        g_fields.push_back(nullptr);
+    }
+    for (int i = 1; i < (int)g_fields.size(); ++i) {
+        if (g_fields[i] == nullptr) {
+            g_fields[i] = field;
+            return i;
+        }
+    }
+    g_fields.push_back(field);
+    return (int)g_fields.size() - 1;
+}
+
+mpAPI int mpCreateBakedField(const vec3 *vectors, ivec3 *div, vec3 *origin, float cell_size)
+{
+    mpTraceFunc();
+    std::shared_ptr<mpBakedFieldData> field(new mpBakedFieldData());
+    if (!field->assign(vectors, *div, *origin, cell_size)) { return 0; }
+    return mpRegisterBakedField(field);
+}
+
+mpAPI bool mpUpdateBakedField(int field, const vec3 *vectors, ivec3 *offset, ivec3 *size)
+{
+    mpTraceFunc();
+    if (field <= 0 || field >= (int)g_fields.size() || g_fields[field] == nullptr) { return false; }
+    return g_fields[field]->update(vectors, *offset, *size);
+}
+
+mpAPI void mpDestroyBakedField(int field)
+{
+    mpTraceFunc();
+    if (field <= 0 || field >= (int)g_fields.size()) { return; }
+    g_fields[field].reset();
+}
+
+mpAPI void mpAddBakedFieldForce(int context, mpForceProperties *props, mat4 *_trans, int field)
+{
+    mpTraceFunc();
+    if (field <= 0 || field >= (int)g_fields.size() || g_fields[field] == nullptr) { return; }
+
+    mpForce force;
+    mpBuildForce(context, force, *props, *_trans);
+    mpBuildBakedField(force.field, *_trans, *g_fields[field]);
+    g_worlds[context]->addBakedFieldForce(force, g_fields[field]);
+}
+
+mpAPI void mpAddForces(int context, const mpForceProperties *props, const mat4 *trans, int num)
+{
+    mpTraceFunc();
+    std::vector<mpForce> forces(std::max<int>(num, 0));
+    for (int i = 0; i < num; ++i) {
+        mpBuildForce(context, forces[i], props[i], trans[i]);
+    }
+    g_worlds[context]->addForces(forces.data(), forces.size());
+}
+
+mpAPI void mpAddSplineForce(int context, mpForceProperties *props, mat4 *_trans, const vec3 *points, int num_points)
+{
+    mpTraceFunc();
+    std::vector<vec3> polyline;
+    mpBuildSplinePolyline(polyline, points, num_points);
+    if (polyline.size() < 2) { return; }
+
+    mpForce force;
+    mpBuildForce(context, force, *props, *_trans);
+    g_worlds[context]->addSplineForce(force, polyline.data(), polyline.size());
+}
+
 mpAPI void mpScanSphere(int context, mpHitHandler handler, vec3 *center, float radius)
 {
     mpTraceFunc();
@@ -427,6 +734,31 @@ mpAPI void mpMoveAll(int context, vec3 *move_amount)
     g_worlds[context]->moveAll(*move_amount);
 }
 
+
+mpAPI int mpGetProfileStats(int context, mpProfileStats *stats, int num_stats)
+{
+    mpTraceFunc();
+    return g_worlds[context]->getProfiler().getStats(stats, num_stats);
+}
+
+mpAPI const char* mpGetProfilePhaseName(mpProfilePhase phase)
+{
+    mpTraceFunc();
+    return mpProfiler::getPhaseName(phase);
+}
+
+mpAPI void mpResetProfileStats(int context)
+{
+    mpTraceFunc();
+    g_worlds[context]->getProfiler().reset();
+}
+
+mpAPI bool mpDumpProfileTrace(int context, const char *path)
+{
+    mpTraceFunc();
+    return g_worlds[context]->getProfiler().dumpTrace(path);
+}
+
 } // extern "C"
 
 void mpSetGraphicsInterface(mpGraphicsInterfaceType device_type, void* device_ptr)
@@ -24,6 +24,13 @@ enum class mpSolverType
     SPHEst,
 };
 
+// layout of particles in data texture. see mpUpdateDataTexture()
+enum class mpRenderFormat
+{
+    Full,       // 3 RGBAf32 texels: (position, id), (velocity, speed), (hash, lifetime, hit, userdata)
+    Compact,    // 2 RGBAf16 texels: (position, id & 2047), (velocity, lifetime)
+};
+
 enum class mpForceShape
 {
     AffectAll,
@@ -32,14 +39,44 @@ enum class mpForceShape
     Box,
 };
 
+// must match ForceDirection in mpCollision.h
 enum class mpForceType
 {
     Directional,
     Radial,
-    RadialCapsule,
-    Vortex,
-    Spline,
+    RadialCapsule,  // away from local y axis of the force's transform
     VectorField,
+    Vortex,         // around the axis that passes center along direction
+    Spline,         // along the spline given to mpAddSplineForce()
+    BakedField,     // along the field given to mpAddBakedFieldForce()
+};
+
+enum class mpProfilePhase
+{
+    Update,         // whole mpWorld::update()
+    GenHash,
+    Compact,        // dropping dead particles
+    Sort,
+    BuildCells,
+    Gather,
+    NeighborList,
+    Broadphase,
+    Interaction,    // impulse solver processes forces & colliders in this phase too
+    Integrate,      // SPH solvers process forces & colliders in this phase too
+    GPUClone,
+    CallHandlers,   // whole mpWorld::callHandlers()
+    HitHandlers,
+    ForceHandlers,
+    Num,
+};
+
+struct mpProfileStats
+{
+    float min_ms;
+    float avg_ms;
+    float max_ms;
+    float avg_tasks;    // parallel blocks run in the phase. blocks inside sort & scan are not counted
+    int num_samples;    // number of recent updates the phase ran in
 };
 
 #ifdef mpImpl
@@ -82,12 +119,22 @@ enum class mpForceType
         float SPHParticleMass;
         float SPHViscosity;
         float reserved[4];
+        int32_t sparse_grid;        // hashed grid. only occupied cells are stored and world_div is not clamped to 1024.
+        int32_t neighbor_list;      // cache neighbors of each particle and reuse them while particles move less than half of skin.
+        float neighbor_list_skin;
+        int32_t half_stencil;       // impulse solver evaluates each particle pair once. deterministic regardless of thread count.
+        int32_t adaptive_substeps;  // integrate dt of mpUpdate() in substeps instead of one step of timestep. see mpGetNumSubsteps().
+        float substep_cfl;          // number of substeps is chosen so that the fastest particle moves at most substep_cfl * particle_size in a substep.
+        int32_t max_substeps;
+        mpRenderFormat render_format; // data texture must be RGBAf16 if Compact
 
         mpKernelParams()
         {
             world_center = mpV3(0.0f, 0.0f, 0.0f);
             world_extent = mpV3(10.24f, 10.24f, 10.24f);
             world_div    = mpV3i(128, 128, 128);
+            active_region_center = mpV3(0.0f, 0.0f, 0.0f);
+            active_region_extent = mpV3(0.0f, 0.0f, 0.0f);
             coord_scaler = mpV3(1.0f, 1.0f, 1.0f);
 
             solver_type = mpSolverType::Impulse;
@@ -107,6 +154,15 @@ enum class mpForceType
             SPHRestDensity = 1000.0f;
             SPHParticleMass = 0.002f;
             SPHViscosity = 0.1f;
+
+            sparse_grid = 0;
+            neighbor_list = 0;
+            neighbor_list_skin = 0.02f;
+            half_stencil = 0;
+            adaptive_substeps = 0;
+            substep_cfl = 0.5f;
+            max_substeps = 8;
+            render_format = mpRenderFormat::Full;
         }
 
     };
@@ -146,6 +202,7 @@ enum class mpForceType
 
     typedef void(__stdcall *mpHitHandler)(mpParticle *p);
     typedef void(__stdcall *mpForceHandler)(mpParticleForce *p);
+    typedef void(__stdcall *mpBatchHitHandler)(int owner_id, mpParticle **particles, int num);
 
     struct mpSpawnParams
     {
@@ -163,6 +220,7 @@ enum class mpForceType
         float stiffness;
         mpHitHandler hit_handler;
         mpForceHandler force_handler;
+        mpBatchHitHandler batch_hit_handler; // called once per collider with all particles hit. hit_handler is not called if this is set
     };
 
     struct mpForceProperties
@@ -194,6 +252,12 @@ mpAPI void           mpUpdate(int context, float dt);
 mpAPI void           mpBeginUpdate(int context, float dt);   // async version
 mpAPI void           mpEndUpdate(int context);               // 
 mpAPI void           mpCallHandlers(int context);
+// pull version of batch_hit_handler. mpUpdateHitLists() groups hit particles by collider,
+// and mpGetHitList() returns particles hit by the collider of owner_id. valid until next update.
+mpAPI void           mpUpdateHitLists(int context);
+mpAPI int            mpGetHitList(int context, int owner_id, mpParticle ***particles);
+mpAPI void           mpSetMaxThreads(int context, int num_threads);  // threads used by update & handlers. 0: no limit
+mpAPI int            mpGetNumSubsteps(int context);  // substeps taken in last update. 1 unless adaptive_substeps is enabled
 
 mpAPI void           mpClearParticles(int context);
 mpAPI void           mpClearCollidersAndForces(int context);
@@ -205,17 +269,54 @@ mpAPI int            mpGetNumParticles(int context);
 mpAPI void           mpForceSetNumParticles(int context, int num);
 mpAPI mpParticleIM*  mpGetIntermediateData(int context, int nth=-1);
 mpAPI mpParticle*    mpGetParticles(int context);
-mpAPI void           mpAddParticles(int context, mpParticle *particles, int num_particles);
+// while async update is running, particles are queued and added at start of next update. particles the spawn queue can't take
+// are kept and added at mpEndUpdate() instead, so none are dropped. like other times, particles beyond max_particles are ignored.
+mpAPI void           mpAddParticles(int context, mpParticle *particles, int num_particles); // also scatter functions below
+// thread safe. can be called at any time, even while async update is running. particles are added at start of next update.
+// returns number of particles accepted. less than num_particles if the spawn queue is full.
+mpAPI int            mpEnqueueParticles(int context, const mpParticle *particles, int num_particles);
+mpAPI void           mpSetSpawnQueueCapacity(int context, int capacity); // not thread safe. pending particles are discarded. default 16384
 mpAPI void           mpScatterParticlesSphere(int context, mpV3 *center, float radius, int num, const mpSpawnParams *params);
 mpAPI void           mpScatterParticlesBox(int context, mpV3 *center, mpV3 *size, int num, const mpSpawnParams *params);
 mpAPI void           mpScatterParticlesSphereTransform(int context, mpM44 *transform, int num, const mpSpawnParams *params);
 mpAPI void           mpScatterParticlesBoxTransform(int context, mpM44 *transform, int num, const mpSpawnParams *params);
+// scatter functions give same particles for same seed and same sequence of calls. setting seed restarts the sequence.
+mpAPI void           mpSetSpawnSeed(int context, uint32_t seed);
 
 mpAPI void           mpAddSphereCollider(int context, mpColliderProperties *props, mpV3 *center, float radius);
 mpAPI void           mpAddCapsuleCollider(int context, mpColliderProperties *props, mpV3 *pos1, mpV3 *pos2, float radius);
 mpAPI void           mpAddBoxCollider(int context, mpColliderProperties *props, mpM44 *transform, mpV3 *center, mpV3 *size);
-mpAPI void           mpRemoveCollider(int context, mpColliderProperties *props);
+mpAPI void           mpRemoveCollider(int context, mpColliderProperties *props); // removes the collider added with props->owner_id. O(1)
+// batch versions of above. props and shapes are arrays of num elements.
+mpAPI void           mpAddSphereColliders(int context, const mpColliderProperties *props, const mpV3 *centers, const float *radii, int num);
+mpAPI void           mpAddCapsuleColliders(int context, const mpColliderProperties *props, const mpV3 *pos1, const mpV3 *pos2, const float *radii, int num);
+mpAPI void           mpAddBoxColliders(int context, const mpColliderProperties *props, const mpM44 *transforms, const mpV3 *centers, const mpV3 *sizes, int num);
+// persistent colliders. they are not removed by mpClearCollidersAndForces(), and updated in place by handle. handles are never 0.
+// shapes are built with particle_size at the time of create / update. invalid handles are ignored.
+// while async update is running, changes are applied at mpEndUpdate(). handles are valid right away.
+mpAPI void           mpCreateSphereColliders(int context, const mpColliderProperties *props, const mpV3 *centers, const float *radii, int num, int *handles);
+mpAPI void           mpCreateCapsuleColliders(int context, const mpColliderProperties *props, const mpV3 *pos1, const mpV3 *pos2, const float *radii, int num, int *handles);
+mpAPI void           mpCreateBoxColliders(int context, const mpColliderProperties *props, const mpM44 *transforms, const mpV3 *centers, const mpV3 *sizes, int num, int *handles);
+mpAPI void           mpUpdateSphereColliders(int context, const int *handles, const mpColliderProperties *props, const mpV3 *centers, const float *radii, int num);
+mpAPI void           mpUpdateCapsuleColliders(int context, const int *handles, const mpColliderProperties *props, const mpV3 *pos1, const mpV3 *pos2, const float *radii, int num);
+mpAPI void           mpUpdateBoxColliders(int context, const int *handles, const mpColliderProperties *props, const mpM44 *transforms, const mpV3 *centers, const mpV3 *sizes, int num);
+mpAPI void           mpDestroyColliders(int context, const int *handles, int num);
+mpAPI int            mpIsValidColliderHandle(int context, int handle); // 0 once destroyed, or removed by mpRemoveCollider()
+// signed distance field colliders. SDF is shared by all contexts. create functions return id of SDF, or 0 if failed.
+// colliders keep data of SDF until they are cleared, so SDF can be destroyed any time.
+mpAPI int            mpCreateSDF(const float *distances, mpV3i *div, mpV3 *origin, float cell_size); // baked grid. distances are [(z*div.y + y)*div.x + x]
+mpAPI int            mpCreateSDFFromMesh(const mpV3 *vertices, int num_vertices, const int *indices, int num_indices, float cell_size); // mesh must be closed
+mpAPI void           mpDestroySDF(int sdf);
+mpAPI void           mpAddSDFCollider(int context, mpColliderProperties *props, mpM44 *transform, int sdf);
 mpAPI void           mpAddForce(int context, mpForceProperties *p, mpM44 *trans);
+mpAPI void           mpAddForces(int context, const mpForceProperties *p, const mpM44 *trans, int num); // batch version. Spline and BakedField need their own functions
+mpAPI void           mpAddSplineForce(int context, mpForceProperties *p, mpM44 *trans, const mpV3 *points, int num_points); // points are control points of catmull-rom spline in world space
+// baked vector fields. field is shared by all contexts and lives in local space of the force's transform. create returns id of field, or 0 if failed.
+// forces keep data of field until they are cleared. update overwrites a region in place; don't call it during async update.
+mpAPI int            mpCreateBakedField(const mpV3 *vectors, mpV3i *div, mpV3 *origin, float cell_size); // vectors are [(z*div.y + y)*div.x + x]
+mpAPI bool           mpUpdateBakedField(int field, const mpV3 *vectors, mpV3i *offset, mpV3i *size); // vectors are [(z*size.y + y)*size.x + x]
+mpAPI void           mpDestroyBakedField(int field);
+mpAPI void           mpAddBakedFieldForce(int context, mpForceProperties *p, mpM44 *trans, int field);
 
 mpAPI void           mpScanSphere(int context, mpHitHandler handler, mpV3 *center, float radius);
 mpAPI void           mpScanAABB(int context, mpHitHandler handler, mpV3 *center, mpV3 *extent);
@@ -226,6 +327,13 @@ mpAPI void           mpScanAllParallel(int context, mpHitHandler handler);
 
 mpAPI void           mpMoveAll(int context, mpV3 *move_amount);
 
+// stats are indexed by mpProfilePhase. returns number of stats written.
+mpAPI int            mpGetProfileStats(int context, mpProfileStats *stats, int num_stats);
+mpAPI const char*    mpGetProfilePhaseName(mpProfilePhase phase);
+mpAPI void           mpResetProfileStats(int context);
+// write recent events in chrome://tracing format. call when update isn't running (e.g. after mpEndUpdate()).
+mpAPI bool           mpDumpProfileTrace(int context, const char *path);
+
 } // extern "C"
 
 // for static link usage. initialize graphics device manually.
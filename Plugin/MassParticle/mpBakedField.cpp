@@ -0,0 +1,48 @@
+#include "pch.h"
+#include "mpInternal.h"
+#include "mpConcurrency.h"
+#include "mpBakedField.h"
+
+
+mpBakedFieldData::mpBakedFieldData()
+    : div(0), bricks(0), origin(0.0f), cell_size(0.0f)
+{
+}
+
+bool mpBakedFieldData::assign(const vec3 *src, const ivec3 &div_, const vec3 &origin_, float cell_size_)
+{
+    if (src == nullptr || div_.x < 2 || div_.y < 2 || div_.z < 2 || !(cell_size_ > 0.0f)) { return false; }
+
+    div = div_;
+    bricks = (div + (ispc::BF_BrickSize - 1)) / int(ispc::BF_BrickSize);
+    origin = origin_;
+    cell_size = cell_size_;
+    vectors.assign(size_t(bricks.x) * bricks.y * bricks.z * ispc::BF_BrickPoints * 3, 0.0f);
+    return update(src, ivec3(0), div);
+}
+
+bool mpBakedFieldData::update(const vec3 *src, const ivec3 &offset, const ivec3 &size)
+{
+    if (src == nullptr || glm::any(glm::lessThan(offset, ivec3(0))) || glm::any(glm::lessThanEqual(size, ivec3(0))) ||
+        glm::any(glm::greaterThan(offset + size, div)))
+    {
+        return false;
+    }
+
+    // each row along x is copied by a task
+    ist::parallel_for(0, size.y * size.z,
+        [&](int row) {
+            int y = offset.y + row % size.y;
+            int z = offset.z + row / size.y;
+            int brick_yz = ((z >> ispc::BF_BrickBits) * bricks.y + (y >> ispc::BF_BrickBits)) * bricks.x;
+            int local_yz = ((z & ispc::BF_BrickMask) << ispc::BF_BrickBits | (y & ispc::BF_BrickMask)) << ispc::BF_BrickBits;
+            const vec3 *s = &src[size_t(row) * size.x];
+            for (int i = 0; i < size.x; ++i) {
+                int x = offset.x + i;
+                int brick = brick_yz + (x >> ispc::BF_BrickBits);
+                int local = local_yz | (x & ispc::BF_BrickMask);
+                (vec3&)vectors[(size_t(brick) * ispc::BF_BrickPoints + local) * 3] = s[i];
+            }
+        });
+    return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// vector field on grid points in local space of the force, stored in bricks (see BakedField in mpCollision.h).
+// forces refer vectors directly. mpWorld holds a reference to it until the forces are cleared.
+struct mpBakedFieldData
+{
+    mpFloatArray vectors;   // bricks of BF_BrickPoints grid points
+    ivec3 div;              // grid points on each axis
+    ivec3 bricks;           // bricks on each axis
+    vec3 origin;            // position of grid point (0,0,0)
+    float cell_size;
+
+    mpBakedFieldData();
+
+    // copies vectors in [(z*div.y + y)*div.x + x] order. div must be at least 2 on each axis.
+    bool assign(const vec3 *vectors, const ivec3 &div, const vec3 &origin, float cell_size);
+
+    // overwrites the region [offset, offset+size) in place. vectors are [(z*size.y + y)*size.x + x].
+    // must not be called while forces that refer this field are being processed.
+    bool update(const vec3 *vectors, const ivec3 &offset, const ivec3 &size);
+};
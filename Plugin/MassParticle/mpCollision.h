@@ -36,6 +36,41 @@ struct Box
     Plane planes[6];
 };
 
+// signed distance field sampled on grid points in local space. negative inside.
+struct SDF
+{
+    float *distances;       // [(z*div.y + y)*div.x + x]
+    vec3i div;              // grid points on each axis. at least 2
+    vec3f origin;           // local position of grid point (0,0,0)
+    float rcp_cell_size;
+    vec3f to_local[4];      // world -> local. rows of rotation & scale, and translation
+    vec3f to_world[3];      // local -> world. rows of rotation & scale, for normals
+    float scale;            // world length of unit local length
+    float offset;           // particle size
+};
+
+
+// vector field sampled on grid points in local space of the force.
+// grid points are stored in bricks of BF_BrickSize^3 so that neighbors of a point are close in memory.
+enum BakedFieldBrick
+{
+    BF_BrickBits = 2,
+    BF_BrickSize = 4,
+    BF_BrickMask = 3,
+    BF_BrickPoints = 64,
+};
+
+struct BakedField
+{
+    float *vectors;         // [(brick*BF_BrickPoints + ((z&3)*4 + (y&3))*4 + (x&3))*3 + axis], brick = ((z>>2)*bricks.y + (y>>2))*bricks.x + (x>>2)
+    vec3i div;              // grid points on each axis. at least 2
+    vec3i bricks;           // bricks on each axis
+    vec3f origin;           // local position of grid point (0,0,0)
+    float rcp_cell_size;
+    vec3f to_local[4];      // world -> local. rows of rotation & scale, and translation
+    vec3f to_world[3];      // local -> world. rows of rotation only, so that vectors are not scaled
+};
+
 
 struct ColliderProperties
 {
@@ -43,6 +78,7 @@ struct ColliderProperties
     float stiffness;
     void *hit_handler;
     void *force_handler;
+    void *batch_hit_handler;
 };
 
 struct PlaneCollider
@@ -73,6 +109,13 @@ struct BoxCollider
     Box shape;
 };
 
+struct SDFCollider
+{
+    ColliderProperties props;
+    BoundingBox bounds;
+    SDF shape;
+};
+
 
 enum ForceShape
 {
@@ -88,6 +131,21 @@ enum ForceDirection
     FD_Radial,
     FD_RadialCapsule,
     FD_VectorField, //
+    FD_Vortex,      // swirls around axis (center, direction)
+    FD_Spline,      // flows along polyline sampled from spline
+    FD_BakedField,  // vectors of user supplied grid
+};
+
+// kinds of broadphase candidates. must match mpBroadphaseKind
+enum BroadphaseKind
+{
+    BP_Plane,
+    BP_Sphere,
+    BP_Capsule,
+    BP_Box,
+    BP_SDF,
+    BP_Force,
+    BP_NumKinds,
 };
 
 struct ForceProperties
@@ -114,8 +172,11 @@ struct Force
     ForceProperties props;
     BoundingBox     bounds;
     Sphere          sphere;
-    Capsule         capsule;
+    Capsule         capsule;    // also axis of FD_RadialCapsule
     Box             box;
+    int             spline_begin; // FD_Spline: points of polyline in Context::spline_points
+    int             spline_num;
+    BakedField      field;        // FD_BakedField
 };
 
 struct Cell
@@ -123,6 +184,7 @@ struct Cell
     int begin, end;
     int soai;
     float density;
+    vec3i index;
 };
 
 struct KernelParams
@@ -156,4 +218,13 @@ struct KernelParams
     float SPHDensityCoef;
     float SPHGradPressureCoef;
     float SPHLapViscosityCoef;
+
+    int sparse_grid;
+    int neighbor_list;          // cache neighbors of each particle (verlet list)
+    float neighbor_list_skin;   // margin of neighbor list. list is rebuilt when a particle moved more than half of this
+    int half_stencil;           // impulse solver evaluates each pair once (13 neighbor cells + own cell)
+    int adaptive_substeps;      // update(dt) runs substeps of dt. timestep is overwritten while substeps run
+    float substep_cfl;          // max distance the fastest particle moves in a substep, relative to particle_size
+    int max_substeps;
+    int render_format;          // mpRenderFormat. layout of GPU snapshot
 };
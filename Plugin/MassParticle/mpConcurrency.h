@@ -1,6 +1,11 @@
 #pragma once
 #include <vector>
 #include <mutex>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <cstdint>
 #ifdef mpWithTBB
     #include <tbb/tbb.h>
     #include <tbb/combinable.h>
@@ -50,7 +55,7 @@ public:
 
     ~tls()
     {
-        std::unique_lock<std::mutex> lock;
+        std::unique_lock<std::mutex> lock(m_mutex);
         for (auto p : m_locals) { delete p; }
         m_locals.clear();
     }
@@ -64,7 +69,7 @@ public:
             value = v;
 
             {
-                std::unique_lock<std::mutex> lock;
+                std::unique_lock<std::mutex> lock(m_mutex);
                 m_locals.push_back(v);
             }
         }
@@ -74,6 +79,7 @@ public:
     template<class Body>
     void each(const Body& body)
     {
+        std::unique_lock<std::mutex> lock(m_mutex);
         for (auto p : m_locals) { body(*p); }
     }
 
@@ -83,7 +89,7 @@ protected:
 };
 
 
-#ifdef WithTBB
+#ifdef mpWithTBB
 
 template<class IndexType, class Body>
 inline void parallel_for(IndexType first, IndexType last, const Body& body)
@@ -115,6 +121,34 @@ using tbb::task_group;
 using tbb::combinable;
 
 
+// limits number of threads used by parallel_* called inside run(). 0: no limit
+class concurrency_limit
+{
+public:
+    concurrency_limit() : m_max_threads(0) {}
+
+    void set(int max_threads)
+    {
+        max_threads = std::max<int>(max_threads, 0);
+        if (max_threads == m_max_threads) { return; }
+        m_max_threads = max_threads;
+        m_arena.reset(max_threads > 0 ? new tbb::task_arena(max_threads) : nullptr);
+    }
+    int get() const { return m_max_threads; }
+
+    template<class Body>
+    void run(const Body& body)
+    {
+        if (m_arena) { m_arena->execute(body); }
+        else { body(); }
+    }
+
+private:
+    int m_max_threads;
+    std::unique_ptr<tbb::task_arena> m_arena;
+};
+
+
 #elif _WIN32
 
 template<class IndexType, class Body>
@@ -158,10 +192,364 @@ public:
     template<class Body>
     void combine_each(const Body& body)
     {
-        for (auto p : m_locals) { body(*p); }
+        this->each(body);
     }
 };
 
-#endif // WithTBB
+
+// limits number of threads used by parallel_* called inside run(). 0: no limit
+class concurrency_limit
+{
+public:
+    concurrency_limit() : m_max_threads(0), m_scheduler(nullptr) {}
+    ~concurrency_limit() { set(0); }
+
+    void set(int max_threads)
+    {
+        max_threads = std::max<int>(max_threads, 0);
+        if (max_threads == m_max_threads) { return; }
+        m_max_threads = max_threads;
+        if (m_scheduler) {
+            m_scheduler->Release();
+            m_scheduler = nullptr;
+        }
+        if (max_threads > 0) {
+            concurrency::SchedulerPolicy policy(2,
+                concurrency::MinConcurrency, 1,
+                concurrency::MaxConcurrency, max_threads);
+            m_scheduler = concurrency::Scheduler::Create(policy);
+        }
+    }
+    int get() const { return m_max_threads; }
+
+    template<class Body>
+    void run(const Body& body)
+    {
+        if (m_scheduler) {
+            m_scheduler->Attach();
+            body();
+            concurrency::CurrentScheduler::Detach();
+        }
+        else { body(); }
+    }
+
+private:
+    int m_max_threads;
+    concurrency::Scheduler *m_scheduler;
+};
+
+#endif // mpWithTBB
+
+
+// accumulator for parallel reductions. each slot is padded so that slots never share a cache line.
+// slots are indexed by block of the range (see parallel_accumulate()), not by thread. the split depends
+// only on the range size, so combine order and floating point results don't depend on scheduling.
+// slots are kept across uses. no allocation happens after warm-up as long as T doesn't allocate.
+template<class T>
+class slot_accumulator
+{
+public:
+    static const int max_slots = 64;
+    static const int cache_line_size = 64;
+
+    slot_accumulator() : m_num_slots(0) {}
+
+    void resize(int n)
+    {
+        if (n > (int)m_slots.size()) { m_slots.resize(n); }
+        m_num_slots = n;
+    }
+    int size() const { return m_num_slots; }
+    T& operator[](int i) { return m_slots[i].value; }
+
+    // body: [](T &v). called in slot order.
+    template<class Body>
+    void combine_each(const Body& body)
+    {
+        for (int i = 0; i < m_num_slots; ++i) { body(m_slots[i].value); }
+    }
+
+private:
+    struct slot
+    {
+        T value;
+        char pad[cache_line_size];
+    };
+    std::vector<slot> m_slots;
+    int m_num_slots;
+};
+
+// splits [first, last) into at most slot_accumulator<T>::max_slots blocks of at least min_block_size.
+// body: [](T &slot, int begin, int end)
+template<class T, class Body>
+inline void parallel_accumulate(slot_accumulator<T> &acc, int first, int last, int min_block_size, const Body& body)
+{
+    const int max_slots = slot_accumulator<T>::max_slots;
+    int num = last - first;
+    int num_slots = std::max<int>(1, std::min<int>(max_slots, (num + min_block_size - 1) / min_block_size));
+    int block_size = (num + num_slots - 1) / num_slots;
+    acc.resize(num_slots);
+    parallel_for(0, num_slots, [&](int si) {
+        int begin = first + si * block_size;
+        int end = std::min<int>(last, begin + block_size);
+        body(acc[si], begin, end);
+    });
+}
+
+
+// blocked exclusive prefix sum over [0, num). returns total.
+// count(i) returns value of element i, write(i, sum) receives sum of elements before i.
+// count() is called twice for each element, so it should be cheap. e.g. compaction:
+//   parallel_exclusive_scan<int>(num, [&](int i) { return alive(i) ? 1 : 0; },
+//       [&](int i, int pos) { if (alive(i)) { dst[pos] = src[i]; } });
+template<class T, class CountBody, class WriteBody>
+inline T parallel_exclusive_scan(int num, const CountBody& count, const WriteBody& write)
+{
+    const int min_block_size = 4096;
+    const int max_blocks = 64;
+    if (num <= 0) { return T(); }
+
+    int num_blocks = std::min<int>(max_blocks, (num + min_block_size - 1) / min_block_size);
+    int block_size = (num + num_blocks - 1) / num_blocks;
+    T block_sums[max_blocks];
+
+    parallel_for(0, num_blocks, [&](int bi) {
+        int end = std::min<int>(num, (bi + 1) * block_size);
+        T sum = T();
+        for (int i = bi * block_size; i < end; ++i) { sum += count(i); }
+        block_sums[bi] = sum;
+    });
+
+    T total = T();
+    for (int bi = 0; bi < num_blocks; ++bi) {
+        T t = block_sums[bi];
+        block_sums[bi] = total;
+        total += t;
+    }
+
+    parallel_for(0, num_blocks, [&](int bi) {
+        int end = std::min<int>(num, (bi + 1) * block_size);
+        T sum = block_sums[bi];
+        for (int i = bi * block_size; i < end; ++i) {
+            T c = count(i);
+            write(i, sum);
+            sum += c;
+        }
+    });
+    return total;
+}
+
+// dst can be same as src.
+template<class T>
+inline T parallel_exclusive_scan(const T *src, T *dst, int num)
+{
+    return parallel_exclusive_scan<T>(num,
+        [&](int i) { return src[i]; },
+        [&](int i, T sum) { dst[i] = sum; });
+}
+
+// stable stream compaction of [0, num). returns number of elements kept.
+// keep(i) tells if element i is kept, move(i, pos) moves kept element i to pos of destination.
+// destination must not overlap source. result doesn't depend on scheduling.
+template<class KeepBody, class MoveBody>
+inline int parallel_compact(int num, const KeepBody& keep, const MoveBody& move)
+{
+    return parallel_exclusive_scan<int>(num,
+        [&](int i) { return keep(i) ? 1 : 0; },
+        [&](int i, int pos) { if (keep(i)) { move(i, pos); } });
+}
+
+
+// bounded multi-producer single-consumer queue of element batches.
+// push() is lock-free and can be called from any thread at any time. it never blocks; it returns number of
+// elements accepted, which is less than requested when the queue is full.
+// drain() must be called from one thread at a time. there are two buffers: drain() switches pushes to the other
+// buffer, waits for pushes still copying into the old one, and hands the old one to the consumer.
+// state packs index of the buffer being pushed to, number of pushes into it, and number of elements reserved in it.
+template<class T, class Alloc = std::allocator<T> >
+class batch_queue
+{
+public:
+    batch_queue(int capacity = 0) : m_capacity(0), m_state(0)
+    {
+        m_finished[0] = 0;
+        m_finished[1] = 0;
+        set_capacity(capacity);
+    }
+
+    // not thread safe. pending elements are discarded.
+    void set_capacity(int n)
+    {
+        n = std::max<int>(n, 0);
+        m_buffers[0].resize(n);
+        m_buffers[1].resize(n);
+        m_capacity = n;
+        m_state = m_state.load() & index_bit;
+        m_finished[0] = 0;
+        m_finished[1] = 0;
+    }
+    int capacity() const { return m_capacity; }
+
+    int push(const T *src, int num)
+    {
+        uint64_t s = m_state.load(std::memory_order_relaxed);
+        uint64_t ns;
+        int begin, n;
+        do {
+            begin = int(s & count_mask);
+            n = std::min<int>(num, m_capacity - begin);
+            if (n <= 0) { return 0; }
+            ns = s + writer_one + uint64_t(n);
+        } while (!m_state.compare_exchange_weak(s, ns, std::memory_order_acquire, std::memory_order_relaxed));
+
+        int bi = int(s >> index_shift);
+        std::copy(src, src + n, m_buffers[bi].begin() + begin);
+        m_finished[bi].fetch_add(1, std::memory_order_release);
+        return n;
+    }
+
+    // body: [](T *elements, int num). returns number of elements drained.
+    template<class Body>
+    int drain(const Body& body)
+    {
+        uint64_t s = m_state.load(std::memory_order_relaxed);
+        int bi = int(s >> index_shift);
+        s = m_state.exchange(uint64_t(bi ^ 1) << index_shift, std::memory_order_acq_rel);
+        int writers = int((s >> writer_shift) & count_mask);
+        int num = int(s & count_mask);
+        while (m_finished[bi].load(std::memory_order_acquire) != writers) { std::this_thread::yield(); }
+        m_finished[bi].store(0, std::memory_order_relaxed);
+        if (num > 0) { body(m_buffers[bi].data(), num); }
+        return num;
+    }
+
+private:
+    static const int index_shift = 63;
+    static const int writer_shift = 32;
+    static const uint64_t index_bit = uint64_t(1) << 63;
+    static const uint64_t writer_one = uint64_t(1) << 32;
+    static const uint64_t count_mask = 0x7fffffff;
+
+    std::vector<T, Alloc> m_buffers[2];
+    int m_capacity;
+    std::atomic<uint64_t> m_state;
+    std::atomic<int> m_finished[2]; // pushes done copying into each buffer
+};
+
+
+// stable LSD radix sort of (key, value) pairs. only lower key_bits bits of keys are considered.
+// keys & values are sorted in place. tmp_keys & tmp_values must have room for num elements.
+// passes whose digit is same for all elements are skipped (e.g. high bits of nearly empty grid).
+template<class KeyType, class ValueType>
+inline void parallel_radix_sort(KeyType *keys, ValueType *values, KeyType *tmp_keys, ValueType *tmp_values, int num, int key_bits)
+{
+    const int digit_bits = 8;
+    const int num_buckets = 1 << digit_bits;
+    const int min_block_size = 4096;
+    const int max_blocks = 64;
+    if (num <= 1) { return; }
+
+    int num_blocks = std::min<int>(max_blocks, (num + min_block_size - 1) / min_block_size);
+    int block_size = (num + num_blocks - 1) / num_blocks;
+    std::vector<int> counts(num_blocks * num_buckets);
+
+    KeyType *src_keys = keys, *dst_keys = tmp_keys;
+    ValueType *src_values = values, *dst_values = tmp_values;
+    for (int shift = 0; shift < key_bits; shift += digit_bits) {
+        // histogram per block
+        parallel_for(0, num_blocks, [&](int bi) {
+            int *c = &counts[bi * num_buckets];
+            std::fill(c, c + num_buckets, 0);
+            int end = std::min<int>(num, (bi + 1) * block_size);
+            for (int i = bi * block_size; i < end; ++i) {
+                ++c[(src_keys[i] >> shift) & (num_buckets - 1)];
+            }
+        });
+
+        // exclusive scan in (digit, block) order. skip this pass if all keys fall into one bucket.
+        bool skip = false;
+        int total = 0;
+        for (int d = 0; d < num_buckets && !skip; ++d) {
+            int digit_begin = total;
+            for (int bi = 0; bi < num_blocks; ++bi) {
+                int &c = counts[bi * num_buckets + d];
+                int t = c;
+                c = total;
+                total += t;
+            }
+            skip = total - digit_begin == num;
+        }
+        if (skip) { continue; }
+
+        // scatter. order inside each block is preserved so the sort is stable.
+        parallel_for(0, num_blocks, [&](int bi) {
+            int *c = &counts[bi * num_buckets];
+            int end = std::min<int>(num, (bi + 1) * block_size);
+            for (int i = bi * block_size; i < end; ++i) {
+                int dst = c[(src_keys[i] >> shift) & (num_buckets - 1)]++;
+                dst_keys[dst] = src_keys[i];
+                dst_values[dst] = src_values[i];
+            }
+        });
+        std::swap(src_keys, dst_keys);
+        std::swap(src_values, dst_values);
+    }
+
+    if (src_keys != keys) {
+        parallel_for(0, num_blocks, [&](int bi) {
+            int beg = bi * block_size;
+            int end = std::min<int>(num, beg + block_size);
+            std::copy(src_keys + beg, src_keys + end, keys + beg);
+            std::copy(src_values + beg, src_values + end, values + beg);
+        });
+    }
+}
+
+// sorts (key, value) pairs of which only ones marked by mark bit in key may be out of order, and clears the mark.
+// pairs not marked must be ordered already, as they are when most elements stay where last sort put them.
+// marked pairs are taken out, sorted by parallel_radix_sort() and merged back in. so cost is a few linear passes
+// plus sorting num_marked pairs, instead of a pass per digit over all. on equal keys, pairs not marked come first.
+// result doesn't depend on scheduling. mark must be above key_bits.
+template<class KeyType, class ValueType>
+inline void parallel_merge_marked(KeyType *keys, ValueType *values, KeyType *tmp_keys, ValueType *tmp_values, int num, int num_marked, KeyType mark, int key_bits)
+{
+    const int min_block_size = 4096;
+    const int max_blocks = 64;
+    const int num_ordered = num - num_marked;
+    if (num <= 0) { return; }
+
+    // ordered pairs to front of tmp, marked ones after them. both keep their order.
+    parallel_exclusive_scan<int>(num,
+        [&](int i) { return (keys[i] & mark) == 0 ? 1 : 0; },
+        [&](int i, int pos) {
+            int dst = (keys[i] & mark) == 0 ? pos : num_ordered + (i - pos);
+            tmp_keys[dst] = keys[i] & ~mark;
+            tmp_values[dst] = values[i];
+        });
+    const KeyType *okeys = tmp_keys, *mkeys = tmp_keys + num_ordered;
+    const ValueType *ovalues = tmp_values, *mvalues = tmp_values + num_ordered;
+    parallel_radix_sort(tmp_keys + num_ordered, tmp_values + num_ordered, keys, values, num_marked, key_bits);
+
+    // each block of ordered pairs merges marked ones that go before next block. marked ones equal to
+    // first key of a block go after it, so each block finds its range by lower_bound().
+    int num_blocks = std::max<int>(1, std::min<int>(max_blocks, (num_ordered + min_block_size - 1) / min_block_size));
+    int block_size = (num_ordered + num_blocks - 1) / num_blocks;
+    parallel_for(0, num_blocks, [&](int bi) {
+        int o = std::min<int>(num_ordered, bi * block_size);
+        int oend = std::min<int>(num_ordered, o + block_size);
+        auto marked_before = [&](int oi) {
+            return oi == num_ordered ? num_marked : int(std::lower_bound(mkeys, mkeys + num_marked, okeys[oi]) - mkeys);
+        };
+        int m = bi == 0 ? 0 : marked_before(o);
+        int mend = marked_before(oend);
+        int d = o + m;
+        while (o < oend && m < mend) {
+            if (mkeys[m] < okeys[o]) { keys[d] = mkeys[m]; values[d++] = mvalues[m++]; }
+            else                     { keys[d] = okeys[o]; values[d++] = ovalues[o++]; }
+        }
+        for (; o < oend; ++o) { keys[d] = okeys[o]; values[d++] = ovalues[o]; }
+        for (; m < mend; ++m) { keys[d] = mkeys[m]; values[d++] = mvalues[m]; }
+    });
+}
 
 } // namespace ist
@@ -17,6 +17,37 @@ float mpGenRand1()
     return s_dist(g_rand);
 }
 
+// 32x32->64 multiplication of each lane
+static inline void mpMulHiLo(simd128i a, simd128i b, simd128i &hi, simd128i &lo)
+{
+    simd128i even = _mm_mul_epu32(a, b);
+    simd128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 3, 1)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 3, 1)));
+}
+
+void mpPhilox4x32(simd128i ctr[4], u32 key0, u32 key1)
+{
+    const simd128i m0 = _mm_set1_epi32(0xD2511F53);
+    const simd128i m1 = _mm_set1_epi32(0xCD9E8D57);
+    simd128i c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    for (int r = 0; r < 10; ++r) {
+        simd128i k0 = _mm_set1_epi32(key0);
+        simd128i k1 = _mm_set1_epi32(key1);
+        simd128i hi0, lo0, hi1, lo1;
+        mpMulHiLo(m0, c0, hi0, lo0);
+        mpMulHiLo(m1, c2, hi1, lo1);
+        c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), k0);
+        c1 = lo1;
+        c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), k1);
+        c3 = lo0;
+        key0 += 0x9E3779B9;
+        key1 += 0xBB67AE85;
+    }
+    ctr[0] = c0; ctr[1] = c1; ctr[2] = c2; ctr[3] = c3;
+}
+
+
 void* mpAlignedAlloc(size_t size, size_t align)
 {
 #ifdef _MSC_VER
@@ -53,4 +84,86 @@ void mpSoAData::resize(size_t n)
     density.resize(n);
     affection.resize(n);
     hit.resize(n);
+    hit_prev.resize(n);
+    id.resize(n);
+    lifetime.resize(n);
+    userdata.resize(n);
+}
+
+void mpNeighborList::resize(size_t n)
+{
+    begin.resize(n);
+    count.resize(n);
+    pos_x.resize(n);
+    pos_y.resize(n);
+    pos_z.resize(n);
+}
+
+void mpNeighborList::resizeBack(size_t n)
+{
+    begin_back.resize(n);
+    count_back.resize(n);
+    pos_x_back.resize(n);
+    pos_y_back.resize(n);
+    pos_z_back.resize(n);
+}
+
+void mpNeighborList::swapBack()
+{
+    begin.swap(begin_back);
+    count.swap(count_back);
+    pos_x.swap(pos_x_back);
+    pos_y.swap(pos_y_back);
+    pos_z.swap(pos_z_back);
+}
+
+
+static const u64 mpEmptyCellKey = ~0ull;
+
+mpCellHashTable::mpCellHashTable()
+    : m_allocated(0), m_capacity(0), m_bits(0)
+{
+}
+
+void mpCellHashTable::reset(int num_keys)
+{
+    // keep load factor <= 0.5
+    m_bits = 6;
+    while ((size_t(1) << m_bits) < size_t(num_keys) * 2) { ++m_bits; }
+    m_capacity = size_t(1) << m_bits;
+    if (m_capacity > m_allocated) {
+        m_entries.reset(new Entry[m_capacity]);
+        m_allocated = m_capacity;
+    }
+    for (size_t i = 0; i < m_capacity; ++i) {
+        m_entries[i].key.store(mpEmptyCellKey, std::memory_order_relaxed);
+    }
+}
+
+inline size_t mpCellHashTable::hash(u64 key) const
+{
+    return size_t((key * 0x9E3779B97F4A7C15ull) >> (64 - m_bits));
+}
+
+void mpCellHashTable::insert(u64 key, int value)
+{
+    size_t mask = m_capacity - 1;
+    for (size_t i = hash(key);; i = (i + 1) & mask) {
+        u64 expected = mpEmptyCellKey;
+        if (m_entries[i].key.compare_exchange_strong(expected, key)) {
+            m_entries[i].value = value;
+            return;
+        }
+    }
+}
+
+int mpCellHashTable::find(u64 key) const
+{
+    if (m_capacity == 0) { return -1; }
+    size_t mask = m_capacity - 1;
+    for (size_t i = hash(key);; i = (i + 1) & mask) {
+        u64 k = m_entries[i].key.load(std::memory_order_relaxed);
+        if (k == key) { return m_entries[i].value; }
+        if (k == mpEmptyCellKey) { return -1; }
+    }
 }
@@ -12,9 +12,12 @@ typedef int16_t         i16;
 typedef uint16_t        u16;
 typedef int32_t         i32;
 typedef uint32_t        u32;
+typedef int64_t         i64;
+typedef uint64_t        u64;
 typedef float           f32;
 
 typedef __m128 simd128;
+typedef __m128i simd128i;
 
 using ist::vec4soa2;
 using ist::vec4soa3;
@@ -38,12 +41,15 @@ typedef ispc::Plane                     mpPlane;
 typedef ispc::Sphere                    mpSphere;
 typedef ispc::Capsule                   mpCapsule;
 typedef ispc::Box                       mpBox;
+typedef ispc::SDF                       mpSDF;
+typedef ispc::BakedField                mpBakedField;
 
 typedef ispc::ColliderProperties        mpColliderProperties;
 typedef ispc::PlaneCollider             mpPlaneCollider;
 typedef ispc::SphereCollider            mpSphereCollider;
 typedef ispc::CapsuleCollider           mpCapsuleCollider;
 typedef ispc::BoxCollider               mpBoxCollider;
+typedef ispc::SDFCollider               mpSDFCollider;
 
 typedef ispc::ForceProperties           mpForceProperties;
 typedef ispc::Force                     mpForce;
@@ -83,6 +89,45 @@ float mpGenRand();
 // 0.0f-1.0f
 float mpGenRand1();
 
+// Philox4x32-10 counter based RNG on 4 lanes. ctr[w] holds word w of the counter of each lane and receives
+// the results. same counter & key always give same numbers, so they can be generated in any order in parallel.
+void mpPhilox4x32(simd128i ctr[4], u32 key0, u32 key1);
+
+// random bits -> -1.0f-1.0f
+inline simd128 mpRandBitsToFloat(simd128i bits)
+{
+    // 23 bits of mantissa of [2, 4) - 3
+    simd128i m = _mm_or_si128(_mm_srli_epi32(bits, 9), _mm_set1_epi32(0x40000000));
+    return _mm_sub_ps(_mm_castsi128_ps(m), _mm_set1_ps(3.0f));
+}
+
+// float -> half of 4 lanes. round to nearest even. results are sign extended to 32 bit so that _mm_packs_epi32() keeps them.
+inline simd128i mpFloatToHalf(simd128 f)
+{
+    const simd128i f16max = _mm_set1_epi32((127 + 16) << 23);          // >= this rounds to inf
+    const simd128i min_normal = _mm_set1_epi32((127 - 14) << 23);      // < this is subnormal in half
+    const simd128i subnorm_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+    const simd128i normal_bias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+    simd128 sign = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+    simd128 absf = _mm_xor_ps(f, sign);
+    simd128i absi = _mm_castps_si128(absf);
+    simd128i is_regular = _mm_cmpgt_epi32(f16max, absi);
+    simd128i is_sub = _mm_cmpgt_epi32(min_normal, absi);
+    simd128i nan_bit = _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absf, absf)), _mm_set1_epi32(0x200));
+    simd128i inf_or_nan = _mm_or_si128(nan_bit, _mm_set1_epi32(0x7c00));
+
+    // subnormal: let float addition round mantissa
+    simd128i sub = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(subnorm_magic))), subnorm_magic);
+    // normal: rebias exponent and round. odd mantissa rounds half up
+    simd128i odd = _mm_srai_epi32(_mm_slli_epi32(absi, 31 - 13), 31);
+    simd128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absi, normal_bias), odd), 13);
+
+    simd128i r = _mm_or_si128(_mm_and_si128(is_sub, sub), _mm_andnot_si128(is_sub, normal));
+    r = _mm_or_si128(_mm_and_si128(is_regular, r), _mm_andnot_si128(is_regular, inf_or_nan));
+    return _mm_or_si128(r, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+
 
 struct mpKernelParams : ispc::KernelParams
 {
@@ -91,6 +136,8 @@ struct mpKernelParams : ispc::KernelParams
         (vec3&)world_center = vec3(0.0f, 0.0f, 0.0f);
         (vec3&)world_extent = vec3(10.24f, 10.24f, 10.24f);
         (ivec3&)world_div = ivec3(128, 128, 128);
+        (vec3&)active_region_center = vec3(0.0f, 0.0f, 0.0f);
+        (vec3&)active_region_extent = vec3(0.0f, 0.0f, 0.0f);
         (vec3&)coord_scaler = vec3(1.0f, 1.0f, 1.0f);
 
         solver_type = 0; // mpSolverType_Impulse
@@ -110,6 +157,15 @@ struct mpKernelParams : ispc::KernelParams
         SPHRestDensity = 1000.0f;
         SPHParticleMass = 0.002f;
         SPHViscosity = 0.1f;
+
+        sparse_grid = 0;
+        neighbor_list = 0;
+        neighbor_list_skin = 0.02f;
+        half_stencil = 0;
+        adaptive_substeps = 0;
+        substep_cfl = 0.5f;
+        max_substeps = 8;
+        render_format = 0; // mpRenderFormat_Full
     }
 };
 
@@ -157,6 +213,15 @@ struct mpParticle
     }
 };
 
+// particle in mpRenderFormat::Compact. halfs of 2 RGBAf16 texels
+struct mpRenderParticle
+{
+    u16 position[3];
+    u16 key;        // id & 2047. exact in half
+    u16 velocity[3];
+    u16 lifetime;
+};
+
 // intermediate data
 struct mpParticleIM
 {
@@ -184,6 +249,7 @@ struct mpParticleForce
 };
 typedef void(__stdcall *mpHitHandler)(mpParticle *p);
 typedef void(__stdcall *mpForceHandler)(mpParticleForce *p);
+typedef void(__stdcall *mpBatchHitHandler)(int owner_id, mpParticle **particles, int num);
 
 struct mpSpawnParams
 {
@@ -228,17 +294,20 @@ public:
 template<class T, typename Alloc> inline bool operator==(const mpAlignedAllocator<T>& l, const mpAlignedAllocator<T>& r) { return (l.equals(r)); }
 template<class T, typename Alloc> inline bool operator!=(const mpAlignedAllocator<T>& l, const mpAlignedAllocator<T>& r) { return (!(l == r)); }
 
+typedef std::vector<char, mpAlignedAllocator<char> >                            mpByteArray;
 typedef std::vector<float, mpAlignedAllocator<float> >                          mpFloatArray;
 typedef std::vector<int, mpAlignedAllocator<int> >                              mpIntArray;
+typedef std::vector<u32, mpAlignedAllocator<u32> >                              mpUIntArray;
+typedef std::vector<u64, mpAlignedAllocator<u64> >                              mpU64Array;
 typedef std::vector<mpParticle, mpAlignedAllocator<mpParticle> >                mpParticleCont;
 typedef std::vector<mpParticleIM, mpAlignedAllocator<mpParticleIM> >            mpParticleIMCont;
 typedef std::vector<mpParticleForce, mpAlignedAllocator<mpParticleForce> >      mpPForceCont;
 typedef std::vector<mpCell, mpAlignedAllocator<mpCell> >                            mpCellCont;
-typedef std::vector<mpColliderProperties*, mpAlignedAllocator<mpPlaneCollider> >    mpColliderPropertiesCont;
 typedef std::vector<mpPlaneCollider, mpAlignedAllocator<mpPlaneCollider> >      mpPlaneColliderCont;
 typedef std::vector<mpSphereCollider, mpAlignedAllocator<mpSphereCollider> >    mpSphereColliderCont;
 typedef std::vector<mpCapsuleCollider, mpAlignedAllocator<mpCapsuleCollider> >  mpCapsuleColliderCont;
 typedef std::vector<mpBoxCollider, mpAlignedAllocator<mpBoxCollider> >          mpBoxColliderCont;
+typedef std::vector<mpSDFCollider, mpAlignedAllocator<mpSDFCollider> >          mpSDFColliderCont;
 typedef std::vector<mpForce, mpAlignedAllocator<mpForce> >                      mpForceCont;
 
 struct mpSoAData
@@ -267,8 +336,97 @@ struct mpSoAData
     mpFloatArray density;
     mpFloatArray affection;
     mpIntArray hit;
+    mpIntArray hit_prev;
+    mpUIntArray id;
+    mpFloatArray lifetime;
+    mpIntArray userdata;
 
     void resize(size_t n);
 };
 
+// verlet neighbor list. begin, count & positions are indexed same as mpSoAData.
+// entries of a particle are contiguous, and particles of a cell are contiguous.
+struct mpNeighborList
+{
+    mpIntArray begin;
+    mpIntArray count;
+    mpIntArray indices;
+    mpFloatArray pos_x; // positions when the list was built
+    mpFloatArray pos_y;
+    mpFloatArray pos_z;
+    std::vector<mpIntArray> blocks; // per task buffers for building
+    // used while the list follows particles to their new SoA slots (mpWorld::remapNeighborList())
+    mpIntArray remap;   // previous slot -> new slot. -1 if the particle died
+    mpIntArray begin_back;
+    mpIntArray count_back;
+    mpFloatArray pos_x_back;
+    mpFloatArray pos_y_back;
+    mpFloatArray pos_z_back;
+    float radius;
+    bool valid;     // false if particles have been added or exposed through AoS view since the list was built
+
+    mpNeighborList() : radius(0.0f), valid(false) {}
+    void resize(size_t n);
+    void resizeBack(size_t n);
+    void swapBack();
+};
+
+// kinds of broadphase candidates. must match BroadphaseKind in mpCollision.h
+enum mpBroadphaseKind
+{
+    mpBP_Plane,
+    mpBP_Sphere,
+    mpBP_Capsule,
+    mpBP_Box,
+    mpBP_SDF,
+    mpBP_Force,
+    mpBP_NumKinds,
+};
+const int mpNumColliderKinds = mpBP_Force; // kinds before mpBP_Force are colliders
+
+// where a collider is: container of the kind and index in it. kind is -1 if nowhere
+struct mpColliderLocation
+{
+    int kind;
+    int index;
+
+    mpColliderLocation(int k = -1, int i = -1) : kind(k), index(i) {}
+};
+
+// colliders & forces binned into a coarse grid of tiles. built once per update.
+// candidates of a kind in a tile are indices[begin[tile*mpBP_NumKinds+kind] ... begin[tile*mpBP_NumKinds+kind+1]], in order of colliders.
+struct mpBroadphase
+{
+    mpIntArray begin;
+    mpIntArray indices;
+    ivec3 shift;    // cell index -> tile index
+    ivec3 div;      // number of tiles
+
+    mpBroadphase() : shift(0), div(1) {}
+};
+
+// open addressing hash table: cell key -> index of occupied cell.
+// insert() can be called in parallel. keys must be unique.
+class mpCellHashTable
+{
+public:
+    mpCellHashTable();
+    void reset(int num_keys);
+    void insert(u64 key, int value);
+    int find(u64 key) const; // -1 if not found
+
+private:
+    struct Entry
+    {
+        std::atomic<u64> key;
+        int value;
+    };
+    size_t hash(u64 key) const;
+
+    std::unique_ptr<Entry[]> m_entries;
+    size_t m_allocated;
+    size_t m_capacity;
+    int m_bits;
+};
+
 class mpWorld;
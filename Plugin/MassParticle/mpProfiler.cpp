@@ -0,0 +1,137 @@
+#include "pch.h"
+#include "mpInternal.h"
+#include "mpProfiler.h"
+
+namespace {
+    const char *g_phase_names[] = {
+        "Update",
+        "GenHash",
+        "Compact",
+        "Sort",
+        "BuildCells",
+        "Gather",
+        "NeighborList",
+        "Broadphase",
+        "Interaction",
+        "Integrate",
+        "GPUClone",
+        "CallHandlers",
+        "HitHandlers",
+        "ForceHandlers",
+    };
+    static_assert(sizeof(g_phase_names) / sizeof(g_phase_names[0]) == (int)mpProfilePhase::Num, "");
+}
+
+mpProfiler::mpProfiler()
+    : m_epoch(std::chrono::steady_clock::now())
+    , m_num_threads(0)
+{
+    for (auto &c : m_task_counts) { c = 0; }
+    memset(m_history, 0, sizeof(m_history));
+}
+
+u64 mpProfiler::now() const
+{
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+}
+
+u64 mpProfiler::beginPhase(mpProfilePhase phase)
+{
+    m_task_counts[(int)phase] = 0;
+    return now();
+}
+
+void mpProfiler::endPhase(mpProfilePhase phase, u64 begin)
+{
+    u64 end = now();
+    record(phase, begin, end, false);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    History &h = m_history[(int)phase];
+    h.time[h.pos] = float(double(end - begin) / 1000000.0);
+    h.tasks[h.pos] = m_task_counts[(int)phase];
+    h.pos = (h.pos + 1) % mpProfileHistorySize;
+    h.num = std::min<int>(h.num + 1, mpProfileHistorySize);
+}
+
+void mpProfiler::addTask(mpProfilePhase phase, u64 begin)
+{
+    record(phase, begin, now(), true);
+    ++m_task_counts[(int)phase];
+}
+
+void mpProfiler::record(mpProfilePhase phase, u64 begin, u64 end, bool is_task)
+{
+    Ring &r = m_rings.local();
+    if (r.tid < 0) { r.tid = m_num_threads++; }
+    mpProfileEvent &e = r.events[r.num_events % mpProfileRingSize];
+    e.begin = begin;
+    e.end = end;
+    e.phase = (int)phase;
+    e.is_task = is_task ? 1 : 0;
+    ++r.num_events;
+}
+
+int mpProfiler::getStats(mpProfileStats *stats, int num_stats)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    int n = std::min<int>(num_stats, (int)mpProfilePhase::Num);
+    for (int pi = 0; pi < n; ++pi) {
+        const History &h = m_history[pi];
+        mpProfileStats &s = stats[pi];
+        memset(&s, 0, sizeof(s));
+        s.num_samples = h.num;
+        if (h.num == 0) { continue; }
+
+        s.min_ms = s.max_ms = h.time[0];
+        float total_time = 0.0f;
+        int total_tasks = 0;
+        for (int i = 0; i < h.num; ++i) {
+            s.min_ms = std::min<float>(s.min_ms, h.time[i]);
+            s.max_ms = std::max<float>(s.max_ms, h.time[i]);
+            total_time += h.time[i];
+            total_tasks += h.tasks[i];
+        }
+        s.avg_ms = total_time / h.num;
+        s.avg_tasks = float(total_tasks) / h.num;
+    }
+    return n;
+}
+
+void mpProfiler::reset()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        memset(m_history, 0, sizeof(m_history));
+    }
+    m_rings.each([](Ring &r) { r.num_events = 0; });
+}
+
+const char* mpProfiler::getPhaseName(mpProfilePhase phase)
+{
+    int i = (int)phase;
+    return i >= 0 && i < (int)mpProfilePhase::Num ? g_phase_names[i] : "";
+}
+
+bool mpProfiler::dumpTrace(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == nullptr) { return false; }
+
+    fputs("{\"traceEvents\":[\n", f);
+    bool first = true;
+    m_rings.each([&](const Ring &r) {
+        u32 num = std::min<u32>(r.num_events, mpProfileRingSize);
+        for (u32 i = r.num_events - num; i != r.num_events; ++i) {
+            const mpProfileEvent &e = r.events[i % mpProfileRingSize];
+            fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d}",
+                first ? "" : ",\n",
+                getPhaseName((mpProfilePhase)e.phase), e.is_task ? "task" : "phase",
+                double(e.begin) / 1000.0, double(e.end - e.begin) / 1000.0, r.tid);
+            first = false;
+        }
+    });
+    fputs("\n]}\n", f);
+    fclose(f);
+    return true;
+}
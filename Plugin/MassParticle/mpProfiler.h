@@ -0,0 +1,98 @@
+#pragma once
+#include <chrono>
+#include "mpConcurrency.h"
+
+// lightweight profiler that is always compiled in.
+// phases of mpWorld::update() & callHandlers() are timed by mpProfileScope on the calling thread.
+// blocks of parallel loops are timed by mpProfileTask on worker threads and counted as tasks of the phase.
+// every thread records events into its own ring buffer, so recording events never takes a lock.
+// min/avg/max of each phase are kept for last mpProfileHistorySize samples.
+
+const int mpProfileRingSize = 4096;     // events kept per thread for trace dump
+const int mpProfileHistorySize = 64;    // samples of each phase for rolling stats
+
+struct mpProfileEvent
+{
+    u64 begin;  // ns from creation of profiler
+    u64 end;
+    int phase;
+    int is_task;
+};
+
+class mpProfiler
+{
+public:
+    mpProfiler();
+
+    u64  now() const;
+    u64  beginPhase(mpProfilePhase phase);
+    void endPhase(mpProfilePhase phase, u64 begin);
+    void addTask(mpProfilePhase phase, u64 begin);
+
+    // stats are indexed by mpProfilePhase. returns number of stats written.
+    int  getStats(mpProfileStats *stats, int num_stats);
+    void reset();
+    // chrome://tracing format. must not be called while update is running.
+    bool dumpTrace(const char *path);
+
+    static const char* getPhaseName(mpProfilePhase phase);
+
+private:
+    struct Ring
+    {
+        mpProfileEvent events[mpProfileRingSize];
+        u32 num_events;
+        int tid;
+        Ring() : num_events(0), tid(-1) {}
+    };
+    struct History
+    {
+        float time[mpProfileHistorySize];   // ms
+        int tasks[mpProfileHistorySize];
+        int num;
+        int pos;
+    };
+
+    void record(mpProfilePhase phase, u64 begin, u64 end, bool is_task);
+
+    std::chrono::steady_clock::time_point m_epoch;
+    ist::tls<Ring>      m_rings;
+    std::atomic<int>    m_num_threads;
+    std::atomic<int>    m_task_counts[(int)mpProfilePhase::Num];
+    History             m_history[(int)mpProfilePhase::Num];
+    std::mutex          m_mutex;
+};
+
+
+class mpProfileScope
+{
+public:
+    mpProfileScope(mpProfiler &prof, mpProfilePhase phase) : m_prof(prof), m_phase(phase), m_begin(prof.beginPhase(phase)) {}
+    ~mpProfileScope() { m_prof.endPhase(m_phase, m_begin); }
+private:
+    mpProfiler &m_prof;
+    mpProfilePhase m_phase;
+    u64 m_begin;
+};
+
+class mpProfileTask
+{
+public:
+    mpProfileTask(mpProfiler &prof, mpProfilePhase phase) : m_prof(prof), m_phase(phase), m_begin(prof.now()) {}
+    ~mpProfileTask() { m_prof.addTask(m_phase, m_begin); }
+private:
+    mpProfiler &m_prof;
+    mpProfilePhase m_phase;
+    u64 m_begin;
+};
+
+// same as ist::parallel_for(first, last, granularity, body), but each block is recorded as a task of phase.
+template<class Body>
+inline void mpParallelFor(mpProfiler &prof, mpProfilePhase phase, int first, int last, int granularity, const Body& body)
+{
+    ist::parallel_for_blocked(first, last, granularity,
+        [&](int begin, int end) {
+            mpProfileTask task(prof, phase);
+            for (int i = begin; i < end; ++i) { body(i); }
+        });
+}
@@ -0,0 +1,212 @@
+#include "pch.h"
+#include "mpInternal.h"
+#include "mpConcurrency.h"
+#include "mpSDF.h"
+
+namespace {
+
+const int g_sdf_border_cells = 2;
+const int g_sdf_max_div = 256;
+
+// closest point on triangle abc to p. (Real-Time Collision Detection 5.1.5)
+vec3 mpClosestPointTriangle(const vec3 &p, const vec3 &a, const vec3 &b, const vec3 &c)
+{
+    vec3 ab = b - a;
+    vec3 ac = c - a;
+    vec3 ap = p - a;
+    float d1 = glm::dot(ab, ap);
+    float d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) { return a; }
+
+    vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp);
+    float d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) { return b; }
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+        return a + ab * (d1 / (d1 - d3));
+    }
+
+    vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp);
+    float d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) { return c; }
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+        return a + ac * (d2 / (d2 - d6));
+    }
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+
+    float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+} // namespace
+
+
+mpSDFData::mpSDFData()
+    : div(0), origin(0.0f), cell_size(0.0f)
+{
+}
+
+bool mpSDFData::assign(const float *src, const ivec3 &div_, const vec3 &origin_, float cell_size_)
+{
+    if (src == nullptr || div_.x < 2 || div_.y < 2 || div_.z < 2 || !(cell_size_ > 0.0f)) { return false; }
+
+    div = div_;
+    origin = origin_;
+    cell_size = cell_size_;
+    distances.assign(src, src + size_t(div.x) * div.y * div.z);
+    return true;
+}
+
+bool mpSDFData::bake(const vec3 *vertices, int num_vertices, const int *indices, int num_indices, float cell_size_)
+{
+    if (vertices == nullptr || indices == nullptr || !(cell_size_ > 0.0f)) { return false; }
+
+    // valid triangles & bounds of the mesh
+    std::vector<ivec3> tris;
+    tris.reserve(num_indices / 3);
+    vec3 bl(std::numeric_limits<float>::max());
+    vec3 ur(-std::numeric_limits<float>::max());
+    for (int i = 0; i + 2 < num_indices; i += 3) {
+        ivec3 t(indices[i], indices[i + 1], indices[i + 2]);
+        if (glm::any(glm::lessThan(t, ivec3(0))) || glm::any(glm::greaterThanEqual(t, ivec3(num_vertices)))) { continue; }
+        const vec3 &a = vertices[t.x];
+        const vec3 &b = vertices[t.y];
+        const vec3 &c = vertices[t.z];
+        if (glm::length_sq(glm::cross(b - a, c - a)) == 0.0f) { continue; }
+        tris.push_back(t);
+        bl = glm::min(bl, glm::min(a, glm::min(b, c)));
+        ur = glm::max(ur, glm::max(a, glm::max(b, c)));
+    }
+    if (tris.empty()) { return false; }
+
+    vec3 size = ur - bl;
+    float max_size = std::max<float>(size.x, std::max<float>(size.y, size.z));
+    cell_size = std::max<float>(cell_size_, max_size / float(g_sdf_max_div - 1 - g_sdf_border_cells * 2));
+    origin = bl - cell_size * float(g_sdf_border_cells);
+    for (int a = 0; a < 3; ++a) {
+        div[a] = int(std::ceil(size[a] / cell_size)) + 1 + g_sdf_border_cells * 2;
+    }
+    const int num_points = div.x * div.y * div.z;
+    distances.assign(num_points, std::numeric_limits<float>::max());
+    std::vector<int> closest(num_points, -1);
+
+    auto index_of = [&](int x, int y, int z) { return (z * div.y + y) * div.x + x; };
+    auto point_of = [&](int x, int y, int z) { return origin + vec3(float(x), float(y), float(z)) * cell_size; };
+    auto distance_to = [&](const vec3 &p, int ti) {
+        const ivec3 &t = tris[ti];
+        return glm::length(p - mpClosestPointTriangle(p, vertices[t.x], vertices[t.y], vertices[t.z]));
+    };
+
+    // exact distances of grid points around each triangle
+    for (int ti = 0; ti < (int)tris.size(); ++ti) {
+        const ivec3 &t = tris[ti];
+        vec3 tbl = glm::min(vertices[t.x], glm::min(vertices[t.y], vertices[t.z]));
+        vec3 tur = glm::max(vertices[t.x], glm::max(vertices[t.y], vertices[t.z]));
+        ivec3 lo = glm::max(ivec3(glm::floor((tbl - origin) / cell_size)) - 1, ivec3(0));
+        ivec3 hi = glm::min(ivec3(glm::ceil((tur - origin) / cell_size)) + 1, div - 1);
+        for (int z = lo.z; z <= hi.z; ++z) {
+            for (int y = lo.y; y <= hi.y; ++y) {
+                for (int x = lo.x; x <= hi.x; ++x) {
+                    int i = index_of(x, y, z);
+                    float d = distance_to(point_of(x, y, z), ti);
+                    if (d < distances[i]) {
+                        distances[i] = d;
+                        closest[i] = ti;
+                    }
+                }
+            }
+        }
+    }
+
+    // propagate closest triangles to rest of the grid by a forward and a backward sweep.
+    // each sweep looks at the 13 neighbors that have already been visited in the sweep.
+    ivec3 offsets[13];
+    {
+        int n = 0;
+        for (int z = -1; z <= 0; ++z) {
+            for (int y = -1; y <= 1; ++y) {
+                for (int x = -1; x <= 1; ++x) {
+                    if (z == 0 && (y > 0 || (y == 0 && x >= 0))) { continue; }
+                    offsets[n++] = ivec3(x, y, z);
+                }
+            }
+        }
+    }
+    for (int dir = 1; dir >= -1; dir -= 2) {
+        for (int zi = 0; zi < div.z; ++zi) {
+            int z = dir > 0 ? zi : div.z - 1 - zi;
+            for (int yi = 0; yi < div.y; ++yi) {
+                int y = dir > 0 ? yi : div.y - 1 - yi;
+                for (int xi = 0; xi < div.x; ++xi) {
+                    int x = dir > 0 ? xi : div.x - 1 - xi;
+                    int i = index_of(x, y, z);
+                    vec3 p = point_of(x, y, z);
+                    for (const ivec3 &o : offsets) {
+                        ivec3 n = ivec3(x, y, z) + o * dir;
+                        if (glm::any(glm::lessThan(n, ivec3(0))) || glm::any(glm::greaterThanEqual(n, div))) { continue; }
+                        int tn = closest[index_of(n.x, n.y, n.z)];
+                        if (tn < 0 || tn == closest[i]) { continue; }
+                        float d = distance_to(p, tn);
+                        if (d < distances[i]) {
+                            distances[i] = d;
+                            closest[i] = tn;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // sign by parity of crossings of a ray along +x through each row of grid points.
+    // rays are slightly offset so that they don't go through edges & vertices exactly.
+    const float ray_offset_y = 0.0013f;
+    const float ray_offset_z = 0.0007f;
+    std::vector<std::vector<float>> crossings(div.y * div.z);
+    for (const ivec3 &t : tris) {
+        const vec3 &a = vertices[t.x];
+        const vec3 &b = vertices[t.y];
+        const vec3 &c = vertices[t.z];
+        float area = (b.y - a.y) * (c.z - a.z) - (b.z - a.z) * (c.y - a.y);
+        if (area == 0.0f) { continue; }
+
+        vec3 tbl = (glm::min(a, glm::min(b, c)) - origin) / cell_size;
+        vec3 tur = (glm::max(a, glm::max(b, c)) - origin) / cell_size;
+        int ylo = std::max<int>(int(std::ceil(tbl.y - ray_offset_y)), 0);
+        int yhi = std::min<int>(int(std::floor(tur.y - ray_offset_y)), div.y - 1);
+        int zlo = std::max<int>(int(std::ceil(tbl.z - ray_offset_z)), 0);
+        int zhi = std::min<int>(int(std::floor(tur.z - ray_offset_z)), div.z - 1);
+        for (int z = zlo; z <= zhi; ++z) {
+            for (int y = ylo; y <= yhi; ++y) {
+                float py = origin.y + (float(y) + ray_offset_y) * cell_size;
+                float pz = origin.z + (float(z) + ray_offset_z) * cell_size;
+                float wa = ((b.y - py) * (c.z - pz) - (b.z - pz) * (c.y - py)) / area;
+                float wb = ((c.y - py) * (a.z - pz) - (c.z - pz) * (a.y - py)) / area;
+                float wc = 1.0f - wa - wb;
+                if (wa < 0.0f || wb < 0.0f || wc < 0.0f) { continue; }
+                crossings[z * div.y + y].push_back(a.x * wa + b.x * wb + c.x * wc);
+            }
+        }
+    }
+    ist::parallel_for(0, div.y * div.z,
+        [&](int row) {
+            std::vector<float> &xs = crossings[row];
+            std::sort(xs.begin(), xs.end());
+            float *d = &distances[row * div.x];
+            size_t n = 0;
+            for (int x = 0; x < div.x; ++x) {
+                float px = origin.x + float(x) * cell_size;
+                while (n < xs.size() && xs[n] < px) { ++n; }
+                if (n % 2 == 1) { d[x] = -d[x]; }
+            }
+        });
+    return true;
+}
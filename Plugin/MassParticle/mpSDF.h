@@ -0,0 +1,21 @@
+#pragma once
+
+// signed distance field on grid points in local space of SDF colliders. negative inside.
+// colliders refer distances directly. mpWorld holds a reference to it until the colliders are cleared.
+struct mpSDFData
+{
+    mpFloatArray distances; // [(z*div.y + y)*div.x + x]
+    ivec3 div;              // grid points on each axis
+    vec3 origin;            // position of grid point (0,0,0)
+    float cell_size;
+
+    mpSDFData();
+
+    // copies baked distances. div must be at least 2 on each axis.
+    bool assign(const float *distances, const ivec3 &div, const vec3 &origin, float cell_size);
+
+    // bakes a closed triangle mesh. grid covers the mesh with a few cells of margin.
+    // cell_size is enlarged if the grid gets too large. inside/outside is decided by parity of ray crossings,
+    // so open meshes give wrong signs.
+    bool bake(const vec3 *vertices, int num_vertices, const int *indices, int num_indices, float cell_size);
+};
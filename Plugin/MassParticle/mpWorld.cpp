@@ -7,9 +7,9 @@
 
 const int mpDataTextureWidth = 3072;
 const int mpDataTextureHeight = 256;
-const int mpTexelsEachParticle = 3;
-const int mpParticlesEachLine = mpDataTextureWidth / mpTexelsEachParticle;
 const i32 SOA_BOCK_SIZE = 8;
+const int mpSnapshotIndexMask = 3;
+const int mpSnapshotFresh = 4; // middle snapshot is newer than front one
 
 
 i32 soa_blocks(i32 i)
@@ -17,58 +17,74 @@ i32 soa_blocks(i32 i)
     return ceildiv(i, SOA_BOCK_SIZE);
 }
 
+// layout of particles in data texture for each mpRenderFormat
+inline int mpParticlesEachLine(int format)
+{
+    return mpDataTextureWidth / (format == (int)mpRenderFormat::Compact ? 2 : 3);
+}
+
+inline size_t mpBytesEachParticle(int format)
+{
+    return format == (int)mpRenderFormat::Compact ? sizeof(mpRenderParticle) : sizeof(mpParticle);
+}
+
 template<class T>
 inline void simd_store(void *address, T v)
 {
     _mm_store_ps((float*)address, (const simd128&)v);
 }
 
-void mpSoAnize(const mpCell &cell, const mpParticleCont &particles, mpSoAData &soa)
+// gather particles of the cell into new SoA layout. this is the only pass that moves particle data.
+// srcs[i] is slot in previous SoA, or ~(index in AoS view) for particles added or exposed through AoS view.
+// carry_hits: keep hit & hit_prev as they are (substeps of one update) instead of shifting hit into hit_prev.
+void mpSoAGather(const mpCell &cell, const int *srcs, const mpSoAData &src, const mpParticleCont &particles, mpSoAData &dst, bool carry_hits)
 {
     int num = cell.end - cell.begin;
-    i32 si = cell.soai * SOA_BOCK_SIZE;
-    i32 blocks = soa_blocks(num);
-    float *pos_x = &soa.pos_x[si];
-    float *pos_y = &soa.pos_y[si];
-    float *pos_z = &soa.pos_z[si];
-    float *vel_x = &soa.vel_x[si];
-    float *vel_y = &soa.vel_y[si];
-    float *vel_z = &soa.vel_z[si];
-    float *acl_x = &soa.acl_x[si];
-    float *acl_y = &soa.acl_y[si];
-    float *acl_z = &soa.acl_z[si];
-    float *speed = &soa.speed[si];
-    float *density = &soa.density[si];
-    int *hit = &soa.hit[si];
-
-    ist::vec4soa3 soav;
-    for (i32 bi = 0; bi < blocks; ++bi) {
-        i32 i = bi*SOA_BOCK_SIZE;
-        i32 pi = cell.begin + i;
-
-        soav = ist::soa_transpose34(particles[pi + 0].position, particles[pi + 1].position, particles[pi + 2].position, particles[pi + 3].position);
-        simd_store(&pos_x[i + 0], soav.x());
-        simd_store(&pos_y[i + 0], soav.y());
-        simd_store(&pos_z[i + 0], soav.z());
-        soav = ist::soa_transpose34(particles[pi + 0].velocity, particles[pi + 1].velocity, particles[pi + 2].velocity, particles[pi + 3].velocity);
-        simd_store(&vel_x[i + 0], soav.x());
-        simd_store(&vel_y[i + 0], soav.y());
-        simd_store(&vel_z[i + 0], soav.z());
-
-        soav = ist::soa_transpose34(particles[pi + 4].position, particles[pi + 5].position, particles[pi + 6].position, particles[pi + 7].position);
-        simd_store(&pos_x[i + 4], soav.x());
-        simd_store(&pos_y[i + 4], soav.y());
-        simd_store(&pos_z[i + 4], soav.z());
-        soav = ist::soa_transpose34(particles[pi + 4].velocity, particles[pi + 5].velocity, particles[pi + 6].velocity, particles[pi + 7].velocity);
-        simd_store(&vel_x[i + 4], soav.x());
-        simd_store(&vel_y[i + 4], soav.y());
-        simd_store(&vel_z[i + 4], soav.z());
-
-        simd_store(&hit[i + 0], _mm_set1_epi32(0));
-        simd_store(&hit[i + 4], _mm_set1_epi32(0));
+    i32 di = cell.soai * SOA_BOCK_SIZE;
+    for (i32 i = 0; i < num; ++i) {
+        i32 s = srcs[cell.begin + i];
+        i32 d = di + i;
+        if (s >= 0) {
+            dst.pos_x[d] = src.pos_x[s];
+            dst.pos_y[d] = src.pos_y[s];
+            dst.pos_z[d] = src.pos_z[s];
+            dst.vel_x[d] = src.vel_x[s];
+            dst.vel_y[d] = src.vel_y[s];
+            dst.vel_z[d] = src.vel_z[s];
+            dst.speed[d] = src.speed[s];
+            dst.density[d] = src.density[s];
+            dst.hit_prev[d] = carry_hits ? src.hit_prev[s] : src.hit[s];
+            dst.hit[d] = carry_hits ? src.hit[s] : 0;
+            dst.id[d] = src.id[s];
+            dst.lifetime[d] = src.lifetime[s];
+            dst.userdata[d] = src.userdata[s];
+        }
+        else {
+            const mpParticle &p = particles[~s];
+            const float *pos = (const float*)&p.position;
+            const float *vel = (const float*)&p.velocity;
+            dst.pos_x[d] = pos[0];
+            dst.pos_y[d] = pos[1];
+            dst.pos_z[d] = pos[2];
+            dst.vel_x[d] = vel[0];
+            dst.vel_y[d] = vel[1];
+            dst.vel_z[d] = vel[2];
+            dst.speed[d] = vel[3];
+            dst.density[d] = 0.0f;
+            dst.hit_prev[d] = p.hit;
+            dst.hit[d] = 0;
+            dst.id[d] = p.id;
+            dst.lifetime[d] = p.lifetime;
+            dst.userdata[d] = p.userdata;
+        }
+        dst.acl_x[d] = 0.0f;
+        dst.acl_y[d] = 0.0f;
+        dst.acl_z[d] = 0.0f;
     }
 }
-void mpAoSnize(const mpCell &cell, const mpSoAData &soa, mpParticleCont &particles, mpParticleIMCont &im)
+
+// SoA -> AoS. im can be null.
+void mpAoSnize(const mpCell &cell, const mpSoAData &soa, mpParticle *particles, mpParticleIM *im)
 {
     int num = cell.end - cell.begin;
     i32 si = cell.soai * SOA_BOCK_SIZE;
@@ -85,6 +101,10 @@ void mpAoSnize(const mpCell &cell, const mpSoAData &soa, mpParticleCont &particl
     const float *speed = &soa.speed[si];
     const float *density = &soa.density[si];
     const int *hit = &soa.hit[si];
+    const int *hit_prev = &soa.hit_prev[si];
+    const u32 *id = &soa.id[si];
+    const float *lifetime = &soa.lifetime[si];
+    const int *userdata = &soa.userdata[si];
 
     for (i32 bi = 0; bi < blocks; ++bi) {
         i32 i = bi*SOA_BOCK_SIZE;
@@ -112,73 +132,162 @@ void mpAoSnize(const mpCell &cell, const mpSoAData &soa, mpParticleCont &particl
                 _mm_load_ps(&vel_z[i + 4]),
                 _mm_load_ps(&speed[i + 4])),
         };
-        ist::vec4soa4 aos_axl[2] = {
-            ist::soa_transpose44(
-            _mm_load_ps(&acl_x[i + 0]),
-                _mm_load_ps(&acl_y[i + 0]),
-                _mm_load_ps(&acl_z[i + 0]),
-                _mm_set1_ps(0.0f)),
-            ist::soa_transpose44(
-                _mm_load_ps(&acl_x[i + 4]),
-                _mm_load_ps(&acl_y[i + 4]),
-                _mm_load_ps(&acl_z[i + 4]),
-                _mm_set1_ps(0.0f)),
-        };
 
         i32 pi = cell.begin + i;
         i32 e = std::min<i32>(SOA_BOCK_SIZE, num - i);
         for (i32 ei = 0; ei < e; ++ei) {
-            u32 id = particles[pi + ei].id;
-            im[pi + ei].accel = aos_axl[ei / 4][ei % 4];
-            particles[pi + ei].position = aos_pos[ei / 4][ei % 4];
-            particles[pi + ei].velocity = aos_vel[ei / 4][ei % 4];
-            particles[pi + ei].density = ((float*)density)[bi*SOA_BOCK_SIZE + ei];
-            particles[pi + ei].hit_prev = particles[pi + ei].hit;
-            particles[pi + ei].hit = (u16)((int*)hit)[bi*SOA_BOCK_SIZE + ei];
-            particles[pi + ei].id = id;
+            mpParticle &p = particles[pi + ei];
+            p.position = aos_pos[ei / 4][ei % 4];
+            p.velocity = aos_vel[ei / 4][ei % 4];
+            p.id = id[i + ei];
+            p.density = density[i + ei];
+            p.lifetime = lifetime[i + ei];
+            p.hit = (u16)hit[i + ei];
+            p.hit_prev = (u16)hit_prev[i + ei];
+            p.userdata = userdata[i + ei];
+        }
+        if (im) {
+            ist::vec4soa4 aos_axl[2] = {
+                ist::soa_transpose44(
+                _mm_load_ps(&acl_x[i + 0]),
+                    _mm_load_ps(&acl_y[i + 0]),
+                    _mm_load_ps(&acl_z[i + 0]),
+                    _mm_set1_ps(0.0f)),
+                ist::soa_transpose44(
+                    _mm_load_ps(&acl_x[i + 4]),
+                    _mm_load_ps(&acl_y[i + 4]),
+                    _mm_load_ps(&acl_z[i + 4]),
+                    _mm_set1_ps(0.0f)),
+            };
+            for (i32 ei = 0; ei < e; ++ei) {
+                im[pi + ei].accel = aos_axl[ei / 4][ei % 4];
+            }
         }
     }
 }
 
+// SoA -> mpRenderParticle. 4 particles are converted to halfs and interleaved at a time.
+void mpAoSnizeCompact(const mpCell &cell, const mpSoAData &soa, mpRenderParticle *particles, bool id_as_float)
+{
+    int num = cell.end - cell.begin;
+    i32 si = cell.soai * SOA_BOCK_SIZE;
+    i32 blocks = soa_blocks(num);
+    const float *pos_x = &soa.pos_x[si];
+    const float *pos_y = &soa.pos_y[si];
+    const float *pos_z = &soa.pos_z[si];
+    const float *vel_x = &soa.vel_x[si];
+    const float *vel_y = &soa.vel_y[si];
+    const float *vel_z = &soa.vel_z[si];
+    const u32 *id = &soa.id[si];
+    const float *lifetime = &soa.lifetime[si];
+
+    for (i32 bi = 0; bi < blocks; ++bi) {
+        i32 i = bi*SOA_BOCK_SIZE;
+        mpRenderParticle packed[SOA_BOCK_SIZE];
+        for (i32 h = 0; h < SOA_BOCK_SIZE; h += 4) {
+            i32 k = i + h;
+            simd128i ids = _mm_load_si128((const simd128i*)&id[k]);
+            if (id_as_float) { ids = _mm_cvttps_epi32(_mm_castsi128_ps(ids)); }
+            simd128 key = _mm_cvtepi32_ps(_mm_and_si128(ids, _mm_set1_epi32(2047)));
+
+            // 16 bit lanes: (x0 x1 x2 x3 z0 z1 z2 z3) & (y0 y1 y2 y3 w0 w1 w2 w3) -> (x0 y0 z0 w0 x1 y1 z1 w1) ...
+            simd128i pxz = _mm_packs_epi32(mpFloatToHalf(_mm_load_ps(&pos_x[k])), mpFloatToHalf(_mm_load_ps(&pos_z[k])));
+            simd128i pyw = _mm_packs_epi32(mpFloatToHalf(_mm_load_ps(&pos_y[k])), mpFloatToHalf(key));
+            simd128i vxz = _mm_packs_epi32(mpFloatToHalf(_mm_load_ps(&vel_x[k])), mpFloatToHalf(_mm_load_ps(&vel_z[k])));
+            simd128i vyw = _mm_packs_epi32(mpFloatToHalf(_mm_load_ps(&vel_y[k])), mpFloatToHalf(_mm_load_ps(&lifetime[k])));
+            simd128i pxy = _mm_unpacklo_epi16(pxz, pyw);
+            simd128i pzw = _mm_unpackhi_epi16(pxz, pyw);
+            simd128i vxy = _mm_unpacklo_epi16(vxz, vyw);
+            simd128i vzw = _mm_unpackhi_epi16(vxz, vyw);
+            simd128i p01 = _mm_unpacklo_epi32(pxy, pzw);
+            simd128i p23 = _mm_unpackhi_epi32(pxy, pzw);
+            simd128i v01 = _mm_unpacklo_epi32(vxy, vzw);
+            simd128i v23 = _mm_unpackhi_epi32(vxy, vzw);
+
+            simd128i *dst = (simd128i*)&packed[h];
+            _mm_storeu_si128(dst + 0, _mm_unpacklo_epi64(p01, v01));
+            _mm_storeu_si128(dst + 1, _mm_unpackhi_epi64(p01, v01));
+            _mm_storeu_si128(dst + 2, _mm_unpacklo_epi64(p23, v23));
+            _mm_storeu_si128(dst + 3, _mm_unpackhi_epi64(p23, v23));
+        }
+        i32 e = std::min<i32>(SOA_BOCK_SIZE, num - i);
+        memcpy(&particles[cell.begin + i], packed, sizeof(mpRenderParticle) * e);
+    }
+}
 
-inline u32 mpGenHash(mpWorld &world, const mpParticle &particle)
+
+inline float mpUpdateLifetime(const mpKernelParams &p, const vec3 &pos, float lifetime, float dt)
+{
+    vec3 rel = glm::abs(pos - (vec3&)p.active_region_center);
+    if (rel.x > p.active_region_extent.x ||
+        rel.y > p.active_region_extent.y ||
+        rel.z > p.active_region_extent.z)
+    {
+        return 0.0f;
+    }
+    return std::max<f32>(lifetime - dt, 0.0f);
+}
+
+// returns cell index. dead particles are mapped to the key next to the last cell.
+inline u64 mpGenHash(mpWorld &world, const vec3 &ppos, float lifetime)
 {
     const mpKernelParams &p = world.getKernelParams();
     mpTempParams &t = world.getTempParams();
     vec3 &bl = (vec3&)t.world_bounds_bl;
     vec3 &rcpCell = (vec3&)t.rcp_cell_size;
-    vec3 &ppos = (vec3&)particle.position;
 
-    u32 xb = clamp<i32>(i32((ppos.x - bl.x)*rcpCell.x), 0, p.world_div.x - 1);
-    u32 zb = clamp<i32>(i32((ppos.z - bl.z)*rcpCell.z), 0, p.world_div.z - 1) << (t.world_div_bits.x);
-    u32 yb = clamp<i32>(i32((ppos.y - bl.y)*rcpCell.y), 0, p.world_div.y - 1) << (t.world_div_bits.x + t.world_div_bits.z);
-    u32 r = xb | zb | yb;
-    if (particle.lifetime <= 0.0f) { r |= 0x80000000; }
-    return r;
+    if (lifetime <= 0.0f) { return u64(1) << (t.world_div_bits.x + t.world_div_bits.y + t.world_div_bits.z); }
+    u64 xb = clamp<i32>(i32((ppos.x - bl.x)*rcpCell.x), 0, p.world_div.x - 1);
+    u64 zb = u64(clamp<i32>(i32((ppos.z - bl.z)*rcpCell.z), 0, p.world_div.z - 1)) << (t.world_div_bits.x);
+    u64 yb = u64(clamp<i32>(i32((ppos.y - bl.y)*rcpCell.y), 0, p.world_div.y - 1)) << (t.world_div_bits.x + t.world_div_bits.z);
+    return xb | zb | yb;
 }
 
-inline void mpGenIndex(mpWorld &world, u32 hash, ispc::vec3i &idx)
+inline void mpGenIndex(mpWorld &world, u64 hash, ispc::vec3i &idx)
 {
     const mpKernelParams &p = world.getKernelParams();
     mpTempParams &t = world.getTempParams();
-    idx.x = hash & (p.world_div.x - 1);
-    idx.z = (hash >> (t.world_div_bits.x)) & (p.world_div.z - 1);
-    idx.y = (hash >> (t.world_div_bits.x + t.world_div_bits.z)) & (p.world_div.y - 1);
+    idx.x = int(hash & (p.world_div.x - 1));
+    idx.z = int((hash >> (t.world_div_bits.x)) & (p.world_div.z - 1));
+    idx.y = int((hash >> (t.world_div_bits.x + t.world_div_bits.z)) & (p.world_div.y - 1));
 }
 
 
 
 static const int g_particles_par_task = 2048;
 static const int g_cells_par_task = 256;
+static const int g_max_dense_world_div = 1024;
+static const int g_max_sparse_world_div = 1 << 20;
+static const int g_broadphase_div_bits = 3; // broadphase has up to 8 tiles on each axis
+static const int g_spawn_queue_capacity = 16384;
+static const int g_merge_sort_divisor = 8; // sortParticles() merges moved particles in while they are at most 1/8 of all
+static const u64 g_moved_key_bit = u64(1) << 63; // on sort keys of particles that may be out of order
 
 mpWorld::mpWorld()
-    : m_id_seed(0)
+    : m_spawn_queue(g_spawn_queue_capacity)
+    , m_num_cells(0)
+    , m_id_seed(0)
+    , m_spawn_seed(0)
+    , m_spawn_counter(0)
     , m_num_particles(0)
+    , m_num_soa_particles(0)
+    , m_num_substeps(0)
+    , m_aos_exposed(false)
+    , m_updating(false)
     , m_has_hithandler(false)
     , m_has_forcehandler(false)
-    , m_num_particles_gpu(0)
+    , m_has_batchhandler(false)
+    , m_gpu_back(0)
+    , m_gpu_front(2)
+    , m_gpu_middle(1)
     , m_num_particles_gpu_prev(0)
+    , m_gpu_format_prev(-1)
+    , m_gpu_texture_prev(nullptr)
 {
+    for (mpGPUSnapshot &snap : m_gpu_snapshots) {
+        snap.num = 0;
+        snap.format = (int)mpRenderFormat::Full;
+    }
 }
 
 mpWorld::~mpWorld()
@@ -193,6 +302,9 @@ void mpWorld::setKernelParams(const mpKernelParams &v)
     m_kparams = v;
 
     if (m_kparams.max_particles != (int)m_particles.size()) {
+        // AoS view must hold all particles before it is resized
+        materializeParticles();
+
         mpParticle blank;
         blank.lifetime = 0.0f;
 
@@ -203,9 +315,11 @@ void mpWorld::setKernelParams(const mpKernelParams &v)
 
 mpTempParams& mpWorld::getTempParams()  { return m_tparams; }
 const mpCellCont& mpWorld::getCells()   { return m_cells; }
+int mpWorld::getNumCells() const        { return m_num_cells; }
 
 void mpWorld::forceSetNumParticles(int v)
 {
+    materializeParticles();
     v = std::min<int>(v, (int)m_kparams.max_particles);
 
     if (v > m_num_particles) {
@@ -223,17 +337,71 @@ void mpWorld::forceSetNumParticles(int v)
 }
 
 int         mpWorld::getNumParticles() const { return m_num_particles; }
-mpParticle* mpWorld::getParticles() { return m_particles.data(); }
-int         mpWorld::getNumParticlesGPU() const { return m_num_particles_gpu; }
-mpParticle* mpWorld::getParticlesGPU() { return m_particles_gpu.data(); }
+mpParticle* mpWorld::getParticles() { materializeParticles(); return m_particles.data(); }
+int         mpWorld::getNumParticlesGPU() const { return m_gpu_snapshots[m_gpu_front].num; }
+
+mpParticle* mpWorld::getParticlesGPU()
+{
+    mpGPUSnapshot &snap = m_gpu_snapshots[m_gpu_front];
+    return snap.format == (int)mpRenderFormat::Full ? (mpParticle*)snap.data.data() : nullptr;
+}
 
-mpParticleIM& mpWorld::getIntermediateData(int i) { return m_imd[i]; }
+mpParticleIM& mpWorld::getIntermediateData(int i) { materializeParticles(); return m_imd[i]; }
 mpParticleIM& mpWorld::getIntermediateData() { return m_imd[m_current]; }
 
-std::mutex& mpWorld::getMutex() { return m_mutex; }
+mpProfiler& mpWorld::getProfiler() { return m_profiler; }
+void mpWorld::setMaxThreads(int v) { m_concurrency.set(v); }
+int mpWorld::getMaxThreads() const { return m_concurrency.get(); }
+int mpWorld::getNumSubsteps() const { return m_num_substeps; }
+
+// SoA data is canonical between updates. AoS view (m_particles & m_imd) is built only when someone
+// asks for it, and is read back at next update because the caller may have modified it.
+void mpWorld::materializeParticles()
+{
+    if (m_aos_exposed) { return; }
+    m_aos_exposed = true;
+
+    int num = std::min<int>(m_num_soa_particles, (int)m_particles.size());
+    if (num == 0) { return; }
+    mpCell *ce = m_cells.data();
+    ist::parallel_for(0, m_num_cells, g_cells_par_task,
+        [&](int i) {
+            if (ce[i].end > num) { return; }
+            mpAoSnize(ce[i], m_soa, m_particles.data(), m_imd.data());
+        });
+}
 
 
 void mpWorld::addParticles(mpParticle *p, size_t num)
+{
+    // m_particles may be in use by the update running in background
+    if (m_updating) {
+        spawnAfterUpdate(p, num);
+    }
+    else {
+        appendParticles(p, num);
+    }
+}
+
+// while updating. particles go to spawn queue, and ones it can't take are kept until endUpdate().
+// once some are kept, later ones are kept too so that particles are added in order of calls.
+void mpWorld::spawnAfterUpdate(const mpParticle *p, size_t num)
+{
+    size_t accepted = m_spawn_overflow.empty() ? (size_t)enqueueParticles(p, num) : 0;
+    m_spawn_overflow.insert(m_spawn_overflow.end(), p + accepted, p + num);
+}
+
+int mpWorld::enqueueParticles(const mpParticle *p, size_t num)
+{
+    return m_spawn_queue.push(p, (int)std::min<size_t>(num, std::numeric_limits<int>::max()));
+}
+
+void mpWorld::setSpawnQueueCapacity(int v)
+{
+    m_spawn_queue.set_capacity(v);
+}
+
+void mpWorld::appendParticles(const mpParticle *p, size_t num)
 {
     num = std::min<size_t>(num, m_kparams.max_particles - m_num_particles);
     for (int i = 0; i < (int)num; ++i) {
@@ -252,64 +420,441 @@ void mpWorld::addParticles(mpParticle *p, size_t num)
     m_num_particles += (int)num;
 }
 
+
+struct mpScatterParams
+{
+    mat4 trans;
+    mpScatterShape shape;
+    mpSpawnParams spawn;
+    u32 seed;
+    u64 counter;    // counter of first particle
+    u32 id_base;    // ids are id_base+1, id_base+2, ...
+    bool id_as_float;
+};
+
+// particles [begin, end) of a burst, 4 at a time. random numbers of i-th particle come from counter+i only,
+// so results don't depend on how the burst is split into tasks.
+static void mpScatterParticlesImpl(mpParticle *dst, int begin, int end, const mpScatterParams &sp)
+{
+    const u32 key1 = 0x6d705363; // 'mpSc'
+    const mat4 &m = sp.trans;
+    const mpSpawnParams &spawn = sp.spawn;
+    const simd128 half = _mm_set1_ps(0.5f);
+    const simd128 vel_diffuse = _mm_set1_ps(spawn.velocity_random_diffuse);
+    const simd128 lifetime_diffuse = _mm_set1_ps(spawn.lifetime_random_diffuse);
+
+    for (int i = begin; i < end; i += 4) {
+        // counter: (index lo, index hi, stream, 0). stream 0: position, 1: velocity & lifetime
+        u64 c[4] = { sp.counter + i, sp.counter + i + 1, sp.counter + i + 2, sp.counter + i + 3 };
+        simd128i c_lo = _mm_set_epi32(u32(c[3]), u32(c[2]), u32(c[1]), u32(c[0]));
+        simd128i c_hi = _mm_set_epi32(u32(c[3] >> 32), u32(c[2] >> 32), u32(c[1] >> 32), u32(c[0] >> 32));
+        simd128i rpos[4] = { c_lo, c_hi, _mm_setzero_si128(), _mm_setzero_si128() };
+        simd128i rspawn[4] = { c_lo, c_hi, _mm_set1_epi32(1), _mm_setzero_si128() };
+        mpPhilox4x32(rpos, sp.seed, key1);
+        mpPhilox4x32(rspawn, sp.seed, key1);
+
+        simd128 x = mpRandBitsToFloat(rpos[0]);
+        simd128 y = mpRandBitsToFloat(rpos[1]);
+        simd128 z = mpRandBitsToFloat(rpos[2]);
+        if (sp.shape == mpScatterShape_Sphere) {
+            // direction to a random point in cube, and distance along it in -0.5-0.5
+            simd128 len_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+            simd128 s = _mm_div_ps(_mm_mul_ps(mpRandBitsToFloat(rpos[3]), half), _mm_sqrt_ps(_mm_max_ps(len_sq, _mm_set1_ps(1e-12f))));
+            x = _mm_mul_ps(x, s);
+            y = _mm_mul_ps(y, s);
+            z = _mm_mul_ps(z, s);
+        }
+        else {
+            x = _mm_mul_ps(x, half);
+            y = _mm_mul_ps(y, half);
+            z = _mm_mul_ps(z, half);
+        }
+        simd128 pos[3];
+        for (int a = 0; a < 3; ++a) {
+            pos[a] = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][a]), x), _mm_mul_ps(_mm_set1_ps(m[1][a]), y)),
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2][a]), z), _mm_set1_ps(m[3][a])));
+        }
+        simd128 vel[3];
+        for (int a = 0; a < 3; ++a) {
+            vel[a] = _mm_add_ps(_mm_set1_ps(spawn.velocity_base[a]), _mm_mul_ps(mpRandBitsToFloat(rspawn[a]), vel_diffuse));
+        }
+        simd128 lifetime = _mm_add_ps(_mm_set1_ps(spawn.lifetime), _mm_mul_ps(mpRandBitsToFloat(rspawn[3]), lifetime_diffuse));
+
+        ist::vec4soa4 aos_pos = ist::soa_transpose44(pos[0], pos[1], pos[2], _mm_setzero_ps());
+        ist::vec4soa4 aos_vel = ist::soa_transpose44(vel[0], vel[1], vel[2], _mm_setzero_ps());
+        float lifetimes[4];
+        _mm_storeu_ps(lifetimes, lifetime);
+        int e = std::min<int>(4, end - i);
+        for (int ei = 0; ei < e; ++ei) {
+            mpParticle &p = dst[i + ei];
+            u32 id = sp.id_base + u32(i + ei) + 1;
+            p.position = aos_pos[ei];
+            if (sp.id_as_float) { (float&)p.id = float(id); }
+            else { p.id = id; }
+            p.velocity = aos_vel[ei];
+            p.hash = 0;
+            p.lifetime = lifetimes[ei];
+            p.hit = 0;
+            p.hit_prev = 0;
+            p.userdata = spawn.userdata;
+        }
+    }
+}
+
+void mpWorld::setSpawnSeed(u32 seed)
+{
+    m_spawn_seed = seed;
+    m_spawn_counter = 0;
+}
+
+void mpWorld::scatterParticles(mpScatterShape shape, const mat4 &trans, int num, const mpSpawnParams *params)
+{
+    if (num <= 0) { return; }
+
+    mpScatterParams sp;
+    sp.trans = trans;
+    sp.shape = shape;
+    if (params) { sp.spawn = *params; }
+    else { memset(&sp.spawn, 0, sizeof(sp.spawn)); }
+    sp.seed = m_spawn_seed;
+    sp.counter = m_spawn_counter;
+    sp.id_base = m_id_seed;
+    sp.id_as_float = m_kparams.id_as_float != 0;
+    m_spawn_counter += num;
+
+    mpHitHandler handler = sp.spawn.handler;
+    if (m_updating) {
+        // m_particles may be in use by the update running in background. ids are given when the queue is drained.
+        mpParticleCont particles(num);
+        ist::parallel_for_blocked(0, num, g_particles_par_task,
+            [&](int begin, int end) { mpScatterParticlesImpl(particles.data(), begin, end, sp); });
+        if (handler) {
+            for (auto &p : particles) { handler(&p); }
+        }
+        spawnAfterUpdate(particles.data(), num);
+        return;
+    }
+
+    num = std::min<int>(num, m_kparams.max_particles - m_num_particles);
+    if (num <= 0) { return; }
+    mpParticle *dst = &m_particles[m_num_particles];
+    ist::parallel_for_blocked(0, num, g_particles_par_task,
+        [&](int begin, int end) { mpScatterParticlesImpl(dst, begin, end, sp); });
+    if (handler) {
+        for (int i = 0; i < num; ++i) { handler(&dst[i]); }
+    }
+    m_id_seed += num;
+    m_num_particles += num;
+}
+
+
+// handle = generation << mpHandleSlotBits | slot. slot 0 is never used, so handles are never 0.
+const int mpHandleSlotBits = 20;
+const int mpHandleSlotMask = (1 << mpHandleSlotBits) - 1;
+const int mpHandleGenerationMask = 0x7ff;
+
+mpColliderProperties& mpWorld::getColliderProperties(int kind, int index)
+{
+    switch (kind) {
+    case mpBP_Plane: return m_plane_colliders[index].props;
+    case mpBP_Sphere: return m_sphere_colliders[index].props;
+    case mpBP_Capsule: return m_capsule_colliders[index].props;
+    case mpBP_Box: return m_box_colliders[index].props;
+    default: return m_sdf_colliders[index].props;
+    }
+}
+
+int mpWorld::getNumColliders(int kind) const
+{
+    switch (kind) {
+    case mpBP_Plane: return (int)m_plane_colliders.size();
+    case mpBP_Sphere: return (int)m_sphere_colliders.size();
+    case mpBP_Capsule: return (int)m_capsule_colliders.size();
+    case mpBP_Box: return (int)m_box_colliders.size();
+    default: return (int)m_sdf_colliders.size();
+    }
+}
+
+void mpWorld::resizeColliders(int kind, int num)
+{
+    switch (kind) {
+    case mpBP_Plane: m_plane_colliders.resize(num); break;
+    case mpBP_Sphere: m_sphere_colliders.resize(num); break;
+    case mpBP_Capsule: m_capsule_colliders.resize(num); break;
+    case mpBP_Box: m_box_colliders.resize(num); break;
+    default: m_sdf_colliders.resize(num); break;
+    }
+}
+
+void mpWorld::moveCollider(int kind, int from, int to)
+{
+    if (from == to) { return; }
+    switch (kind) {
+    case mpBP_Plane: m_plane_colliders[to] = m_plane_colliders[from]; break;
+    case mpBP_Sphere: m_sphere_colliders[to] = m_sphere_colliders[from]; break;
+    case mpBP_Capsule: m_capsule_colliders[to] = m_capsule_colliders[from]; break;
+    case mpBP_Box: m_box_colliders[to] = m_box_colliders[from]; break;
+    default: m_sdf_colliders[to] = m_sdf_colliders[from]; break;
+    }
+    int id = getColliderProperties(kind, to).owner_id;
+    if (id >= 0 && id < (int)m_id_table.size() && m_id_table[id].kind == kind && m_id_table[id].index == from) {
+        m_id_table[id].index = to;
+    }
+}
+
+void mpWorld::registerColliders(int kind, int begin, int end)
+{
+    for (int i = begin; i < end; ++i) {
+        int id = getColliderProperties(kind, i).owner_id;
+        if (id < 0) { continue; }
+        if (id >= (int)m_id_table.size()) { m_id_table.resize(id + 1); }
+        m_id_table[id] = mpColliderLocation(kind, i);
+    }
+}
+
+void mpWorld::unregisterCollider(int kind, int index)
+{
+    int id = getColliderProperties(kind, index).owner_id;
+    if (id >= 0 && id < (int)m_id_table.size() && m_id_table[id].kind == kind && m_id_table[id].index == index) {
+        m_id_table[id] = mpColliderLocation();
+    }
+}
+
+void mpWorld::eraseCollider(int kind, int index)
+{
+    unregisterCollider(kind, index);
+
+    // last persistent collider fills the hole, and last non-persistent collider fills its place.
+    // slot of erased persistent collider is released, so its handle becomes invalid however it was erased.
+    std::vector<int> &persistent = m_persistent[kind];
+    if (index < (int)persistent.size()) {
+        int last = (int)persistent.size() - 1;
+        releaseSlot(persistent[index]);
+        if (index != last) {
+            moveCollider(kind, last, index);
+            persistent[index] = persistent[last];
+            m_slots[persistent[index]].index = index;
+        }
+        persistent.pop_back();
+        index = last;
+    }
+    int num = getNumColliders(kind);
+    moveCollider(kind, num - 1, index);
+    resizeColliders(kind, num - 1);
+}
+
+mpColliderProperties* mpWorld::findCollider(int owner_id)
+{
+    if (owner_id < 0 || owner_id >= (int)m_id_table.size()) { return nullptr; }
+    const mpColliderLocation &loc = m_id_table[owner_id];
+    return loc.kind < 0 ? nullptr : &getColliderProperties(loc.kind, loc.index);
+}
+
+
 void mpWorld::addPlaneColliders(mpPlaneCollider *col, size_t num)
 {
     m_plane_colliders.insert(m_plane_colliders.end(), col, col + num);
+    registerColliders(mpBP_Plane, (int)(m_plane_colliders.size() - num), (int)m_plane_colliders.size());
 }
 
 void mpWorld::addSphereColliders(mpSphereCollider *col, size_t num)
 {
     m_sphere_colliders.insert(m_sphere_colliders.end(), col, col + num);
+    registerColliders(mpBP_Sphere, (int)(m_sphere_colliders.size() - num), (int)m_sphere_colliders.size());
 }
 
 void mpWorld::addCapsuleColliders(mpCapsuleCollider *col, size_t num)
 {
     m_capsule_colliders.insert(m_capsule_colliders.end(), col, col + num);
+    registerColliders(mpBP_Capsule, (int)(m_capsule_colliders.size() - num), (int)m_capsule_colliders.size());
 }
 
 void mpWorld::addBoxColliders(mpBoxCollider *col, size_t num)
 {
     m_box_colliders.insert(m_box_colliders.end(), col, col + num);
+    registerColliders(mpBP_Box, (int)(m_box_colliders.size() - num), (int)m_box_colliders.size());
+}
+
+void mpWorld::addSDFColliders(mpSDFCollider *col, size_t num, const std::shared_ptr<mpSDFData> &sdf)
+{
+    m_sdf_colliders.insert(m_sdf_colliders.end(), col, col + num);
+    registerColliders(mpBP_SDF, (int)(m_sdf_colliders.size() - num), (int)m_sdf_colliders.size());
+    m_sdf_data.push_back(sdf);
 }
 
 
 void mpWorld::removeCollider(mpColliderProperties &props)
 {
-    {
-        auto i = std::lower_bound(m_box_colliders.begin(), m_box_colliders.end(), props.owner_id,
-            [&](const mpBoxCollider &c, int i) { return c.props.owner_id < i; });
-        if (i != m_box_colliders.end()) {
-            i->props.hit_handler = nullptr;
-            i->props.force_handler = nullptr;
-            return;
+    mpColliderProperties *p = findCollider(props.owner_id);
+
+    // handlers are not touched by kernels, so they can be cleared even while updating.
+    // the collider itself is removed when the update is done. it may be one created while updating.
+    if (p) {
+        p->hit_handler = nullptr;
+        p->force_handler = nullptr;
+    }
+    if (m_updating) {
+        mpDeferredColliderOp op = { mpDeferred_Remove, -1, props.owner_id, -1 };
+        m_deferred_ops.push_back(op);
+    }
+    else if (p) {
+        const mpColliderLocation &loc = m_id_table[props.owner_id];
+        eraseCollider(loc.kind, loc.index);
+    }
+}
+
+// applies collider operations made while updating, in order they were made
+void mpWorld::flushDeferredColliders()
+{
+    for (const mpDeferredColliderOp &op : m_deferred_ops) {
+        switch (op.op) {
+        case mpDeferred_Remove:
+            if (findCollider(op.handle)) {
+                const mpColliderLocation &loc = m_id_table[op.handle];
+                eraseCollider(loc.kind, loc.index);
+            }
+            break;
+        case mpDeferred_Create:
+            switch (op.kind) {
+            case mpBP_Sphere: insertCollider(m_sphere_colliders, op.kind, op.handle, m_deferred_spheres[op.data]); break;
+            case mpBP_Capsule: insertCollider(m_capsule_colliders, op.kind, op.handle, m_deferred_capsules[op.data]); break;
+            case mpBP_Box: insertCollider(m_box_colliders, op.kind, op.handle, m_deferred_boxes[op.data]); break;
+            }
+            break;
+        case mpDeferred_Update:
+            switch (op.kind) {
+            case mpBP_Sphere: updateCollidersImpl(m_sphere_colliders, m_deferred_spheres, op.kind, &op.handle, &m_deferred_spheres[op.data], 1); break;
+            case mpBP_Capsule: updateCollidersImpl(m_capsule_colliders, m_deferred_capsules, op.kind, &op.handle, &m_deferred_capsules[op.data], 1); break;
+            case mpBP_Box: updateCollidersImpl(m_box_colliders, m_deferred_boxes, op.kind, &op.handle, &m_deferred_boxes[op.data], 1); break;
+            }
+            break;
+        case mpDeferred_Destroy:
+            destroyColliders(&op.handle, 1);
+            break;
         }
     }
-    {
-        auto i = std::lower_bound(m_sphere_colliders.begin(), m_sphere_colliders.end(), props.owner_id,
-            [&](const mpSphereCollider &c, int i) { return c.props.owner_id < i; });
-        if (i != m_sphere_colliders.end()) {
-            i->props.hit_handler = nullptr;
-            i->props.force_handler = nullptr;
-            return;
+    m_deferred_ops.clear();
+    m_deferred_spheres.clear();
+    m_deferred_capsules.clear();
+    m_deferred_boxes.clear();
+}
+
+
+mpColliderLocation* mpWorld::findHandle(int handle)
+{
+    int slot = handle & mpHandleSlotMask;
+    int generation = (handle >> mpHandleSlotBits) & mpHandleGenerationMask;
+    if (handle <= 0 || slot == 0 || slot >= (int)m_slots.size() || m_slots[slot].kind < 0 || m_slot_generations[slot] != generation) {
+        return nullptr;
+    }
+    return &m_slots[slot];
+}
+
+void mpWorld::releaseSlot(int slot)
+{
+    m_slots[slot] = mpColliderLocation();
+    m_slot_generations[slot] = (m_slot_generations[slot] + 1) & mpHandleGenerationMask;
+    m_free_slots.push_back(slot);
+}
+
+int mpWorld::allocHandle(int kind, int index)
+{
+    if (m_slots.empty()) {
+        m_slots.push_back(mpColliderLocation());
+        m_slot_generations.push_back(0);
+    }
+    int slot;
+    if (!m_free_slots.empty()) {
+        slot = m_free_slots.back();
+        m_free_slots.pop_back();
+    }
+    else {
+        slot = (int)m_slots.size();
+        m_slots.push_back(mpColliderLocation());
+        m_slot_generations.push_back(0);
+    }
+    m_slots[slot] = mpColliderLocation(kind, index);
+    return (m_slot_generations[slot] << mpHandleSlotBits) | slot;
+}
+
+bool mpWorld::isValidHandle(int handle)
+{
+    return findHandle(handle) != nullptr;
+}
+
+// slot of handle must be allocated, but not placed yet
+template<class Cont>
+void mpWorld::insertCollider(Cont &cont, int kind, int handle, const typename Cont::value_type &col)
+{
+    // first non-persistent collider moves to the end to make room
+    std::vector<int> &persistent = m_persistent[kind];
+    int index = (int)persistent.size();
+    cont.push_back(col);
+    moveCollider(kind, index, (int)cont.size() - 1);
+    cont[index] = col;
+    registerColliders(kind, index, index + 1);
+
+    int slot = handle & mpHandleSlotMask;
+    m_slots[slot].index = index;
+    persistent.push_back(slot);
+}
+
+// slots are allocated right away even while updating, so that handles can be returned.
+// they are valid from then on, and colliders are placed when the update is done.
+template<class Cont>
+void mpWorld::createCollidersImpl(Cont &cont, Cont &deferred, int kind, const typename Cont::value_type *col, size_t num, int *o_handles)
+{
+    for (size_t i = 0; i < num; ++i) {
+        int handle = allocHandle(kind, -1);
+        if (m_updating) {
+            mpDeferredColliderOp op = { mpDeferred_Create, kind, handle, (int)deferred.size() };
+            m_deferred_ops.push_back(op);
+            deferred.push_back(col[i]);
         }
+        else {
+            insertCollider(cont, kind, handle, col[i]);
+        }
+        if (o_handles) { o_handles[i] = handle; }
     }
-    {
-        auto i = std::lower_bound(m_capsule_colliders.begin(), m_capsule_colliders.end(), props.owner_id,
-            [&](const mpCapsuleCollider &c, int i) { return c.props.owner_id < i; });
-        if (i != m_capsule_colliders.end()) {
-            i->props.hit_handler = nullptr;
-            i->props.force_handler = nullptr;
-            return;
+}
+
+template<class Cont>
+void mpWorld::updateCollidersImpl(Cont &cont, Cont &deferred, int kind, const int *handles, const typename Cont::value_type *col, size_t num)
+{
+    for (size_t i = 0; i < num; ++i) {
+        mpColliderLocation *loc = findHandle(handles[i]);
+        if (loc == nullptr || loc->kind != kind) { continue; }
+        if (m_updating) {
+            mpDeferredColliderOp op = { mpDeferred_Update, kind, handles[i], (int)deferred.size() };
+            m_deferred_ops.push_back(op);
+            deferred.push_back(col[i]);
+            continue;
         }
+        unregisterCollider(kind, loc->index);
+        cont[loc->index] = col[i];
+        registerColliders(kind, loc->index, loc->index + 1);
     }
-    {
-        auto i = std::lower_bound(m_plane_colliders.begin(), m_plane_colliders.end(), props.owner_id,
-            [&](const mpPlaneCollider &c, int i) { return c.props.owner_id < i; });
-        if (i != m_plane_colliders.end()) {
-            i->props.hit_handler = nullptr;
-            i->props.force_handler = nullptr;
-            return;
+}
+
+void mpWorld::createColliders(const mpSphereCollider *col, size_t num, int *o_handles) { createCollidersImpl(m_sphere_colliders, m_deferred_spheres, mpBP_Sphere, col, num, o_handles); }
+void mpWorld::createColliders(const mpCapsuleCollider *col, size_t num, int *o_handles) { createCollidersImpl(m_capsule_colliders, m_deferred_capsules, mpBP_Capsule, col, num, o_handles); }
+void mpWorld::createColliders(const mpBoxCollider *col, size_t num, int *o_handles) { createCollidersImpl(m_box_colliders, m_deferred_boxes, mpBP_Box, col, num, o_handles); }
+void mpWorld::updateColliders(const int *handles, const mpSphereCollider *col, size_t num) { updateCollidersImpl(m_sphere_colliders, m_deferred_spheres, mpBP_Sphere, handles, col, num); }
+void mpWorld::updateColliders(const int *handles, const mpCapsuleCollider *col, size_t num) { updateCollidersImpl(m_capsule_colliders, m_deferred_capsules, mpBP_Capsule, handles, col, num); }
+void mpWorld::updateColliders(const int *handles, const mpBoxCollider *col, size_t num) { updateCollidersImpl(m_box_colliders, m_deferred_boxes, mpBP_Box, handles, col, num); }
+
+void mpWorld::destroyColliders(const int *handles, size_t num)
+{
+    for (size_t i = 0; i < num; ++i) {
+        mpColliderLocation *loc = findHandle(handles[i]);
+        if (loc == nullptr) { continue; }
+        if (m_updating) {
+            mpDeferredColliderOp op = { mpDeferred_Destroy, loc->kind, handles[i], -1 };
+            m_deferred_ops.push_back(op);
+            continue;
         }
+        eraseCollider(loc->kind, loc->index); // releases the slot
     }
 }
 
@@ -319,6 +864,20 @@ void mpWorld::addForces(mpForce *force, size_t num)
     m_forces.insert(m_forces.end(), force, force + num);
 }
 
+void mpWorld::addSplineForce(mpForce &force, const vec3 *polyline, size_t num_points)
+{
+    force.spline_begin = (int)m_spline_points.size();
+    force.spline_num = (int)num_points;
+    m_spline_points.insert(m_spline_points.end(), polyline, polyline + num_points);
+    m_forces.push_back(force);
+}
+
+void mpWorld::addBakedFieldForce(mpForce &force, const std::shared_ptr<mpBakedFieldData> &field)
+{
+    m_forces.push_back(force);
+    m_field_data.push_back(field);
+}
+
 
 inline ivec3 Position2Index(mpWorld &w, const vec3 &pos)
 {
@@ -389,19 +948,36 @@ inline int overlapSphere_AABB(const vec3 &sphere_pos, float sphere_radius, const
 }
 
 
+inline bool IsInside(const ivec3 &idx, const ivec3 &imin, const ivec3 &imax)
+{
+    return
+        idx.x >= imin.x && idx.x < imax.x &&
+        idx.y >= imin.y && idx.y < imax.y &&
+        idx.z >= imin.z && idx.z < imax.z;
+}
+
+// visits occupied cells in [imin, imax). if the region is larger than number of occupied cells,
+// walks occupied cell list instead of looking up each cell in the region.
 // f: [](const mpCell &cell, const ivec3 &cell_index)
 template<class F>
 inline void ScanCells(mpWorld &w, const ivec3 &imin, const ivec3 &imax, const F &f)
 {
-    const mpCellCont &cells = w.getCells();
-    if (cells.empty()) return;
-    ivec3 bits = w.getTempParams().world_div_bits;
-    mpParticle *particles = w.getParticles();
+    const mpCell *cells = w.getCells().data();
+    int num_cells = w.getNumCells();
+    if (num_cells == 0) return;
+    ivec3 size = imax - imin;
+    if (i64(size.x) * i64(size.y) * i64(size.z) > num_cells) {
+        for (int ci = 0; ci < num_cells; ++ci) {
+            const ivec3 &idx = (const ivec3&)cells[ci].index;
+            if (IsInside(idx, imin, imax)) { f(cells[ci], idx); }
+        }
+        return;
+    }
     for (int iy = imin.y; iy < imax.y; ++iy) {
         for (int iz = imin.z; iz < imax.z; ++iz) {
             for (int ix = imin.x; ix < imax.x; ++ix) {
-                u32 ci = ix | (iz << bits.x) | (iy << (bits.x + bits.z));
-                f(cells[ci], ivec3(ix, iy, iz));
+                int ci = w.findCell(ivec3(ix, iy, iz));
+                if (ci >= 0) { f(cells[ci], ivec3(ix, iy, iz)); }
             }
         }
     }
@@ -411,18 +987,25 @@ inline void ScanCells(mpWorld &w, const ivec3 &imin, const ivec3 &imax, const F
 template<class F>
 inline void ScanCellsParallel(mpWorld &w, const ivec3 &imin, const ivec3 &imax, const F &f)
 {
-    const mpCellCont &cells = w.getCells();
-    if (cells.empty()) return;
-    ivec3 bits = w.getTempParams().world_div_bits;
-    mpParticle *particles = w.getParticles();
-    int lz = imax.z - imin.z;
-    int ly = imax.y - imin.y;
+    const mpCell *cells = w.getCells().data();
+    int num_cells = w.getNumCells();
+    if (num_cells == 0) return;
+    ivec3 size = imax - imin;
+    if (i64(size.x) * i64(size.y) * i64(size.z) > num_cells) {
+        ist::parallel_for(0, num_cells, g_cells_par_task, [&](int ci) {
+            const ivec3 &idx = (const ivec3&)cells[ci].index;
+            if (IsInside(idx, imin, imax)) { f(cells[ci], idx); }
+        });
+        return;
+    }
+    int lz = size.z;
+    int ly = size.y;
     if (ly > 4) {
         ist::parallel_for(imin.y, imax.y, [&](int iy) {
             for (int iz = imin.z; iz < imax.z; ++iz) {
                 for (int ix = imin.x; ix < imax.x; ++ix) {
-                    u32 ci = ix | (iz << bits.x) | (iy << (bits.x + bits.z));
-                    f(cells[ci], ivec3(ix, iy, iz));
+                    int ci = w.findCell(ivec3(ix, iy, iz));
+                    if (ci >= 0) { f(cells[ci], ivec3(ix, iy, iz)); }
                 }
             }
         });
@@ -431,8 +1014,8 @@ inline void ScanCellsParallel(mpWorld &w, const ivec3 &imin, const ivec3 &imax,
         for (int iy = imin.y; iy < imax.y; ++iy) {
             ist::parallel_for(imin.z, imax.z, [&](int iz) {
                 for (int ix = imin.x; ix < imax.x; ++ix) {
-                    u32 ci = ix | (iz << bits.x) | (iy << (bits.x + bits.z));
-                    f(cells[ci], ivec3(ix, iy, iz));
+                    int ci = w.findCell(ivec3(ix, iy, iz));
+                    if (ci >= 0) { f(cells[ci], ivec3(ix, iy, iz)); }
                 }
             });
         }
@@ -444,6 +1027,7 @@ inline void ScanCellsParallel(mpWorld &w, const ivec3 &imin, const ivec3 &imax,
 
 void mpWorld::scanSphere(mpHitHandler handler, const vec3 &pos, float radius)
 {
+    materializeParticles();
     const mpKernelParams &k = m_kparams;
     const mpTempParams &t = m_tparams;
     ivec3 imin = Position2Index(*this, pos - radius);
@@ -470,6 +1054,7 @@ void mpWorld::scanSphere(mpHitHandler handler, const vec3 &pos, float radius)
 
 void mpWorld::scanAABB(mpHitHandler handler, const vec3 &center, const vec3 &extent)
 {
+    materializeParticles();
     const mpKernelParams &k = m_kparams;
     const mpTempParams &t = m_tparams;
     ivec3 imin = Position2Index(*this, center - extent);
@@ -495,6 +1080,7 @@ void mpWorld::scanAABB(mpHitHandler handler, const vec3 &center, const vec3 &ext
 
 void mpWorld::scanSphereParallel(mpHitHandler handler, const vec3 &pos, float radius)
 {
+    materializeParticles();
     const mpKernelParams &k = m_kparams;
     const mpTempParams &t = m_tparams;
     ivec3 imin = Position2Index(*this, pos - radius);
@@ -521,6 +1107,7 @@ void mpWorld::scanSphereParallel(mpHitHandler handler, const vec3 &pos, float ra
 
 void mpWorld::scanAABBParallel(mpHitHandler handler, const vec3 &center, const vec3 &extent)
 {
+    materializeParticles();
     const mpKernelParams &k = m_kparams;
     const mpTempParams &t = m_tparams;
     ivec3 imin = Position2Index(*this, center - extent);
@@ -546,6 +1133,7 @@ void mpWorld::scanAABBParallel(mpHitHandler handler, const vec3 &center, const v
 
 void mpWorld::scanAll(mpHitHandler handler)
 {
+    materializeParticles();
     for (int i = 0; i < m_num_particles; ++i) {
         handler(&m_particles[i]);
     }
@@ -553,6 +1141,7 @@ void mpWorld::scanAll(mpHitHandler handler)
 
 void mpWorld::scanAllParallel(mpHitHandler handler)
 {
+    materializeParticles();
     ist::parallel_for(0, m_num_particles, g_particles_par_task,
         [&](int i) {
             handler(&m_particles[i]);
@@ -561,7 +1150,18 @@ void mpWorld::scanAllParallel(mpHitHandler handler)
 
 void mpWorld::moveAll(const vec3 &move)
 {
-    ist::parallel_for(0, m_num_particles, g_particles_par_task,
+    // move canonical data. padding slots of SoA are moved too, which is harmless.
+    int num_soa = m_aos_exposed ? 0 : m_num_soa_particles;
+    if (num_soa > 0) {
+        int num_slots = (int)m_soa.pos_x.size();
+        ist::parallel_for(0, num_slots, g_particles_par_task,
+            [&](int i) {
+                m_soa.pos_x[i] += move.x;
+                m_soa.pos_y[i] += move.y;
+                m_soa.pos_z[i] += move.z;
+            });
+    }
+    ist::parallel_for(num_soa, m_num_particles, g_particles_par_task,
         [&](int i) {
             (vec3&)m_particles[i].position += move;
         });
@@ -571,31 +1171,49 @@ void mpWorld::moveAll(const vec3 &move)
 void mpWorld::clearParticles()
 {
     m_num_particles = 0;
+    m_num_soa_particles = 0;
+    m_aos_exposed = false;
     for (u32 i = 0; i < m_particles.size(); ++i) {
         m_particles[i].lifetime = 0.0f;
     }
+    // keep cells for lookup table cleanup at next update, but make them empty
+    for (int i = 0; i < m_num_cells; ++i) {
+        m_cells[i].end = m_cells[i].begin;
+    }
 }
 
 void mpWorld::clearCollidersAndForces()
 {
-    m_plane_colliders.clear();
-    m_sphere_colliders.clear();
-    m_capsule_colliders.clear();
-    m_box_colliders.clear();
+    for (int kind = 0; kind < mpNumColliderKinds; ++kind) {
+        int num_persistent = (int)m_persistent[kind].size();
+        for (int i = num_persistent; i < getNumColliders(kind); ++i) { unregisterCollider(kind, i); }
+        resizeColliders(kind, num_persistent);
+    }
+    m_sdf_data.clear();
     m_forces.clear();
+    m_spline_points.clear();
+    m_field_data.clear();
 
     m_has_hithandler = false;
     m_has_forcehandler = false;
+    m_has_batchhandler = false;
 }
 
 
 void mpWorld::update(float dt)
 {
+    m_concurrency.run([&]() { updateImpl(dt); });
+}
+
+void mpWorld::updateImpl(float dt)
+{
+    m_spawn_queue.drain([&](mpParticle *p, int num) { appendParticles(p, num); });
     if (m_num_particles == 0) { return; }
+    mpProfileScope prof_update(m_profiler, mpProfilePhase::Update);
 
     mpKernelParams &kp = m_kparams;
     mpTempParams &tp = m_tparams;
-    int cell_num = 0;
+    i64 cell_num = 0;
 
     {
         vec3 &wpos = (vec3&)kp.world_center;
@@ -607,13 +1225,16 @@ void mpWorld::update(float dt)
         kp.particle_size = std::max<float>(kp.particle_size, 0.00001f);
         kp.max_particles = std::max<int>(kp.max_particles, 128);
         m_num_particles = std::min<int>(m_num_particles, kp.max_particles);
-        kp.world_div.x = clamp<int>(1 << msb(kp.world_div.x), 1, 1024);
-        kp.world_div.y = clamp<int>(1 << msb(kp.world_div.y), 1, 1024);
-        kp.world_div.z = clamp<int>(1 << msb(kp.world_div.z), 1, 1024);
+        m_num_soa_particles = std::min<int>(m_num_soa_particles, m_num_particles);
+        // dense grid has table of all cells. sparse grid only has occupied cells, so it can be much finer.
+        const int max_div = kp.sparse_grid ? g_max_sparse_world_div : g_max_dense_world_div;
+        kp.world_div.x = clamp<int>(1 << msb(kp.world_div.x), 1, max_div);
+        kp.world_div.y = clamp<int>(1 << msb(kp.world_div.y), 1, max_div);
+        kp.world_div.z = clamp<int>(1 << msb(kp.world_div.z), 1, max_div);
         tp.world_div_bits.x = msb(kp.world_div.x);
         tp.world_div_bits.y = msb(kp.world_div.y);
         tp.world_div_bits.z = msb(kp.world_div.z);
-        cell_num = kp.world_div.x * kp.world_div.y * kp.world_div.z;
+        cell_num = i64(kp.world_div.x) * i64(kp.world_div.y) * i64(kp.world_div.z);
         cellsize = (wsize*2.0f / vec3((float)kp.world_div.x, (float)kp.world_div.y, (float)kp.world_div.z));
         cellsize_r = vec3(1.0f, 1.0f, 1.0f) / cellsize;
         bl = wpos - wsize;
@@ -626,288 +1247,970 @@ void mpWorld::update(float dt)
             asize = wsize;
         }
 
-        int reserve_size = mpParticlesEachLine * (ceildiv(kp.max_particles, mpParticlesEachLine));
-        m_cells.resize(cell_num);
         m_particles.resize(kp.max_particles);
+        m_sort_keys.resize(kp.max_particles);
+        m_sort_keys_tmp.resize(kp.max_particles);
+        m_sort_indices.resize(kp.max_particles);
+        m_sort_indices_tmp.resize(kp.max_particles);
         m_imd.resize(kp.max_particles);
-        m_particles_gpu.reserve(reserve_size);
-        m_particles_gpu.resize(kp.max_particles);
 
-        int num_soa_data_blocks = std::min<int>(cell_num, kp.max_particles);
-        if (kp.max_particles > cell_num) {
-            num_soa_data_blocks = cell_num + ((kp.max_particles - cell_num + 1) / 8);
+        // every occupied cell takes at least one block
+        int max_cells = (int)std::min<i64>(cell_num, kp.max_particles);
+        int num_soa_data_blocks = max_cells + (kp.max_particles - max_cells + SOA_BOCK_SIZE - 1) / SOA_BOCK_SIZE;
+        m_soa_back.resize(num_soa_data_blocks * SOA_BOCK_SIZE);
+    }
+
+    {
+        const float PI = 3.14159265359f;
+        kp.RcpParticleSize2 = 1.0f / (m_kparams.particle_size*2.0f);
+        kp.SPHDensityCoef = m_kparams.SPHParticleMass * 315.0f / (64.0f * PI * pow(m_kparams.particle_size, 9));
+        kp.SPHGradPressureCoef = m_kparams.SPHParticleMass * -45.0f / (PI * pow(m_kparams.particle_size, 6));
+        kp.SPHLapViscosityCoef = m_kparams.SPHParticleMass * m_kparams.SPHViscosity * 45.0f / (PI * pow(m_kparams.particle_size, 6));
+    }
+
+    // colliders & forces don't change through substeps
+    if (kp.enable_colliders || kp.enable_forces) {
+        mpProfileScope prof(m_profiler, mpProfilePhase::Broadphase);
+        buildBroadphase();
+    }
+
+    // substeps. count is chosen so that the fastest particle moves at most substep_cfl * particle_size in a substep.
+    const float timestep = kp.timestep;
+    int num_substeps = 1;
+    if (kp.adaptive_substeps) {
+        float max_distance = getMaxSpeed() * dt;
+        float limit = std::max<float>(kp.substep_cfl * kp.particle_size, 0.00001f);
+        num_substeps = clamp<int>((int)std::ceil(max_distance / limit), 1, std::max<int>(kp.max_substeps, 1));
+        kp.timestep = dt / num_substeps;
+    }
+    for (int si = 0; si < num_substeps; ++si) {
+        if (si > 0 && m_num_particles == 0) { break; }
+        step(kp.adaptive_substeps ? kp.timestep : dt, cell_num, si);
+    }
+    kp.timestep = timestep;
+    m_num_substeps = num_substeps;
+
+    {
+        mpProfileScope prof(m_profiler, mpProfilePhase::GPUClone);
+        publishSnapshot();
+    }
+}
+
+// builds snapshot for GPU in back buffer directly from SoA, then publishes it.
+void mpWorld::publishSnapshot()
+{
+    mpGPUSnapshot &snap = m_gpu_snapshots[m_gpu_back];
+    const int format = m_kparams.render_format;
+
+    // whole lines of data texture
+    int each_line = mpParticlesEachLine(format);
+    size_t size = mpBytesEachParticle(format) * each_line * ceildiv(m_kparams.max_particles, each_line);
+    if (snap.format != format || snap.data.size() != size) {
+        snap.data.assign(size, 0);
+        snap.num = 0;
+        snap.format = format;
+    }
+
+    // this buffer may have particles alive in older snapshots. they must be seen as dead.
+    const mpCell *ce = m_cells.data();
+    if (format == (int)mpRenderFormat::Compact) {
+        mpRenderParticle *dst = (mpRenderParticle*)snap.data.data();
+        const bool id_as_float = m_kparams.id_as_float != 0;
+        mpParallelFor(m_profiler, mpProfilePhase::GPUClone, 0, m_num_cells, g_cells_par_task,
+            [&](int i) {
+                mpAoSnizeCompact(ce[i], m_soa, dst, id_as_float);
+            });
+        for (int i = m_num_particles; i < snap.num; ++i) {
+            dst[i].lifetime = 0; // +0.0 in half
+        }
+    }
+    else {
+        mpParticle *dst = (mpParticle*)snap.data.data();
+        mpParallelFor(m_profiler, mpProfilePhase::GPUClone, 0, m_num_cells, g_cells_par_task,
+            [&](int i) {
+                mpAoSnize(ce[i], m_soa, dst, nullptr);
+            });
+        for (int i = m_num_particles; i < snap.num; ++i) {
+            dst[i].lifetime = 0.0f;
         }
-        m_soa.resize(num_soa_data_blocks * 8);
     }
+    snap.num = m_num_particles;
+
+    m_gpu_back = m_gpu_middle.exchange(m_gpu_back | mpSnapshotFresh, std::memory_order_acq_rel) & mpSnapshotIndexMask;
+}
+
+// one step of simulation: gen hash, sort, gather and solve. substep > 0 is a substep of same update:
+// particles are already in SoA, and if no particle left its cell, cells & SoA layout of previous substep are kept.
+void mpWorld::step(float dt, i64 cell_num, int substep)
+{
+    mpKernelParams &kp = m_kparams;
+    mpTempParams &tp = m_tparams;
 
-    mpCell              *ce = m_cells.data();
     mpPlaneCollider     *planes = m_plane_colliders.data();
     mpSphereCollider    *spheres = m_sphere_colliders.data();
     mpCapsuleCollider   *capsules = m_capsule_colliders.data();
     mpBoxCollider       *boxes = m_box_colliders.data();
     mpForce             *forces = m_forces.data();
 
-    int num_colliders = int(m_plane_colliders.size() + m_sphere_colliders.size() + m_capsule_colliders.size() + m_box_colliders.size());
-
+    // gen hash. particles come from SoA of previous update, except ones added or exposed through AoS view.
+    const int num_particles = m_num_particles;
+    const int num_soa = m_aos_exposed ? 0 : m_num_soa_particles;
+    const u64 dead_key = u64(1) << (tp.world_div_bits.x + tp.world_div_bits.y + tp.world_div_bits.z);
+    u64 *keys = m_sort_keys.data();
+    int *srcs = m_sort_indices.data();
+    std::atomic<int> num_moved(0); // particles that left their cell or died
+    std::atomic<int> num_dead(0);
     {
-        const float PI = 3.14159265359f;
-        kp.RcpParticleSize2 = 1.0f / (m_kparams.particle_size*2.0f);
-        kp.SPHDensityCoef = m_kparams.SPHParticleMass * 315.0f / (64.0f * PI * pow(m_kparams.particle_size, 9));
-        kp.SPHGradPressureCoef = m_kparams.SPHParticleMass * -45.0f / (PI * pow(m_kparams.particle_size, 6));
-        kp.SPHLapViscosityCoef = m_kparams.SPHParticleMass * m_kparams.SPHViscosity * 45.0f / (PI * pow(m_kparams.particle_size, 6));
+        mpProfileScope prof(m_profiler, mpProfilePhase::GenHash);
+        if (num_soa > 0) {
+            const mpCell *ce = m_cells.data();
+            const u64 *cell_keys = m_cell_keys.data();
+            mpParallelFor(m_profiler, mpProfilePhase::GenHash, 0, m_num_cells, g_cells_par_task,
+                [&](int ci) {
+                    const mpCell &cell = ce[ci];
+                    i32 si = cell.soai * SOA_BOCK_SIZE;
+                    i32 n = std::min<i32>(cell.end, num_soa) - cell.begin;
+                    int moved = 0, dead = 0;
+                    for (i32 i = 0; i < n; ++i) {
+                        i32 s = si + i;
+                        vec3 pos(m_soa.pos_x[s], m_soa.pos_y[s], m_soa.pos_z[s]);
+                        m_soa.lifetime[s] = mpUpdateLifetime(kp, pos, m_soa.lifetime[s], dt);
+                        u64 key = mpGenHash(*this, pos, m_soa.lifetime[s]);
+                        if (key != cell_keys[ci]) {
+                            ++moved;
+                            if (key == dead_key) { ++dead; }
+                            else { key |= g_moved_key_bit; }
+                        }
+                        keys[cell.begin + i] = key;
+                        srcs[cell.begin + i] = s;
+                    }
+                    if (moved) { num_moved += moved; }
+                    if (dead) { num_dead += dead; }
+                });
+        }
+        mpParallelFor(m_profiler, mpProfilePhase::GenHash, num_soa, num_particles, g_particles_par_task,
+            [&](int i) {
+                mpParticle &p = m_particles[i];
+                p.lifetime = mpUpdateLifetime(kp, (vec3&)p.position, p.lifetime, dt);
+                u64 key = mpGenHash(*this, (vec3&)p.position, p.lifetime);
+                if (key == dead_key) { ++num_dead; }
+                else { key |= g_moved_key_bit; }
+                keys[i] = key;
+                srcs[i] = ~i;
+            });
+    }
+
+    // if every particle stays in its cell, SoA layout doesn't change.
+    const bool same_layout = num_soa == num_particles && num_moved == 0;
+    // neighbor list follows particles to their new slots, but particles from AoS view have no list
+    // and may have been moved by user.
+    m_nlist.valid = m_nlist.valid && num_soa == num_particles;
+
+    // in substeps, params are same as previous substep. so cells are still valid if layout is same.
+    const bool keep_cells = substep > 0 && same_layout;
+    if (!keep_cells) {
+        // drop dead particles first, so that the sort is skipped if only deaths broke the order
+        if (num_dead > 0) {
+            mpProfileScope prof(m_profiler, mpProfilePhase::Compact);
+            compactParticles();
+            srcs = m_sort_indices.data();
+        }
+
+        // sort by hash
+        {
+            mpProfileScope prof(m_profiler, mpProfilePhase::Sort);
+            sortParticles();
+        }
+
+        // build occupied cell list & lookup table
+        {
+            mpProfileScope prof(m_profiler, mpProfilePhase::BuildCells);
+            buildCells(cell_num);
+        }
+
+        // previous SoA / AoS view -> new SoA. hits are accumulated through substeps.
+        {
+            mpProfileScope prof(m_profiler, mpProfilePhase::Gather);
+            if (substep > 0) {
+                // back buffer is what previous update gathered from. it may not have been resized yet.
+                m_soa_back.resize(m_soa.pos_x.size());
+            }
+            const mpCell *ce = m_cells.data();
+            mpParallelFor(m_profiler, mpProfilePhase::Gather, 0, m_num_cells, g_cells_par_task,
+                [&](int i) {
+                    mpSoAGather(ce[i], srcs, m_soa, m_particles, m_soa_back, substep > 0);
+                });
+        }
+        std::swap(m_soa, m_soa_back);
+        m_num_soa_particles = m_num_particles;
+        m_aos_exposed = false;
+
+        if (m_nlist.valid && !same_layout) {
+            mpProfileScope prof(m_profiler, mpProfilePhase::NeighborList);
+            remapNeighborList(srcs);
+        }
+
+        // AoS view past survivors still holds records of particles that died. they must be seen as dead
+        // when exposed again, e.g. by forceSetNumParticles().
+        if (m_num_particles < num_particles) {
+            ist::parallel_for(m_num_particles, num_particles, g_particles_par_task,
+                [&](int i) {
+                    m_particles[i].lifetime = 0.0f;
+                });
+        }
     }
+    else {
+        // same as what mpSoAGather() does to accelerations
+        mpProfileScope prof(m_profiler, mpProfilePhase::Gather);
+        const mpCell *ce = m_cells.data();
+        mpParallelFor(m_profiler, mpProfilePhase::Gather, 0, m_num_cells, g_cells_par_task,
+            [&](int i) {
+                i32 si = ce[i].soai * SOA_BOCK_SIZE;
+                i32 n = ce[i].end - ce[i].begin;
+                std::fill_n(&m_soa.acl_x[si], n, 0.0f);
+                std::fill_n(&m_soa.acl_y[si], n, 0.0f);
+                std::fill_n(&m_soa.acl_z[si], n, 0.0f);
+            });
+    }
+    const int num_cells = m_num_cells;
+    mpCell *ce = m_cells.data();
 
     mpKernelContext kcontext = {
-        &kp, ce,
+        &kp, ce, m_cell_neighbor_begin.data(), m_cell_neighbors.data(),
         m_soa.pos_x.data(), m_soa.pos_y.data(), m_soa.pos_z.data(),
         m_soa.vel_x.data(), m_soa.vel_y.data(), m_soa.vel_z.data(),
         m_soa.acl_x.data(), m_soa.acl_y.data(), m_soa.acl_z.data(),
         m_soa.speed.data(), m_soa.density.data(), m_soa.affection.data(), m_soa.hit.data(),
         planes, spheres, capsules, boxes, forces,
-        (int)m_plane_colliders.size(), (int)m_sphere_colliders.size(), (int)m_capsule_colliders.size(), (int)m_box_colliders.size(), (int)m_forces.size()
+        (int)m_plane_colliders.size(), (int)m_sphere_colliders.size(), (int)m_capsule_colliders.size(), (int)m_box_colliders.size(), (int)m_forces.size(),
+        nullptr, nullptr, nullptr,
+        m_broadphase.begin.data(), m_broadphase.indices.data(),
+        (ispc::vec3i&)m_broadphase.shift, (ispc::vec3i&)m_broadphase.div,
+        m_sdf_colliders.data(), (int)m_sdf_colliders.size(),
+        (ispc::vec3f*)m_spline_points.data(),
     };
 
-    // clear grid
-    ist::parallel_for(0, cell_num, g_cells_par_task,
-        [&](int i) {
-            ce[i].begin = ce[i].end = 0;
-        });
-
-    // gen hash
-    ist::parallel_for(0, m_num_particles, g_particles_par_task,
-        [&](int i) {
-            vec3 rel = glm::abs((vec3&)m_particles[i].position - (vec3&)kp.active_region_center);
-            if (rel.x > kp.active_region_extent.x ||
-                rel.y > kp.active_region_extent.y ||
-                rel.z > kp.active_region_extent.z)
-            {
-                m_particles[i].lifetime = 0.0f;
-            }
-            m_particles[i].lifetime = std::max<f32>(m_particles[i].lifetime - dt, 0.0f);
-            m_particles[i].hash = mpGenHash(*this, m_particles[i]);
-        });
+    const mpProfilePhase interaction = mpProfilePhase::Interaction;
+    const mpProfilePhase integrate = mpProfilePhase::Integrate;
+    mpSolverType solver_type = (mpSolverType)m_kparams.solver_type;
 
-    // sort by hash
-    ist::parallel_sort(m_particles.data(), m_particles.data() + m_num_particles,
-        [&](const mpParticle &a, const mpParticle &b) { return a.hash < b.hash; });
+    // half stencil takes precedence over neighbor list on impulse solver.
+    const bool use_half = solver_type == mpSolverType::Impulse && kp.half_stencil && kp.enable_interaction;
 
-    // count num particles
-    ist::parallel_for(0, m_num_particles, g_particles_par_task,
-        [&](int i) {
-            const u32 G_ID = i;
-            u32 G_ID_PREV = G_ID - 1;
-            u32 G_ID_NEXT = G_ID + 1;
-
-            u32 cell = m_particles[G_ID].hash;
-            u32 cell_prev = (G_ID_PREV == -1) ? -1 : m_particles[G_ID_PREV].hash;
-            u32 cell_next = (G_ID_NEXT == kp.max_particles) ? -2 : m_particles[G_ID_NEXT].hash;
-            if ((cell & 0x80000000) != 0) { // highest bit is live flag
-                if ((cell_prev & 0x80000000) == 0) { // 
-                    m_num_particles = G_ID;
-                }
-            }
-            else {
-                if (cell != cell_prev) {
-                    ce[cell].begin = G_ID;
-                }
-                if (cell != cell_next) {
-                    ce[cell].end = G_ID + 1;
-                }
-            }
-        });
-    if ((m_particles[0].hash & 0x80000000) != 0) {
-        m_num_particles = 0;
+    // neighbor list is shared by density & force passes, and kept across updates while valid.
+    // impulse solver interacts within particle_size*2, SPH within particle_size.
+    const bool use_nlist = kp.neighbor_list && kp.enable_interaction && !use_half;
+    if (use_nlist) {
+        mpProfileScope prof(m_profiler, mpProfilePhase::NeighborList);
+        float radius = solver_type == mpSolverType::Impulse ? kp.particle_size * 2.0f : kp.particle_size;
+        updateNeighborList(kcontext, radius);
     }
-
-    {
-        i32 soai = 0;
-        for (int i = 0; i < cell_num; ++i) {
-            ce[i].soai = soai;
-            soai += soa_blocks(ce[i].end - ce[i].begin);
-        }
+    else {
+        // not to be remapped while unused
+        m_nlist.valid = false;
     }
 
-    // AoS -> SoA
-    ist::parallel_for(0, cell_num, g_cells_par_task,
-        [&](int i) {
-            i32 n = ce[i].end - ce[i].begin;
-            if (n == 0) { return; }
-            mpSoAnize(ce[i], m_particles, m_soa);
-        });
-
-
-    mpSolverType solver_type = (mpSolverType)m_kparams.solver_type;
     if (solver_type == mpSolverType::Impulse) {
         // impulse
-        ist::parallel_for(0, cell_num, g_cells_par_task,
-            [&](int i) {
-                i32 n = ce[i].end - ce[i].begin;
-                if (n == 0) { return; }
-                ispc::vec3i idx;
-                mpGenIndex(*this, i, idx);
-                if (kp.enable_interaction) {
-                    ispc::impUpdatePressure(kcontext, idx);
-                }
-                if (kp.enable_forces) {
-                    ispc::ProcessExternalForce(kcontext, idx);
-                }
-                if (kp.enable_colliders) {
-                    ispc::ProcessColliders(kcontext, idx);
+        {
+            mpProfileScope prof(m_profiler, interaction);
+            if (use_half) {
+                // each pair is evaluated once and writes to both sides. cells of one color are processed at a time,
+                // so no particle is written concurrently and the result doesn't depend on scheduling.
+                if (!keep_cells) { buildCellColors(); }
+                mpParallelFor(m_profiler, interaction, 0, num_cells, g_cells_par_task,
+                    [&](int i) {
+                        const mpCell &cell = ce[i];
+                        i32 si = cell.soai * SOA_BOCK_SIZE;
+                        i32 n = cell.end - cell.begin;
+                        std::fill_n(&m_soa.acl_x[si], n, 0.0f);
+                        std::fill_n(&m_soa.acl_y[si], n, 0.0f);
+                        std::fill_n(&m_soa.acl_z[si], n, 0.0f);
+                    });
+                const int *colors = m_cell_colors.data();
+                for (int c = 0; c < mpNumCellColors; ++c) {
+                    mpParallelFor(m_profiler, interaction, m_color_begin[c], m_color_begin[c + 1], g_cells_par_task,
+                        [&](int i) {
+                            ispc::impUpdatePressureHalf(kcontext, colors[i]);
+                        });
                 }
-            });
-        ist::parallel_for(0, cell_num, g_cells_par_task,
-            [&](int i) {
-                i32 n = ce[i].end - ce[i].begin;
-                if (n == 0) { return; }
-                ispc::vec3i idx;
-                mpGenIndex(*this, i, idx);
-                ispc::Integrate(kcontext, idx);
-            });
+            }
+            mpParallelFor(m_profiler, interaction, 0, num_cells, g_cells_par_task,
+                [&](int i) {
+                    if (use_half) {
+                        // pressure has been done above
+                    }
+                    else if (use_nlist) {
+                        ispc::impUpdatePressureNL(kcontext, i);
+                    }
+                    else if (kp.enable_interaction) {
+                        ispc::impUpdatePressure(kcontext, i);
+                    }
+                    if (kp.enable_forces) {
+                        ispc::ProcessExternalForce(kcontext, i);
+                    }
+                    if (kp.enable_colliders) {
+                        ispc::ProcessColliders(kcontext, i);
+                    }
+                });
+        }
+        {
+            mpProfileScope prof(m_profiler, integrate);
+            mpParallelFor(m_profiler, integrate, 0, num_cells, g_cells_par_task,
+                [&](int i) {
+                    ispc::Integrate(kcontext, i);
+                });
+        }
     }
     else if (solver_type == mpSolverType::SPH || solver_type == mpSolverType::SPHEst) {
         if (kp.enable_interaction && solver_type == mpSolverType::SPH) {
-            ist::parallel_for(0, cell_num, g_cells_par_task,
+            mpProfileScope prof(m_profiler, interaction);
+            mpParallelFor(m_profiler, interaction, 0, num_cells, g_cells_par_task,
                 [&](int i) {
-                    i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
-                    ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
-                    ispc::sphUpdateDensity(kcontext, idx);
+                    if (use_nlist) { ispc::sphUpdateDensityNL(kcontext, i); }
+                    else { ispc::sphUpdateDensity(kcontext, i); }
                 });
-            ist::parallel_for(0, cell_num, g_cells_par_task,
+            mpParallelFor(m_profiler, interaction, 0, num_cells, g_cells_par_task,
                 [&](int i) {
-                    i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
-                    ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
-                    ispc::sphUpdateForce(kcontext, idx);
+                    if (use_nlist) { ispc::sphUpdateForceNL(kcontext, i); }
+                    else { ispc::sphUpdateForce(kcontext, i); }
                 });
         }
         else if (kp.enable_interaction && solver_type == mpSolverType::SPHEst) {
-            ist::parallel_for(0, cell_num, g_cells_par_task,
+            mpProfileScope prof(m_profiler, interaction);
+            mpParallelFor(m_profiler, interaction, 0, num_cells, g_cells_par_task,
                 [&](int i) {
-                i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
-                    ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
-                    ispc::sphUpdateDensityEst1(kcontext, idx);
+                    ispc::sphUpdateDensityEst1(kcontext, i);
+                });
+            mpParallelFor(m_profiler, interaction, 0, num_cells, g_cells_par_task,
+                [&](int i) {
+                    ispc::sphUpdateDensityEst2(kcontext, i);
                 });
-            ist::parallel_for(0, cell_num, g_cells_par_task,
+            mpParallelFor(m_profiler, interaction, 0, num_cells, g_cells_par_task,
                 [&](int i) {
-                    i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
-                    ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
-                    ispc::sphUpdateDensityEst2(kcontext, idx);
+                    if (use_nlist) { ispc::sphUpdateForceNL(kcontext, i); }
+                    else { ispc::sphUpdateForce(kcontext, i); }
                 });
-            ist::parallel_for(0, cell_num, g_cells_par_task,
+        }
+
+        {
+            mpProfileScope prof(m_profiler, integrate);
+            mpParallelFor(m_profiler, integrate, 0, num_cells, g_cells_par_task,
                 [&](int i) {
-                    i32 n = ce[i].end - ce[i].begin;
-                    if (n == 0) { return; }
-                    ispc::vec3i idx;
-                    mpGenIndex(*this, i, idx);
-                    ispc::sphUpdateForce(kcontext, idx);
+                    if (kp.enable_forces) {
+                        ispc::ProcessExternalForce(kcontext, i);
+                    }
+                    if (kp.enable_colliders) {
+                        ispc::ProcessColliders(kcontext, i);
+                    }
+                    ispc::Integrate(kcontext, i);
                 });
         }
+    }
+
+}
+
+// max speed of particles, from SoA and particles added or exposed through AoS view. used to choose number of substeps.
+float mpWorld::getMaxSpeed()
+{
+    const int num_particles = m_num_particles;
+    const int num_soa = m_aos_exposed ? 0 : m_num_soa_particles;
+    const mpCell *ce = m_cells.data();
+
+    // slots are reused across calls. bodies below reset each slot they use.
+    float max_speed_sq = 0.0f;
+    mpSpeedAccumulator &acc = m_speed_slots;
+    if (num_soa > 0) {
+        ist::parallel_accumulate(acc, 0, m_num_cells, g_cells_par_task,
+            [&](float &r, int begin, int end) {
+                r = 0.0f;
+                for (int ci = begin; ci < end; ++ci) {
+                    const mpCell &cell = ce[ci];
+                    i32 si = cell.soai * SOA_BOCK_SIZE;
+                    i32 n = std::min<i32>(cell.end, num_soa) - cell.begin;
+                    for (i32 s = si; s < si + n; ++s) {
+                        vec3 vel(m_soa.vel_x[s], m_soa.vel_y[s], m_soa.vel_z[s]);
+                        r = std::max<float>(r, glm::dot(vel, vel));
+                    }
+                }
+            });
+        acc.combine_each([&](float v) { max_speed_sq = std::max<float>(max_speed_sq, v); });
+    }
+    if (num_particles > num_soa) {
+        ist::parallel_accumulate(acc, num_soa, num_particles, g_particles_par_task,
+            [&](float &r, int begin, int end) {
+                r = 0.0f;
+                for (int i = begin; i < end; ++i) {
+                    const vec3 &vel = (const vec3&)m_particles[i].velocity;
+                    r = std::max<float>(r, glm::dot(vel, vel));
+                }
+            });
+        acc.combine_each([&](float v) { max_speed_sq = std::max<float>(max_speed_sq, v); });
+    }
+    return std::sqrt(max_speed_sq);
+}
+
+// removes dead particles from (key, source) pairs made by update(), keeping order of the rest.
+// m_num_particles becomes number of survivors.
+void mpWorld::compactParticles()
+{
+    const ivec3 &bits = m_tparams.world_div_bits;
+    const u64 dead_key = u64(1) << (bits.x + bits.y + bits.z);
+    const u64 *keys = m_sort_keys.data();
+    const int *srcs = m_sort_indices.data();
+    u64 *dst_keys = m_sort_keys_tmp.data();
+    int *dst_srcs = m_sort_indices_tmp.data();
+
+    m_num_particles = ist::parallel_compact(m_num_particles,
+        [&](int i) { return keys[i] != dead_key; },
+        [&](int i, int pos) {
+            dst_keys[pos] = keys[i];
+            dst_srcs[pos] = srcs[i];
+        });
+    m_sort_keys.swap(m_sort_keys_tmp);
+    m_sort_indices.swap(m_sort_indices_tmp);
+}
 
-        ist::parallel_for(0, cell_num, g_cells_par_task,
+// sort (key, source) pairs made by update(). particle data itself is moved once by mpSoAGather().
+// particles usually stay in same cell across frames. keys of ones that left their cell or came from AoS view
+// are marked by g_moved_key_bit, and the rest are in order of previous sort. so if keys are already ordered,
+// nothing is sorted, and if few are marked, only those are sorted and merged in. marks are cleared.
+void mpWorld::sortParticles()
+{
+    const int num = m_num_particles;
+    const ivec3 &bits = m_tparams.world_div_bits;
+    const int cell_bits = bits.x + bits.y + bits.z;
+    u64 *keys = m_sort_keys.data();
+    int *srcs = m_sort_indices.data();
+
+    std::atomic<int> num_unordered(0);
+    std::atomic<int> num_marked(0);
+    ist::parallel_for_blocked(0, num, g_particles_par_task,
+        [&](int begin, int end) {
+            int unordered = 0, marked = 0;
+            for (int i = begin; i < end; ++i) {
+                if (keys[i] & g_moved_key_bit) { ++marked; }
+                if (i > 0 && (keys[i - 1] & ~g_moved_key_bit) > (keys[i] & ~g_moved_key_bit)) { ++unordered; }
+            }
+            if (unordered) { num_unordered += unordered; }
+            if (marked) { num_marked += marked; }
+        });
+
+    if (num_unordered > 0 && num_marked <= num / g_merge_sort_divisor) {
+        ist::parallel_merge_marked(keys, srcs, m_sort_keys_tmp.data(), m_sort_indices_tmp.data(), num, (int)num_marked, g_moved_key_bit, cell_bits + 1);
+        return;
+    }
+    if (num_marked > 0) {
+        ist::parallel_for(0, num, g_particles_par_task,
             [&](int i) {
-                i32 n = ce[i].end - ce[i].begin;
-                if (n == 0) { return; }
-                ispc::vec3i idx;
-                mpGenIndex(*this, i, idx);
-                if (kp.enable_forces) {
-                    ispc::ProcessExternalForce(kcontext, idx);
+                keys[i] &= ~g_moved_key_bit;
+            });
+    }
+    if (num_unordered > 0) {
+        ist::parallel_radix_sort(keys, srcs, m_sort_keys_tmp.data(), m_sort_indices_tmp.data(), num, cell_bits + 1);
+    }
+}
+
+// concatenates neighbor lists made per block of g_cells_par_task cells into nl.indices in cell order.
+// block_sizes are numbers of entries of each block, and begin of each particle is offset by start of its block.
+static void mpConcatenateNeighborBlocks(mpNeighborList &nl, int *begin, const mpCell *ce, int num_cells, std::vector<int> &block_sizes)
+{
+    const int num_blocks = (int)block_sizes.size();
+    int total = ist::parallel_exclusive_scan(block_sizes.data(), block_sizes.data(), num_blocks);
+    if ((int)nl.indices.size() < total) { nl.indices.resize(total); }
+    ist::parallel_for(0, num_blocks,
+        [&](int bi) {
+            const int base = block_sizes[bi];
+            const int size = (bi + 1 < num_blocks ? block_sizes[bi + 1] : total) - base;
+            std::copy(nl.blocks[bi].begin(), nl.blocks[bi].begin() + size, nl.indices.begin() + base);
+            int end = std::min<int>(num_cells, (bi + 1) * g_cells_par_task);
+            for (int ci = bi * g_cells_par_task; ci < end; ++ci) {
+                i32 si = ce[ci].soai * SOA_BOCK_SIZE;
+                for (i32 s = si; s < si + (ce[ci].end - ce[ci].begin); ++s) {
+                    begin[s] += base;
+                }
+            }
+        });
+}
+
+// occupied cells within reach cells of cell on each axis (including itself).
+// same order as scanning cells in y, z, x. reach 1 gives 3x3x3 cells around.
+template<class Body>
+static inline void mpEachNeighborCell(const mpWorld &w, const mpCell &cell, const ivec3 &reach, const Body &body)
+{
+    const ivec3 &idx = (ivec3&)cell.index;
+    const ivec3 &div = (ivec3&)w.getKernelParams().world_div;
+    ivec3 nbeg = glm::max(idx - reach, ivec3(0));
+    ivec3 nend = glm::min(idx + reach, div - 1);
+    for (int nyi = nbeg.y; nyi <= nend.y; ++nyi) {
+        for (int nzi = nbeg.z; nzi <= nend.z; ++nzi) {
+            for (int nxi = nbeg.x; nxi <= nend.x; ++nxi) {
+                int ni = w.findCell(ivec3(nxi, nyi, nzi));
+                if (ni >= 0) { body(ni); }
+            }
+        }
+    }
+}
+
+// (re)builds verlet neighbor list if needed and sets it to kcontext.
+// list radius is interaction radius + skin. candidates are taken from cells within list radius on each axis,
+// which are more than cells around if the radius exceeds a cell, so skin isn't limited by cell size.
+// list is kept until some particle moves more than half of skin since it was built. sorting particles
+// doesn't break it, as remapNeighborList() moves it to new slots.
+void mpWorld::updateNeighborList(mpKernelContext &kcontext, float interaction_radius)
+{
+    mpNeighborList &nl = m_nlist;
+    const mpTempParams &tp = m_tparams;
+    const int num_cells = m_num_cells;
+    const mpCell *ce = m_cells.data();
+
+    float skin = std::max<float>(m_kparams.neighbor_list_skin, 0.0f);
+    float radius = interaction_radius + skin;
+    ivec3 reach = glm::max(ivec3(glm::ceil(radius * (const vec3&)tp.rcp_cell_size)), ivec3(1));
+
+    bool rebuild = !nl.valid || nl.radius != radius || nl.pos_x.size() != m_soa.pos_x.size();
+    if (!rebuild) {
+        const float limit_sq = (skin * 0.5f) * (skin * 0.5f);
+        std::atomic<bool> exceeded(false);
+        ist::parallel_for(0, num_cells, g_cells_par_task,
+            [&](int ci) {
+                if (exceeded) { return; }
+                const mpCell &cell = ce[ci];
+                i32 si = cell.soai * SOA_BOCK_SIZE;
+                for (i32 s = si; s < si + (cell.end - cell.begin); ++s) {
+                    vec3 d(m_soa.pos_x[s] - nl.pos_x[s], m_soa.pos_y[s] - nl.pos_y[s], m_soa.pos_z[s] - nl.pos_z[s]);
+                    if (glm::dot(d, d) > limit_sq) {
+                        exceeded = true;
+                        break;
+                    }
                 }
-                if (kp.enable_colliders) {
-                    ispc::ProcessColliders(kcontext, idx);
+            });
+        rebuild = exceeded;
+    }
+
+    kcontext.nl_begin = nl.begin.data();
+    kcontext.nl_count = nl.count.data();
+    if (rebuild) {
+        nl.resize(m_soa.pos_x.size());
+        kcontext.nl_begin = nl.begin.data();
+        kcontext.nl_count = nl.count.data();
+
+        // build per block of cells, then concatenate in cell order
+        const int num_blocks = ceildiv(num_cells, g_cells_par_task);
+        if ((int)nl.blocks.size() < num_blocks) { nl.blocks.resize(num_blocks); }
+        std::vector<int> block_sizes(num_blocks);
+        ist::parallel_for(0, num_blocks,
+            [&](int bi) {
+                mpProfileTask task(m_profiler, mpProfilePhase::NeighborList);
+                mpIntArray &dst = nl.blocks[bi];
+                std::vector<int> wide_cells;
+                int n = 0;
+                int end = std::min<int>(num_cells, (bi + 1) * g_cells_par_task);
+                for (int ci = bi * g_cells_par_task; ci < end; ++ci) {
+                    const mpCell &cell = ce[ci];
+                    const int *cand = &m_cell_neighbors[m_cell_neighbor_begin[ci]];
+                    int num_cand = m_cell_neighbor_begin[ci + 1] - m_cell_neighbor_begin[ci];
+                    if (reach != ivec3(1)) {
+                        wide_cells.clear();
+                        mpEachNeighborCell(*this, cell, reach, [&](int ni) { wide_cells.push_back(ni); });
+                        cand = wide_cells.data();
+                        num_cand = (int)wide_cells.size();
+                    }
+                    int num_candidates = 0;
+                    for (int ni = 0; ni < num_cand; ++ni) {
+                        num_candidates += ce[cand[ni]].end - ce[cand[ni]].begin;
+                    }
+                    size_t required = size_t(n) + size_t(cell.end - cell.begin) * num_candidates;
+                    if (dst.size() < required) { dst.resize(required); }
+                    n = ispc::BuildNeighborList(kcontext, ci, radius, cand, num_cand, dst.data(), n);
+
+                    i32 si = cell.soai * SOA_BOCK_SIZE;
+                    for (i32 s = si; s < si + (cell.end - cell.begin); ++s) {
+                        nl.pos_x[s] = m_soa.pos_x[s];
+                        nl.pos_y[s] = m_soa.pos_y[s];
+                        nl.pos_z[s] = m_soa.pos_z[s];
+                    }
                 }
-                ispc::Integrate(kcontext, idx);
+                block_sizes[bi] = n;
             });
+        mpConcatenateNeighborBlocks(nl, nl.begin.data(), ce, num_cells, block_sizes);
+        nl.radius = radius;
+        nl.valid = true;
     }
+    kcontext.nl_indices = nl.indices.data();
+}
 
-    // SoA -> AoS
-    ist::parallel_for(0, cell_num, g_cells_par_task,
-        [&](int i) {
-            i32 n = ce[i].end - ce[i].begin;
-            if (n == 0) { return; }
-            mpAoSnize(ce[i], m_soa, m_particles, m_imd);
+// moves neighbor list to new SoA slots after step() sorted particles. srcs[i] is previous slot of i-th particle.
+// list of each particle keeps same particles except ones that died, and positions it was built at go along.
+// so the list needs to be rebuilt only when half skin test of updateNeighborList() fails.
+void mpWorld::remapNeighborList(const int *srcs)
+{
+    mpNeighborList &nl = m_nlist;
+    const int num_cells = m_num_cells;
+    const mpCell *ce = m_cells.data();
+
+    // previous SoA is m_soa_back now. list must have been made for it.
+    if (nl.begin.size() != m_soa_back.pos_x.size()) {
+        nl.valid = false;
+        return;
+    }
+    nl.remap.assign(nl.begin.size(), -1);
+    int *remap = nl.remap.data();
+    ist::parallel_for(0, num_cells, g_cells_par_task,
+        [&](int ci) {
+            i32 si = ce[ci].soai * SOA_BOCK_SIZE;
+            for (int i = ce[ci].begin; i < ce[ci].end; ++i) {
+                remap[srcs[i]] = si + (i - ce[ci].begin);
+            }
+        });
+
+    nl.resizeBack(m_soa.pos_x.size());
+    const int num_blocks = ceildiv(num_cells, g_cells_par_task);
+    if ((int)nl.blocks.size() < num_blocks) { nl.blocks.resize(num_blocks); }
+    std::vector<int> block_sizes(num_blocks);
+    ist::parallel_for(0, num_blocks,
+        [&](int bi) {
+            mpProfileTask task(m_profiler, mpProfilePhase::NeighborList);
+            mpIntArray &dst = nl.blocks[bi];
+            int n = 0;
+            int end = std::min<int>(num_cells, (bi + 1) * g_cells_par_task);
+            for (int ci = bi * g_cells_par_task; ci < end; ++ci) {
+                i32 si = ce[ci].soai * SOA_BOCK_SIZE;
+                for (int i = ce[ci].begin; i < ce[ci].end; ++i) {
+                    i32 s = si + (i - ce[ci].begin);
+                    i32 prev = srcs[i];
+                    const int *entries = nl.indices.data() + nl.begin[prev];
+                    const int num_entries = nl.count[prev];
+                    if ((int)dst.size() < n + num_entries) { dst.resize(std::max<size_t>(dst.size() * 2, n + num_entries)); }
+                    nl.begin_back[s] = n;
+                    for (int k = 0; k < num_entries; ++k) {
+                        int j = remap[entries[k]];
+                        if (j >= 0) { dst[n++] = j; }
+                    }
+                    nl.count_back[s] = n - nl.begin_back[s];
+                    nl.pos_x_back[s] = nl.pos_x[prev];
+                    nl.pos_y_back[s] = nl.pos_y[prev];
+                    nl.pos_z_back[s] = nl.pos_z[prev];
+                }
+            }
+            block_sizes[bi] = n;
+        });
+    mpConcatenateNeighborBlocks(nl, nl.begin_back.data(), ce, num_cells, block_sizes);
+    nl.swapBack();
+}
+
+// groups occupied cells by color (index % 3 on each axis) into m_cell_colors. cells of color c are
+// m_cell_colors[m_color_begin[c] ... m_color_begin[c+1]), in ascending order.
+// half stencil of a cell touches cells within +-1 on each axis, so cells of same color never write to same cell.
+void mpWorld::buildCellColors()
+{
+    const int num_cells = m_num_cells;
+    const mpCell *ce = m_cells.data();
+    const int num_blocks = ceildiv(num_cells, g_cells_par_task);
+    auto color_of = [](const mpCell &cell) {
+        return cell.index.x % 3 + (cell.index.y % 3) * 3 + (cell.index.z % 3) * 9;
+    };
+
+    // counts are laid out color-major, so scanning them gives offset of each (color, block)
+    std::vector<int> offsets(mpNumCellColors * num_blocks);
+    ist::parallel_for(0, num_blocks,
+        [&](int bi) {
+            int counts[mpNumCellColors] = {};
+            int end = std::min<int>(num_cells, (bi + 1) * g_cells_par_task);
+            for (int ci = bi * g_cells_par_task; ci < end; ++ci) {
+                ++counts[color_of(ce[ci])];
+            }
+            for (int c = 0; c < mpNumCellColors; ++c) {
+                offsets[c * num_blocks + bi] = counts[c];
+            }
+        });
+    ist::parallel_exclusive_scan(offsets.data(), offsets.data(), (int)offsets.size());
+    for (int c = 0; c < mpNumCellColors; ++c) {
+        m_color_begin[c] = num_blocks > 0 ? offsets[c * num_blocks] : 0;
+    }
+    m_color_begin[mpNumCellColors] = num_cells;
+
+    if ((int)m_cell_colors.size() < num_cells) { m_cell_colors.resize(num_cells); }
+    ist::parallel_for(0, num_blocks,
+        [&](int bi) {
+            int pos[mpNumCellColors];
+            for (int c = 0; c < mpNumCellColors; ++c) {
+                pos[c] = offsets[c * num_blocks + bi];
+            }
+            int end = std::min<int>(num_cells, (bi + 1) * g_cells_par_task);
+            for (int ci = bi * g_cells_par_task; ci < end; ++ci) {
+                m_cell_colors[pos[color_of(ce[ci])]++] = ci;
+            }
         });
+}
+
+template<class Body>
+static inline void mpEachBroadphaseSlot(const mpBroadphase &bp, const ivec3 &lo, const ivec3 &hi, int kind, const Body &body)
+{
+    for (int y = lo.y; y <= hi.y; ++y) {
+        for (int z = lo.z; z <= hi.z; ++z) {
+            int slot = ((y * bp.div.z + z) * bp.div.x + lo.x) * mpBP_NumKinds + kind;
+            for (int x = lo.x; x <= hi.x; ++x, slot += mpBP_NumKinds) {
+                body(slot);
+            }
+        }
+    }
+}
 
-    // make clone data for GPU
+// bins colliders & forces into tiles of m_broadphase by their bounds, so that ProcessColliders() and
+// ProcessExternalForce() test only ones near the cell. bounds are expanded by a cell on each side, so the tile of
+// every cell IsGridOverrapedAABB() accepts has the collider. AffectAll forces are binned to every tile.
+void mpWorld::buildBroadphase()
+{
+    const mpKernelParams &kp = m_kparams;
+    const mpTempParams &tp = m_tparams;
+    mpBroadphase &bp = m_broadphase;
+    for (int a = 0; a < 3; ++a) {
+        bp.shift[a] = std::max<int>(tp.world_div_bits[a] - g_broadphase_div_bits, 0);
+        bp.div[a] = (&kp.world_div.x)[a] >> bp.shift[a];
+    }
+
+    struct Item
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        int num_particles_needs_copy = std::max<int>(m_num_particles, m_num_particles_gpu);
-        m_num_particles_gpu = m_num_particles;
-        if (num_particles_needs_copy > 0) {
-            memcpy(m_particles_gpu.data(), m_particles.data(), sizeof(mpParticle)*num_particles_needs_copy);
+        int kind, index;
+        ivec3 lo, hi; // tile range
+    };
+    std::vector<Item> items;
+    auto add = [&](int kind, int index, const ispc::BoundingBox &bb) {
+        const vec3 &world_bl = (const vec3&)tp.world_bounds_bl;
+        const vec3 &rcp_cell = (const vec3&)tp.rcp_cell_size;
+        vec3 bl = ((const vec3&)bb.bl - world_bl) * rcp_cell - 1.0f;
+        vec3 ur = ((const vec3&)bb.ur - world_bl) * rcp_cell + 1.0f;
+        Item item = { kind, index };
+        for (int a = 0; a < 3; ++a) {
+            float last = float((&kp.world_div.x)[a] - 1);
+            if (ur[a] < 0.0f || bl[a] > last) { return; }
+            item.lo[a] = int(clamp<float>(bl[a], 0.0f, last)) >> bp.shift[a];
+            item.hi[a] = int(clamp<float>(ur[a], 0.0f, last)) >> bp.shift[a];
         }
+        items.push_back(item);
+    };
+    for (size_t i = 0; i < m_plane_colliders.size(); ++i) { add(mpBP_Plane, (int)i, m_plane_colliders[i].bounds); }
+    for (size_t i = 0; i < m_sphere_colliders.size(); ++i) { add(mpBP_Sphere, (int)i, m_sphere_colliders[i].bounds); }
+    for (size_t i = 0; i < m_capsule_colliders.size(); ++i) { add(mpBP_Capsule, (int)i, m_capsule_colliders[i].bounds); }
+    for (size_t i = 0; i < m_box_colliders.size(); ++i) { add(mpBP_Box, (int)i, m_box_colliders[i].bounds); }
+    for (size_t i = 0; i < m_sdf_colliders.size(); ++i) { add(mpBP_SDF, (int)i, m_sdf_colliders[i].bounds); }
+    for (size_t i = 0; i < m_forces.size(); ++i) {
+        const mpForce &force = m_forces[i];
+        if ((mpForceShape)force.props.shape_type == mpForceShape::AffectAll) {
+            Item item = { mpBP_Force, (int)i, ivec3(0), bp.div - 1 };
+            items.push_back(item);
+        }
+        else {
+            add(mpBP_Force, (int)i, force.bounds);
+        }
+    }
+
+    // counting sort by (tile, kind). items are in order of kind & index, so each slot is in order of colliders.
+    const int num_slots = bp.div.x * bp.div.y * bp.div.z * mpBP_NumKinds;
+    bp.begin.assign(num_slots + 1, 0);
+    int *begin = bp.begin.data();
+    for (const Item &item : items) {
+        mpEachBroadphaseSlot(bp, item.lo, item.hi, item.kind, [&](int slot) { ++begin[slot]; });
+    }
+    int total = 0;
+    for (int i = 0; i <= num_slots; ++i) {
+        int n = begin[i];
+        begin[i] = total;
+        total += n;
+    }
+
+    bp.indices.resize(std::max<int>(total, 1));
+    int *indices = bp.indices.data();
+    std::vector<int> pos(bp.begin.begin(), bp.begin.end() - 1);
+    for (const Item &item : items) {
+        mpEachBroadphaseSlot(bp, item.lo, item.hi, item.kind, [&](int slot) { indices[pos[slot]++] = item.index; });
+    }
+}
+
+// make list of occupied cells from sorted keys. dead particles have been dropped by compactParticles().
+// cells and their neighbor lists are sized by number of occupied cells, not by number of particles.
+void mpWorld::buildCells(i64 cell_num)
+{
+    const int num_particles = m_num_particles;
+    const u64 *keys = m_sort_keys.data();
+    const bool sparse = m_kparams.sparse_grid != 0;
+
+    // reset lookup entries of previous update
+    if (sparse) {
+        m_cell_table.clear();
+    }
+    else if ((i64)m_cell_table.size() != cell_num) {
+        m_cell_table.assign((size_t)cell_num, -1);
+    }
+    else {
+        mpParallelFor(m_profiler, mpProfilePhase::BuildCells, 0, m_num_cells, g_cells_par_task,
+            [&](int i) {
+                m_cell_table[m_cell_keys[i]] = -1;
+            });
+    }
+
+    std::atomic<int> num_occupied(0);
+    ist::parallel_for_blocked(0, num_particles, g_particles_par_task,
+        [&](int begin, int end) {
+            int n = 0;
+            for (int i = begin; i < end; ++i) {
+                if (i == 0 || keys[i] != keys[i - 1]) { ++n; }
+            }
+            if (n) { num_occupied += n; }
+        });
+    if ((int)m_cells.size() < num_occupied) {
+        m_cells.resize(num_occupied);
+        m_cell_keys.resize(num_occupied);
+    }
+
+    // compact first particle of each cell into cell list, then assign SoA offsets
+    mpCell *ce = m_cells.data();
+    const int num_cells = ist::parallel_exclusive_scan<int>(num_particles,
+        [&](int i) { return i == 0 || keys[i] != keys[i - 1] ? 1 : 0; },
+        [&](int i, int ci) {
+            if (i == 0 || keys[i] != keys[i - 1]) {
+                ce[ci].begin = i;
+                m_cell_keys[ci] = keys[i];
+            }
+        });
+    mpParallelFor(m_profiler, mpProfilePhase::BuildCells, 0, num_cells, g_cells_par_task,
+        [&](int ci) {
+            mpCell &cell = ce[ci];
+            cell.end = ci + 1 < num_cells ? ce[ci + 1].begin : num_particles;
+            cell.density = 0.0f;
+            mpGenIndex(*this, m_cell_keys[ci], cell.index);
+        });
+    ist::parallel_exclusive_scan<int>(num_cells,
+        [&](int ci) { return soa_blocks(ce[ci].end - ce[ci].begin); },
+        [&](int ci, int soai) { ce[ci].soai = soai; });
+    m_num_cells = num_cells;
+
+    if (sparse) {
+        m_cell_hash.reset(num_cells);
+        mpParallelFor(m_profiler, mpProfilePhase::BuildCells, 0, num_cells, g_cells_par_task,
+            [&](int i) {
+                m_cell_hash.insert(m_cell_keys[i], i);
+            });
+    }
+    else {
+        mpParallelFor(m_profiler, mpProfilePhase::BuildCells, 0, num_cells, g_cells_par_task,
+            [&](int i) {
+                m_cell_table[m_cell_keys[i]] = i;
+            });
+    }
+
+    // neighbors. counted first, then written to their place, so only occupied neighbors take memory.
+    m_cell_neighbor_begin.resize(num_cells + 1);
+    int *nb_begin = m_cell_neighbor_begin.data();
+    mpParallelFor(m_profiler, mpProfilePhase::BuildCells, 0, num_cells, g_cells_par_task,
+        [&](int i) {
+            int n = 0;
+            mpEachNeighborCell(*this, ce[i], ivec3(1), [&](int) { ++n; });
+            nb_begin[i] = n;
+        });
+    nb_begin[num_cells] = 0;
+    const int num_neighbors = ist::parallel_exclusive_scan(nb_begin, nb_begin, num_cells + 1);
+    if ((int)m_cell_neighbors.size() < num_neighbors) {
+        m_cell_neighbors.resize(num_neighbors);
+    }
+    int *nb = m_cell_neighbors.data();
+    mpParallelFor(m_profiler, mpProfilePhase::BuildCells, 0, num_cells, g_cells_par_task,
+        [&](int i) {
+            int n = nb_begin[i];
+            mpEachNeighborCell(*this, ce[i], ivec3(1), [&](int ni) { nb[n++] = ni; });
+        });
+}
+
+int mpWorld::findCell(const ivec3 &idx) const
+{
+    const ivec3 &bits = m_tparams.world_div_bits;
+    u64 key = u64(idx.x) | (u64(idx.z) << bits.x) | (u64(idx.y) << (bits.x + bits.z));
+    if (m_kparams.sparse_grid) {
+        return m_cell_hash.find(key);
+    }
+    else {
+        return key < m_cell_table.size() ? m_cell_table[key] : -1;
     }
 }
 
 void mpWorld::beginUpdate(float dt)
 {
+    m_updating = true;
     m_taskgroup.run([=]() { update(dt); });
 }
 
 void mpWorld::endUpdate()
 {
     m_taskgroup.wait();
+    m_updating = false;
+    flushDeferredColliders();
+
+    if (!m_spawn_overflow.empty()) {
+        // queued particles came first
+        m_spawn_queue.drain([&](mpParticle *p, int num) { appendParticles(p, num); });
+        appendParticles(m_spawn_overflow.data(), m_spawn_overflow.size());
+        m_spawn_overflow.clear();
+    }
 }
 
 
 void mpWorld::callHandlers()
 {
-    int num_colliders = 0;
-    // search max id and allocate properties
-    if (!m_plane_colliders.empty()) { num_colliders = std::max(num_colliders, m_plane_colliders.back().props.owner_id + 1); }
-    if (!m_sphere_colliders.empty()) { num_colliders = std::max(num_colliders, m_sphere_colliders.back().props.owner_id + 1); }
-    if (!m_capsule_colliders.empty()) { num_colliders = std::max(num_colliders, m_capsule_colliders.back().props.owner_id + 1); }
-    if (!m_box_colliders.empty()) { num_colliders = std::max(num_colliders, m_box_colliders.back().props.owner_id + 1); }
-    m_collider_properties.resize(num_colliders);
-
-    for (auto &c : m_plane_colliders) { m_collider_properties[c.props.owner_id] = &c.props; }
-    for (auto &c : m_sphere_colliders) { m_collider_properties[c.props.owner_id] = &c.props; }
-    for (auto &c : m_capsule_colliders) { m_collider_properties[c.props.owner_id] = &c.props; }
-    for (auto &c : m_box_colliders) { m_collider_properties[c.props.owner_id] = &c.props; }
-
-    ist::parallel_invoke(
-        [&]() {
-            for (auto p : m_collider_properties) {
-                if (p && p->hit_handler != nullptr) {
-                    m_has_hithandler = true;
-                    break;
-                }
-            }
-        },
-        [&]() {
-            for (auto p : m_collider_properties) {
-                if (p && p->force_handler != nullptr) {
-                    m_has_forcehandler = true;
-                    break;
-                }
-            }
+    m_concurrency.run([&]() { callHandlersImpl(); });
+}
+
+void mpWorld::callHandlersImpl()
+{
+    mpProfileScope prof_handlers(m_profiler, mpProfilePhase::CallHandlers);
+    // hit value of particles is owner id of collider. handlers are looked up by id directly.
+    int num_colliders = (int)m_id_table.size();
+    for (int kind = 0; kind < mpNumColliderKinds; ++kind) {
+        for (int i = 0; i < getNumColliders(kind); ++i) {
+            const mpColliderProperties &props = getColliderProperties(kind, i);
+            if (props.hit_handler != nullptr) { m_has_hithandler = true; }
+            if (props.force_handler != nullptr) { m_has_forcehandler = true; }
+            if (props.batch_hit_handler != nullptr) { m_has_batchhandler = true; }
         }
-    );
+    }
+
+    if (m_has_hithandler || m_has_forcehandler || m_has_batchhandler) {
+        materializeParticles();
+    }
 
     if (m_has_hithandler) {
+        mpProfileScope prof(m_profiler, mpProfilePhase::HitHandlers);
         for (int i = 0; i < m_num_particles; ++i) {
             mpParticle &p = m_particles[i];
             if (p.hit != 0) {
                 m_current = i;
-                mpHitHandler handler = (mpHitHandler)(m_collider_properties[p.hit]->hit_handler);
+                mpColliderProperties *props = findCollider(p.hit);
+                mpHitHandler handler = props && !props->batch_hit_handler ? (mpHitHandler)props->hit_handler : nullptr;
                 if (handler) { handler(&p); }
             }
         }
     }
+    if (m_has_batchhandler) {
+        // one call per collider instead of one per particle
+        buildHitLists();
+        mpProfileScope prof(m_profiler, mpProfilePhase::HitHandlers);
+        for (int id = 0; id < (int)m_hit_begin.size() - 1; ++id) {
+            int num = m_hit_begin[id + 1] - m_hit_begin[id];
+            if (num == 0) { continue; }
+            mpColliderProperties *props = findCollider(id);
+            mpBatchHitHandler handler = props ? (mpBatchHitHandler)props->batch_hit_handler : nullptr;
+            if (handler) { handler(id, &m_hit_particles[m_hit_begin[id]], num); }
+        }
+    }
     if (m_has_forcehandler) {
-
+        mpProfileScope prof(m_profiler, mpProfilePhase::ForceHandlers);
         m_pforce.resize(num_colliders);
         memset(m_pforce.data(), 0, sizeof(mpParticleForce)*m_pforce.size());
-        ist::parallel_for_blocked(0, m_num_particles, g_particles_par_task,
-            [&](int begin, int end) {
-                mpPForceCont &pf = m_pcombinable.local();
+        ist::parallel_accumulate(m_pforce_slots, 0, m_num_particles, g_particles_par_task,
+            [&](mpPForceCont &pf, int begin, int end) {
+                mpProfileTask task(m_profiler, mpProfilePhase::ForceHandlers);
                 pf.resize(num_colliders);
+                memset(pf.data(), 0, sizeof(mpParticleForce)*pf.size());
                 for (int i = begin; i != end; ++i) {
                     mpParticle &p = m_particles[i];
                     if (p.hit != 0) {
@@ -917,20 +2220,20 @@ void mpWorld::callHandlers()
                     }
                 }
             });
-        m_pcombinable.combine_each([&](const mpPForceCont &pf) {
+        m_pforce_slots.combine_each([&](const mpPForceCont &pf) {
             for (int i = 0; i < (int)pf.size(); ++i) {
                 const mpParticleForce &h = pf[i];
                 (simdvec4&)m_pforce[i].position += h.position;
                 (simdvec4&)m_pforce[i].force += h.force;
                 m_pforce[i].num_hits += h.num_hits;
             }
-            memset((void*)pf.data(), 0, sizeof(mpParticleForce)*pf.size());
         });
 
         for (int i = 0; i < num_colliders; ++i) {
             if (m_pforce[i].num_hits == 0) continue;
 
-            mpForceHandler handler = (mpForceHandler)m_collider_properties[i]->force_handler;
+            mpColliderProperties *props = findCollider(i);
+            mpForceHandler handler = props ? (mpForceHandler)props->force_handler : nullptr;
             if (handler) {
                 (vec3&)m_pforce[i].position /= m_pforce[i].num_hits;
                 handler(&m_pforce[i]);
@@ -940,6 +2243,82 @@ void mpWorld::callHandlers()
 }
 
 
+void mpWorld::updateHitLists()
+{
+    m_concurrency.run([&]() {
+        materializeParticles();
+        buildHitLists();
+    });
+}
+
+int mpWorld::getHitList(int owner_id, mpParticle ***o_particles)
+{
+    if (owner_id < 0 || owner_id + 1 >= (int)m_hit_begin.size()) {
+        if (o_particles) { *o_particles = nullptr; }
+        return 0;
+    }
+    int begin = m_hit_begin[owner_id];
+    if (o_particles) { *o_particles = m_hit_particles.data() + begin; }
+    return m_hit_begin[owner_id + 1] - begin;
+}
+
+// counting sort of hit particles by owner id. each block of particles counts hits per id, offsets are
+// prefix sums over (id, block), and the blocks scatter pointers in parallel. order within a list is stable.
+void mpWorld::buildHitLists()
+{
+    mpProfileScope prof(m_profiler, mpProfilePhase::HitHandlers);
+    const int num_ids = (int)m_id_table.size();
+    const int num_particles = std::min<int>(m_num_particles, (int)m_particles.size());
+    m_hit_begin.assign(num_ids + 1, 0);
+    m_hit_particles.clear();
+    if (num_ids == 0 || num_particles == 0) { return; }
+
+    // cap the number of blocks to keep counts small when there are many colliders
+    const int max_blocks = 64;
+    const int block_size = std::max<int>(g_particles_par_task, ceildiv(num_particles, max_blocks));
+    const int num_blocks = ceildiv(num_particles, block_size);
+    m_hit_counts.assign(size_t(num_blocks) * num_ids, 0);
+
+    mpParticle *particles = m_particles.data();
+    int *counts = m_hit_counts.data();
+    ist::parallel_for(0, num_blocks,
+        [&](int b) {
+            mpProfileTask task(m_profiler, mpProfilePhase::HitHandlers);
+            int *c = counts + size_t(b) * num_ids;
+            int end = std::min<int>(num_particles, (b + 1) * block_size);
+            for (int i = b * block_size; i < end; ++i) {
+                int hit = particles[i].hit;
+                if (hit != 0 && hit < num_ids) { ++c[hit]; }
+            }
+        });
+
+    int total = 0;
+    for (int id = 0; id < num_ids; ++id) {
+        m_hit_begin[id] = total;
+        for (int b = 0; b < num_blocks; ++b) {
+            int &c = counts[size_t(b) * num_ids + id];
+            int n = c;
+            c = total;
+            total += n;
+        }
+    }
+    m_hit_begin[num_ids] = total;
+    if (total == 0) { return; }
+
+    m_hit_particles.resize(total);
+    mpParticle **dst = m_hit_particles.data();
+    ist::parallel_for(0, num_blocks,
+        [&](int b) {
+            mpProfileTask task(m_profiler, mpProfilePhase::HitHandlers);
+            int *c = counts + size_t(b) * num_ids;
+            int end = std::min<int>(num_particles, (b + 1) * block_size);
+            for (int i = b * block_size; i < end; ++i) {
+                int hit = particles[i].hit;
+                if (hit != 0 && hit < num_ids) { dst[c[hit]++] = &particles[i]; }
+            }
+        });
+}
+
 
 inline vec2 mpComputeDataTextureCoord(int nth)
 {
@@ -952,14 +2331,28 @@ inline vec2 mpComputeDataTextureCoord(int nth)
 
 int mpWorld::updateDataTexture(void *tex, int width, int height)
 {
-    std::unique_lock<std::mutex> lock(m_mutex);
+    bool fresh = false;
+    if (m_gpu_middle.load(std::memory_order_acquire) & mpSnapshotFresh) {
+        m_gpu_front = m_gpu_middle.exchange(m_gpu_front, std::memory_order_acq_rel) & mpSnapshotIndexMask;
+        fresh = true;
+    }
+    const mpGPUSnapshot &snap = m_gpu_snapshots[m_gpu_front];
 
+    // texture already holds front snapshot unless it has been replaced or its layout has changed
+    bool whole = snap.format != m_gpu_format_prev || tex != m_gpu_texture_prev;
     auto *gd = gi::GetGraphicsInterface();
-    if (gd && !m_particles_gpu.empty()) {
-        int num_needs_copy = std::max<int>(m_num_particles_gpu, m_num_particles_gpu_prev);
-        m_num_particles_gpu_prev = m_num_particles_gpu;
-        gd->writeTexture2D(tex, width, height, gi::TextureFormat::RGBAf32,
-            m_particles_gpu.data(), sizeof(mpParticle)*m_kparams.max_particles);
+    if (gd && !snap.data.empty() && (fresh || whole)) {
+        int each_line = mpParticlesEachLine(snap.format);
+        size_t pitch = mpBytesEachParticle(snap.format) * each_line;
+        // dirty rows: live particles and ones died since last upload. rows below them are dead in texture already.
+        int num_rows = whole ? int(snap.data.size() / pitch) : ceildiv(std::max<int>(snap.num, m_num_particles_gpu_prev), each_line);
+        num_rows = std::min<int>(num_rows, height);
+        m_num_particles_gpu_prev = snap.num;
+        m_gpu_format_prev = snap.format;
+        m_gpu_texture_prev = tex;
+        auto tex_format = snap.format == (int)mpRenderFormat::Compact ? gi::TextureFormat::RGBAf16 : gi::TextureFormat::RGBAf32;
+        // returns once the rows are on staging memory. GPU copies them to the texture in order with rendering.
+        gd->enqueueWriteTexture2D(tex, 0, 0, width, num_rows, tex_format, snap.data.data());
     }
-    return m_num_particles_gpu;
+    return snap.num;
 }
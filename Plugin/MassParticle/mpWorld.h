@@ -1,5 +1,26 @@
 #pragma once
 #include "mpConcurrency.h"
+#include "mpProfiler.h"
+
+// cells are colored by index % 3 on each axis. cells of same color never share neighbors.
+const int mpNumCellColors = 27;
+
+struct mpSDFData;
+struct mpBakedFieldData;
+
+enum mpScatterShape
+{
+    mpScatterShape_Sphere,  // sphere of diameter 1
+    mpScatterShape_Box,     // cube of size 1
+};
+
+// particles for GPU, laid out as in data texture
+struct mpGPUSnapshot
+{
+    mpByteArray data;   // whole lines of data texture
+    int num;            // live particles. particles after them are dead
+    int format;         // mpRenderFormat of data
+};
 
 class mpWorld
 {
@@ -11,14 +32,40 @@ public:
     void endUpdate();
     void update(float dt);
     void callHandlers();
+    void updateHitLists();
+    int  getHitList(int owner_id, mpParticle ***o_particles); // returns number of particles. valid until next update
 
+    // goes to spawn queue if async update is running. particles the queue can't take are added at endUpdate(), so none are lost.
     void addParticles(mpParticle *p, size_t num);
+    // can be called from any thread at any time. particles are added at start of next update.
+    // returns number of particles accepted. it is less than num if the queue is full.
+    int  enqueueParticles(const mpParticle *p, size_t num);
+    void setSpawnQueueCapacity(int v); // not thread safe. pending particles are discarded
+    // random particles in unit shape transformed by trans. written into particles in parallel, or queued as addParticles() if async update is running.
+    // random numbers come from seed and number of particles scattered since the seed was set, so results are reproducible.
+    void scatterParticles(mpScatterShape shape, const mat4 &trans, int num, const mpSpawnParams *params);
+    void setSpawnSeed(u32 seed);
     void addPlaneColliders(mpPlaneCollider *col, size_t num);
     void addSphereColliders(mpSphereCollider *col, size_t num);
     void addCapsuleColliders(mpCapsuleCollider *col, size_t num);
     void addBoxColliders(mpBoxCollider *col, size_t num);
-    void removeCollider(mpColliderProperties &props);
+    void addSDFColliders(mpSDFCollider *col, size_t num, const std::shared_ptr<mpSDFData> &sdf); // sdf is kept until colliders are cleared
+    void removeCollider(mpColliderProperties &props); // by owner_id. deferred to endUpdate() if async update is running
+    // persistent colliders are kept by clearCollidersAndForces() until destroyed. handles are stable and never 0,
+    // and handles of destroyed colliders stay invalid even if their slots are reused.
+    // like removeCollider(), changes are deferred to endUpdate() if async update is running. handles are returned right away.
+    // updating colliders in place costs nothing for the ones that are not updated.
+    void createColliders(const mpSphereCollider *col, size_t num, int *o_handles);
+    void createColliders(const mpCapsuleCollider *col, size_t num, int *o_handles);
+    void createColliders(const mpBoxCollider *col, size_t num, int *o_handles);
+    void updateColliders(const int *handles, const mpSphereCollider *col, size_t num); // invalid handles are ignored
+    void updateColliders(const int *handles, const mpCapsuleCollider *col, size_t num);
+    void updateColliders(const int *handles, const mpBoxCollider *col, size_t num);
+    void destroyColliders(const int *handles, size_t num);
+    bool isValidHandle(int handle); // false once the collider is destroyed or removed by owner_id
     void addForces(mpForce *force, size_t num);
+    void addSplineForce(mpForce &force, const vec3 *polyline, size_t num_points);
+    void addBakedFieldForce(mpForce &force, const std::shared_ptr<mpBakedFieldData> &field); // field is kept until forces are cleared
 
     void scanSphere(mpHitHandler handler, const vec3 &pos, float radius);
     void scanAABB(mpHitHandler handler, const vec3 &center, const vec3 &extent);
@@ -36,50 +83,158 @@ public:
     void                    setKernelParams(const mpKernelParams &v);
     mpTempParams&           getTempParams();
     const mpCellCont&       getCells();
+    int                     getNumCells() const;
+    int                     findCell(const ivec3 &idx) const; // index of occupied cell. -1 if empty
 
     void        forceSetNumParticles(int v);
     int         getNumParticles() const;
     mpParticle* getParticles();
-    int         getNumParticlesGPU() const;
-    mpParticle* getParticlesGPU();
+    int         getNumParticlesGPU() const; // particles in the snapshot last taken by updateDataTexture()
+    mpParticle* getParticlesGPU();              // nullptr unless render_format is Full
 
     mpParticleIM& getIntermediateData(int i);
     mpParticleIM& getIntermediateData();
 
-    std::mutex& getMutex();
+    mpProfiler& getProfiler();
+    void        setMaxThreads(int v); // limits threads used by update() & callHandlers(). 0: no limit
+    int         getMaxThreads() const;
+    int         getNumSubsteps() const; // substeps taken in last update
 
+    // uploads newest snapshot made by update(). never waits for update running in background.
     int updateDataTexture(void *tex, int width, int height);
 
 private:
-    typedef ist::combinable<mpPForceCont> mpPForceConbinable;
+    void updateImpl(float dt);
+    void appendParticles(const mpParticle *p, size_t num);
+    void spawnAfterUpdate(const mpParticle *p, size_t num);
+    void step(float dt, i64 cell_num, int substep);
+    float getMaxSpeed();
+    void callHandlersImpl();
+    void buildHitLists();
+    void compactParticles();
+    void publishSnapshot();
+    void sortParticles();
+    void materializeParticles();
+    void buildCells(i64 cell_num);
+    void updateNeighborList(mpKernelContext &kcontext, float interaction_radius);
+    void remapNeighborList(const int *srcs);
+    void buildCellColors();
+    void buildBroadphase();
+    // collider registry
+    mpColliderProperties&   getColliderProperties(int kind, int index);
+    int                     getNumColliders(int kind) const;
+    void                    resizeColliders(int kind, int num);
+    void                    moveCollider(int kind, int from, int to); // overwrites 'to'
+    void                    registerColliders(int kind, int begin, int end);
+    void                    unregisterCollider(int kind, int index);
+    void                    eraseCollider(int kind, int index);
+    mpColliderProperties*   findCollider(int owner_id); // nullptr if not found
+    void                    flushDeferredColliders();
+    mpColliderLocation*     findHandle(int handle); // nullptr if invalid
+    int                     allocHandle(int kind, int index);
+    void                    releaseSlot(int slot);
+    template<class Cont> void insertCollider(Cont &cont, int kind, int handle, const typename Cont::value_type &col);
+    template<class Cont> void createCollidersImpl(Cont &cont, Cont &deferred, int kind, const typename Cont::value_type *col, size_t num, int *o_handles);
+    template<class Cont> void updateCollidersImpl(Cont &cont, Cont &deferred, int kind, const int *handles, const typename Cont::value_type *col, size_t num);
+
+    enum mpDeferredOp
+    {
+        mpDeferred_Remove,  // handle is owner_id
+        mpDeferred_Create,
+        mpDeferred_Update,
+        mpDeferred_Destroy,
+    };
+    // collider operation made while updating. data is index in m_deferred_* of the kind for create & update
+    struct mpDeferredColliderOp
+    {
+        int op;
+        int kind;
+        int handle;
+        int data;
+    };
+
+    typedef ist::slot_accumulator<mpPForceCont> mpPForceAccumulator;
+    typedef ist::slot_accumulator<float> mpSpeedAccumulator;
+    typedef ist::batch_queue<mpParticle, mpAlignedAllocator<mpParticle> > mpSpawnQueue;
 
     mpParticleCont          m_particles;
+    mpSpawnQueue            m_spawn_queue;
+    mpParticleCont          m_spawn_overflow; // added while updating but didn't fit in m_spawn_queue
+    mpU64Array              m_sort_keys;
+    mpU64Array              m_sort_keys_tmp;
+    mpIntArray              m_sort_indices;
+    mpIntArray              m_sort_indices_tmp;
     mpParticleIMCont        m_imd;
     mpSoAData               m_soa;
-    mpCellCont              m_cells;
+    mpSoAData               m_soa_back;
+    mpCellCont              m_cells;        // occupied cells only
+    mpU64Array              m_cell_keys;
+    int                     m_num_cells;
+    mpIntArray              m_cell_neighbor_begin; // occupied cells around cell i (including itself) are
+    mpIntArray              m_cell_neighbors;      // m_cell_neighbors[m_cell_neighbor_begin[i] ... m_cell_neighbor_begin[i+1]]
+    mpIntArray              m_cell_table;   // dense grid: cell key -> index of occupied cell
+    mpCellHashTable         m_cell_hash;    // sparse grid: cell key -> index of occupied cell
+    mpNeighborList          m_nlist;
+    mpIntArray              m_cell_colors;  // cell indices grouped by color, for half stencil
+    int                     m_color_begin[mpNumCellColors + 1];
+    mpBroadphase            m_broadphase;
     u32                     m_id_seed;
+    u32                     m_spawn_seed;
+    u64                     m_spawn_counter; // particles scattered since m_spawn_seed was set
     int                     m_num_particles;
+    int                     m_num_soa_particles;
+    int                     m_num_substeps;
+    bool                    m_aos_exposed;
+    bool                    m_updating;     // between beginUpdate() and endUpdate()
 
-    mpColliderPropertiesCont m_collider_properties;
     mpPlaneColliderCont     m_plane_colliders;
     mpSphereColliderCont    m_sphere_colliders;
     mpCapsuleColliderCont   m_capsule_colliders;
     mpBoxColliderCont       m_box_colliders;
+    mpSDFColliderCont       m_sdf_colliders;
+    std::vector<std::shared_ptr<mpSDFData>> m_sdf_data; // keeps distances of m_sdf_colliders
+    // collider registry. containers above are dense, and persistent colliders are at front of them.
+    // m_persistent[kind][i]: slot of i-th collider. m_slots[slot]: where the collider of the handle is.
+    // m_id_table[owner_id]: where the collider last added with the id is.
+    std::vector<int>        m_persistent[mpNumColliderKinds];
+    std::vector<mpColliderLocation> m_slots;
+    std::vector<int>        m_slot_generations;
+    std::vector<int>        m_free_slots;
+    std::vector<mpColliderLocation> m_id_table;
+    std::vector<mpDeferredColliderOp> m_deferred_ops; // made while updating, in order
+    mpSphereColliderCont    m_deferred_spheres;
+    mpCapsuleColliderCont   m_deferred_capsules;
+    mpBoxColliderCont       m_deferred_boxes;
     mpForceCont             m_forces;
+    std::vector<vec3>       m_spline_points; // polylines of FD_Spline forces
+    std::vector<std::shared_ptr<mpBakedFieldData>> m_field_data; // keeps vectors of FD_BakedField forces
     bool                    m_has_hithandler;
     bool                    m_has_forcehandler;
+    bool                    m_has_batchhandler;
+    // particles hit by collider of owner_id are m_hit_particles[m_hit_begin[owner_id] ... m_hit_begin[owner_id+1]], in order of particles.
+    std::vector<mpParticle*> m_hit_particles;
+    mpIntArray              m_hit_begin;
+    mpIntArray              m_hit_counts;   // per block counts for building
 
     ist::task_group         m_taskgroup;
-    std::mutex              m_mutex;
+    ist::concurrency_limit  m_concurrency;
     mpKernelParams          m_kparams;
     mpTempParams            m_tparams;
 
     mpPForceCont            m_pforce;
-    mpPForceConbinable      m_pcombinable;
-
-    int                     m_num_particles_gpu;
-    int                     m_num_particles_gpu_prev;
-    mpParticleCont          m_particles_gpu;
+    mpPForceAccumulator     m_pforce_slots;
+    mpSpeedAccumulator      m_speed_slots;  // squared max speed of each block, for getMaxSpeed()
+
+    // snapshots of particles for GPU in triple buffer. update() fills back one and publishes it by swapping it
+    // with middle one. updateDataTexture() swaps front one with middle one if it has been published since.
+    mpGPUSnapshot           m_gpu_snapshots[3];
+    int                     m_gpu_back;
+    int                     m_gpu_front;
+    std::atomic<int>        m_gpu_middle;           // index | mpSnapshotFresh
+    int                     m_num_particles_gpu_prev; // live particles in texture
+    int                     m_gpu_format_prev;      // layout of texture. whole texture is uploaded when it changes
+    void                    *m_gpu_texture_prev;    // and when texture itself changes
 
     int                     m_current;
+    mpProfiler              m_profiler;
 };
@@ -7,6 +7,8 @@
 #include <functional>
 #include <random>
 #include <mutex>
+#include <atomic>
+#include <memory>
 
 #define GLM_FORCE_RADIANS
 #ifdef _WIN64
@@ -55,6 +55,34 @@ void TextureTest(gi::GraphicsInterface *ifs,
     Test(ifs->writeTexture2D(texture, width, height, format, data.data(), data_size));
     Test(ifs->readTexture2D(read_data.data(), data_size, texture, width, height, format));
     Test(memcmp(data.data(), read_data.data(), data_size) == 0);
+
+    // back-to-back writes. backends with staging memory have to reuse it
+    for (int i = 0; i < 4; ++i) {
+        Test(ifs->writeTexture2D(texture, width, height, format, (i % 2 == 0 ? idata : data).data(), data_size));
+    }
+    Test(ifs->readTexture2D(read_data.data(), data_size, texture, width, height, format));
+    Test(memcmp(data.data(), read_data.data(), data_size) == 0);
+
+    // sub-rectangle writes keep rest of the texture. enqueued one is read back in order.
+    {
+        const int rx = 1, ry = height / 4, rw = width / 2, rh = height / 2;
+        auto rect = std::vector<T>(rw * rh);
+        auto expected = data;
+        for (int y = 0; y < rh; ++y) {
+            for (int x = 0; x < rw; ++x) {
+                rect[rw * y + x] = idata[width * (ry + y) + (rx + x)];
+                expected[width * (ry + y) + (rx + x)] = idata[width * (ry + y) + (rx + x)];
+            }
+        }
+        Test(ifs->writeTexture2D(texture, rx, ry, rw, rh, format, rect.data()));
+        Test(ifs->readTexture2D(read_data.data(), data_size, texture, width, height, format));
+        Test(memcmp(expected.data(), read_data.data(), data_size) == 0);
+
+        Test(ifs->writeTexture2D(texture, width, height, format, data.data(), data_size));
+        Test(ifs->enqueueWriteTexture2D(texture, rx, ry, rw, rh, format, rect.data()));
+        Test(ifs->readTexture2D(read_data.data(), data_size, texture, width, height, format));
+        Test(memcmp(expected.data(), read_data.data(), data_size) == 0);
+    }
     ifs->releaseTexture2D(texture);
     printf("\n");
 }
@@ -75,6 +103,12 @@ void BufferTest(gi::GraphicsInterface *ifs,
     Test(ifs->writeBuffer(buffer, data.data(), data_size, type));
     Test(ifs->readBuffer(read_data.data(), buffer, data_size, type));
     Test(memcmp(data.data(), read_data.data(), data_size) == 0);
+
+    for (int i = 0; i < 4; ++i) {
+        Test(ifs->writeBuffer(buffer, (i % 2 == 0 ? idata : data).data(), data_size, type));
+    }
+    Test(ifs->readBuffer(read_data.data(), buffer, data_size, type));
+    Test(memcmp(data.data(), read_data.data(), data_size) == 0);
     ifs->releaseBuffer(buffer);
     printf("\n");
 }
@@ -1,9 +1,442 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 #include "../MassParticle/MassParticle.h"
 
+// headless benchmark. runs standard scenes through the C API only (no Unity, no GPU) and reports
+// ns/particle/step of each phase taken from the built-in profiler (mpGetProfileStats()).
+//
+// usage: TestMassParticle [-quick] [-nlist] [-half] [-substep] [-compact] [-o results.json]
+// -nlist runs every configuration with neighbor list (mpKernelParams::neighbor_list) as well.
+// -half runs every impulse configuration with half stencil (mpKernelParams::half_stencil) as well.
+// -substep runs every configuration with adaptive substeps (mpKernelParams::adaptive_substeps) as well.
+// -compact builds GPU snapshots in mpRenderFormat::Compact instead of Full (GPUClone phase).
+// results file is JSON: one record per run with time of each phase in ns/particle/step.
+// returns non-zero if a scene lost all particles or produced non-finite positions.
 
-int main(int argc, char *argv[])
+enum class Scene
+{
+    DamBreak,   // SPH. block of fluid collapses in a container
+    BoxFill,    // impulse. particles are emitted into a container during warm-up
+    Colliders,  // impulse. particles fall through many sphere & capsule colliders with force handlers
+    Forces,     // impulse. many radial & directional forces
+    Scan,       // impulse. box fill + sphere / AABB scan queries each step
+};
+
+struct RunParams
+{
+    Scene scene;
+    mpSolverType solver;
+    int num_particles;
+    int world_div;
+    int num_threads;
+    bool neighbor_list;
+    bool half_stencil;
+    bool adaptive_substeps;
+};
+
+struct RunResult
+{
+    RunParams params;
+    int num_alive;
+    double step_ms;     // wall clock of mpUpdate() + mpCallHandlers()
+    double scan_ms;     // wall clock of scan queries. Scan scene only
+    double substeps;    // average of mpGetNumSubsteps()
+    mpProfileStats stats[(int)mpProfilePhase::Num];
+    bool ok;
+};
+
+static const int g_num_warmup_steps = 20;
+static const int g_num_steps = 60; // must be <= rolling window of profiler (64)
+static const float g_container_extent = 8.0f;
+static const float g_spacing = 0.12f;   // initial particle spacing. particle_size is 0.08
+
+static int g_num_force_hits;
+static mpRenderFormat g_render_format = mpRenderFormat::Full;
+
+
+static const char* GetSceneName(Scene s)
 {
+    switch (s) {
+    case Scene::DamBreak: return "DamBreak";
+    case Scene::BoxFill: return "BoxFill";
+    case Scene::Colliders: return "Colliders";
+    case Scene::Forces: return "Forces";
+    case Scene::Scan: return "Scan";
+    }
+    return "";
+}
+
+static const char* GetSolverName(mpSolverType s)
+{
+    switch (s) {
+    case mpSolverType::Impulse: return "Impulse";
+    case mpSolverType::SPH: return "SPH";
+    case mpSolverType::SPHEst: return "SPHEst";
+    }
+    return "";
+}
+
+static mpM44 Identity()
+{
+    mpM44 r;
+    memset(&r, 0, sizeof(r));
+    r.v[0] = r.v[5] = r.v[10] = r.v[15] = 1.0f;
+    return r;
+}
+
+static mpM44 Translate(const mpV3 &pos, float scale)
+{
+    mpM44 r = Identity();
+    r.v[0] = r.v[5] = r.v[10] = scale;
+    r.v[12] = pos.x; r.v[13] = pos.y; r.v[14] = pos.z;
+    return r;
+}
+
+static void __stdcall CountForce(mpParticleForce *f)
+{
+    g_num_force_hits += f->num_hits;
+}
+
+static void __stdcall CountHit(mpParticle *p)
+{
+    ++g_num_force_hits;
+}
+
+
+static mpSpawnParams MakeSpawnParams()
+{
+    mpSpawnParams sp;
+    sp.velocity_base = mpV3(0.0f, 0.0f, 0.0f);
+    sp.velocity_random_diffuse = 0.5f;
+    sp.lifetime = 10000.0f;
+    sp.lifetime_random_diffuse = 0.0f;
+    sp.userdata = 0;
+    sp.handler = nullptr;
+    return sp;
+}
+
+// floor and 4 walls. world bounds don't stop particles.
+static void AddContainer(int ctx, int &owner_id)
+{
+    const float e = g_container_extent;
+    const float t = 1.0f;
+    mpV3 centers[] = {
+        mpV3(0.0f, -t * 0.5f, 0.0f),
+        mpV3(-e - t * 0.5f, e, 0.0f), mpV3(e + t * 0.5f, e, 0.0f),
+        mpV3(0.0f, e, -e - t * 0.5f), mpV3(0.0f, e, e + t * 0.5f),
+    };
+    mpV3 sizes[] = {
+        mpV3(e * 2.0f + t * 2.0f, t, e * 2.0f + t * 2.0f),
+        mpV3(t, e * 2.0f, e * 2.0f), mpV3(t, e * 2.0f, e * 2.0f),
+        mpV3(e * 2.0f, e * 2.0f, t), mpV3(e * 2.0f, e * 2.0f, t),
+    };
+    mpM44 trans = Identity();
+    for (int i = 0; i < 5; ++i) {
+        mpColliderProperties props = { owner_id++, 1500.0f, nullptr, nullptr };
+        mpAddBoxCollider(ctx, &props, &trans, &centers[i], &sizes[i]);
+    }
+}
+
+static void AddGravity(int ctx)
+{
+    mpForceProperties fp;
+    memset(&fp, 0, sizeof(fp));
+    fp.shape = mpForceShape::AffectAll;
+    fp.type = mpForceType::Directional;
+    fp.direction = mpV3(0.0f, -1.0f, 0.0f);
+    fp.strength_near = fp.strength_far = 9.8f;
+    fp.attenuation_exp = 0.25f;
+    mpM44 trans = Identity();
+    mpAddForce(ctx, &fp, &trans);
+}
+
+// colliders & forces are cleared by the caller each step. they are rebuilt every step as in Unity.
+static void SetupStep(int ctx, const RunParams &rp, int step)
+{
+    int owner_id = 1;
+    AddContainer(ctx, owner_id);
+    AddGravity(ctx);
+
+    if (rp.scene == Scene::Colliders) {
+        // 16x16 grid of spheres and capsules
+        for (int i = 0; i < 256; ++i) {
+            float x = -g_container_extent + (g_container_extent * 2.0f) * ((i % 16) + 0.5f) / 16.0f;
+            float z = -g_container_extent + (g_container_extent * 2.0f) * ((i / 16) + 0.5f) / 16.0f;
+            mpColliderProperties props = { owner_id++, 1500.0f, nullptr, CountForce };
+            if (i % 2 == 0) {
+                mpV3 center(x, 2.0f + (i % 3), z);
+                mpAddSphereCollider(ctx, &props, &center, 0.3f);
+            }
+            else {
+                mpV3 pos1(x - 0.3f, 3.0f, z), pos2(x + 0.3f, 3.5f, z);
+                mpAddCapsuleCollider(ctx, &props, &pos1, &pos2, 0.2f);
+            }
+        }
+    }
+    else if (rp.scene == Scene::Forces) {
+        for (int i = 0; i < 128; ++i) {
+            float x = -g_container_extent + (g_container_extent * 2.0f) * ((i % 8) + 0.5f) / 8.0f;
+            float z = -g_container_extent + (g_container_extent * 2.0f) * ((i / 8 % 8) + 0.5f) / 8.0f;
+            mpV3 center(x, 1.0f + (i / 64) * 3.0f, z);
+
+            mpForceProperties fp;
+            memset(&fp, 0, sizeof(fp));
+            fp.attenuation_exp = 0.25f;
+            fp.center = center;
+            if (i % 2 == 0) {
+                fp.shape = mpForceShape::Sphere;
+                fp.type = mpForceType::Radial;
+                fp.strength_near = 20.0f * std::sin(step * 0.1f + i);
+                fp.range_outer = 1.5f;
+                fp.rcp_range = 1.0f / fp.range_outer;
+            }
+            else {
+                fp.shape = mpForceShape::Box;
+                fp.type = mpForceType::Directional;
+                fp.direction = mpV3(0.0f, 1.0f, 0.0f);
+                fp.strength_near = fp.strength_far = 15.0f;
+            }
+            mpM44 trans = Translate(center, 2.0f);
+            mpAddForce(ctx, &fp, &trans);
+        }
+    }
+}
+
+static void Spawn(int ctx, const RunParams &rp, int step)
+{
+    mpSpawnParams sp = MakeSpawnParams();
+    const float e = g_container_extent - 0.5f;
+    if (rp.scene == Scene::DamBreak) {
+        if (step != 0) { return; }
+        // fluid block at a corner of the container
+        float side = std::min<float>(std::cbrt(rp.num_particles * g_spacing * g_spacing * g_spacing), e);
+        float height = rp.num_particles * g_spacing * g_spacing * g_spacing / (side * side);
+        mpV3 center(-e + side * 0.5f, height * 0.5f, -e + side * 0.5f);
+        mpV3 size(side * 0.5f, height * 0.5f, side * 0.5f);
+        sp.velocity_random_diffuse = 0.0f;
+        mpScatterParticlesBox(ctx, &center, &size, rp.num_particles, &sp);
+    }
+    else {
+        // emit during warm-up
+        if (step >= g_num_warmup_steps) { return; }
+        int num = rp.num_particles / g_num_warmup_steps;
+        if (step == g_num_warmup_steps - 1) { num = rp.num_particles - num * step; }
+        mpV3 center(0.0f, 6.0f, 0.0f);
+        mpV3 size(e, 1.0f, e);
+        mpScatterParticlesBox(ctx, &center, &size, num, &sp);
+    }
+}
+
+static double RunScans(int ctx)
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < 64; ++i) {
+        float x = -g_container_extent + g_container_extent * 2.0f * (i % 8 + 0.5f) / 8.0f;
+        float z = -g_container_extent + g_container_extent * 2.0f * (i / 8 + 0.5f) / 8.0f;
+        mpV3 center(x, 0.5f, z);
+        mpV3 extent(0.5f, 0.5f, 0.5f);
+        mpScanSphere(ctx, CountHit, &center, 0.5f);
+        mpScanAABB(ctx, CountHit, &center, &extent);
+    }
+    mpV3 center(0.0f, 1.0f, 0.0f);
+    mpV3 extent(g_container_extent, 1.0f, g_container_extent);
+    mpScanSphereParallel(ctx, CountHit, &center, 4.0f);
+    mpScanAABBParallel(ctx, CountHit, &center, &extent);
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+static bool Validate(int ctx)
+{
+    int num = mpGetNumParticles(ctx);
+    if (num == 0) { return false; }
+    const mpParticle *particles = mpGetParticles(ctx);
+    for (int i = 0; i < num; ++i) {
+        const mpV3 &p = particles[i].position;
+        if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) { return false; }
+    }
+    return true;
+}
+
+static RunResult Run(const RunParams &rp)
+{
+    RunResult r;
+    memset(&r, 0, sizeof(r));
+    r.params = rp;
+
     int ctx = mpCreateContext();
+    mpKernelParams kp;
+    mpGetKernelParams(ctx, &kp);
+    // default extent. cell size is 0.16 (= particle diameter) at world_div 128
+    kp.world_center = mpV3(0.0f, g_container_extent, 0.0f);
+    kp.world_div = mpV3i(rp.world_div, rp.world_div, rp.world_div);
+    kp.solver_type = rp.solver;
+    kp.max_particles = rp.num_particles;
+    kp.neighbor_list = rp.neighbor_list ? 1 : 0;
+    kp.half_stencil = rp.half_stencil ? 1 : 0;
+    kp.adaptive_substeps = rp.adaptive_substeps ? 1 : 0;
+    kp.render_format = g_render_format;
+    mpSetKernelParams(ctx, &kp);
+    mpSetMaxThreads(ctx, rp.num_threads);
+
+    const float dt = 1.0f / 60.0f;
+    double step_ms = 0.0, scan_ms = 0.0;
+    for (int step = 0; step < g_num_warmup_steps + g_num_steps; ++step) {
+        if (step == g_num_warmup_steps) { mpResetProfileStats(ctx); }
+
+        mpClearCollidersAndForces(ctx);
+        SetupStep(ctx, rp, step);
+        Spawn(ctx, rp, step);
+
+        auto begin = std::chrono::high_resolution_clock::now();
+        mpUpdate(ctx, dt);
+        mpCallHandlers(ctx);
+        auto end = std::chrono::high_resolution_clock::now();
+        if (step >= g_num_warmup_steps) {
+            step_ms += std::chrono::duration<double, std::milli>(end - begin).count();
+            r.num_alive += mpGetNumParticles(ctx);
+            r.substeps += mpGetNumSubsteps(ctx);
+            if (rp.scene == Scene::Scan) { scan_ms += RunScans(ctx); }
+        }
+    }
+    r.num_alive /= g_num_steps;
+    r.step_ms = step_ms / g_num_steps;
+    r.scan_ms = scan_ms / g_num_steps;
+    r.substeps /= g_num_steps;
+    mpGetProfileStats(ctx, r.stats, (int)mpProfilePhase::Num);
+    r.ok = Validate(ctx);
     mpDestroyContext(ctx);
-    return 0;
+    return r;
+}
+
+// phases are averaged over steps they ran in, then normalized by average alive particles.
+static double NsPerParticle(const RunResult &r, double ms)
+{
+    return r.num_alive > 0 ? ms * 1000000.0 / r.num_alive : 0.0;
+}
+
+static void PrintHeader()
+{
+    printf("%-10s %-8s %8s %5s %3s %8s %9s", "scene", "solver", "particles", "div", "thr", "alive", "step ms");
+    for (int i = 0; i < (int)mpProfilePhase::Num; ++i) {
+        printf(" %9.9s", mpGetProfilePhaseName((mpProfilePhase)i));
+    }
+    printf("  (ns/particle/step)\n");
+}
+
+static void PrintResult(const RunResult &r)
+{
+    const RunParams &rp = r.params;
+    printf("%-10s %-8s %8d %5d %3d %8d %9.3f", GetSceneName(rp.scene), GetSolverName(rp.solver),
+        rp.num_particles, rp.world_div, rp.num_threads, r.num_alive, r.step_ms);
+    for (int i = 0; i < (int)mpProfilePhase::Num; ++i) {
+        printf(" %9.2f", NsPerParticle(r, r.stats[i].avg_ms));
+    }
+    if (rp.neighbor_list) { printf("  nlist"); }
+    if (rp.half_stencil) { printf("  half"); }
+    if (rp.adaptive_substeps) { printf("  substeps %.2f", r.substeps); }
+    if (rp.scene == Scene::Scan) { printf("  scan %.3fms", r.scan_ms); }
+    printf("%s\n", r.ok ? "" : "  NG");
+    fflush(stdout);
+}
+
+static bool WriteResults(const char *path, const std::vector<RunResult> &results)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == nullptr) { return false; }
+    fprintf(f, "{\"unit\":\"ns/particle/step\",\"steps\":%d,\"runs\":[\n", g_num_steps);
+    for (size_t ri = 0; ri < results.size(); ++ri) {
+        const RunResult &r = results[ri];
+        const RunParams &rp = r.params;
+        fprintf(f, "{\"scene\":\"%s\",\"solver\":\"%s\",\"particles\":%d,\"world_div\":%d,\"threads\":%d,\"neighbor_list\":%s,\"half_stencil\":%s,\"adaptive_substeps\":%s,\"substeps\":%.2f,\"alive\":%d,\"ok\":%s,\"step_ms\":%.4f,\"scan_ms\":%.4f,\"phases\":{",
+            GetSceneName(rp.scene), GetSolverName(rp.solver), rp.num_particles, rp.world_div, rp.num_threads, rp.neighbor_list ? "true" : "false", rp.half_stencil ? "true" : "false",
+            rp.adaptive_substeps ? "true" : "false", r.substeps,
+            r.num_alive, r.ok ? "true" : "false", r.step_ms, r.scan_ms);
+        for (int i = 0; i < (int)mpProfilePhase::Num; ++i) {
+            const mpProfileStats &s = r.stats[i];
+            fprintf(f, "%s\"%s\":{\"avg\":%.3f,\"min\":%.3f,\"max\":%.3f,\"tasks\":%.1f}", i == 0 ? "" : ",",
+                mpGetProfilePhaseName((mpProfilePhase)i),
+                NsPerParticle(r, s.avg_ms), NsPerParticle(r, s.min_ms), NsPerParticle(r, s.max_ms), s.avg_tasks);
+        }
+        fprintf(f, "}}%s\n", ri + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+    return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+    bool quick = false;
+    bool nlist = false;
+    bool half = false;
+    bool substep = false;
+    const char *out_path = "MassParticleBenchmark.json";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-quick") == 0) { quick = true; }
+        else if (strcmp(argv[i], "-nlist") == 0) { nlist = true; }
+        else if (strcmp(argv[i], "-half") == 0) { half = true; }
+        else if (strcmp(argv[i], "-substep") == 0) { substep = true; }
+        else if (strcmp(argv[i], "-compact") == 0) { g_render_format = mpRenderFormat::Compact; }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) { out_path = argv[++i]; }
+    }
+
+    int hw_threads = std::max<int>(1, (int)std::thread::hardware_concurrency());
+    std::vector<int> counts = quick ? std::vector<int>{ 16384 } : std::vector<int>{ 16384, 65536, 262144 };
+    std::vector<int> divs = quick ? std::vector<int>{ 128 } : std::vector<int>{ 32, 64, 128 };
+    std::vector<int> threads;
+    for (int t = 1; t < hw_threads; t *= 2) { threads.push_back(t); }
+    threads.push_back(hw_threads);
+    if (quick) { threads = { hw_threads }; }
+    // solver variants: { neighbor_list, half_stencil, adaptive_substeps }
+    struct Variant { bool neighbor_list, half_stencil, adaptive_substeps; };
+    std::vector<Variant> variants = { { false, false, false } };
+    if (nlist) { variants.push_back({ true, false, false }); }
+    if (half) { variants.push_back({ false, true, false }); }
+    if (substep) { variants.push_back({ false, false, true }); }
+
+    struct SceneDesc { Scene scene; std::vector<mpSolverType> solvers; };
+    std::vector<SceneDesc> scenes = {
+        { Scene::DamBreak, { mpSolverType::SPH, mpSolverType::SPHEst } },
+        { Scene::BoxFill, { mpSolverType::Impulse } },
+        { Scene::Colliders, { mpSolverType::Impulse } },
+        { Scene::Forces, { mpSolverType::Impulse } },
+        { Scene::Scan, { mpSolverType::Impulse } },
+    };
+
+    std::vector<RunResult> results;
+    bool ok = true;
+    PrintHeader();
+    for (auto &sd : scenes) {
+        for (auto solver : sd.solvers) {
+            for (int num : counts) {
+                for (int div : divs) {
+                    for (int nt : threads) {
+                        for (auto &v : variants) {
+                            if (v.half_stencil && solver != mpSolverType::Impulse) { continue; }
+                            RunParams rp = { sd.scene, solver, num, div, nt, v.neighbor_list, v.half_stencil, v.adaptive_substeps };
+                            results.push_back(Run(rp));
+                            PrintResult(results.back());
+                            ok = ok && results.back().ok;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (!WriteResults(out_path, results)) {
+        printf("failed to write %s\n", out_path);
+        return 1;
+    }
+    printf("results: %s\n", out_path);
+    return ok ? 0 : 1;
 }
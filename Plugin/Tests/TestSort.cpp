@@ -0,0 +1,197 @@
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include "../MassParticle/mpConcurrency.h"
+
+// checks & measures sorts mpWorld::sortParticles() is made of, on (key, source) pairs laid out as it makes them:
+// ist::parallel_radix_sort() for shuffled keys, and ist::parallel_merge_marked() for last frame's order
+// with a few particles moved to cells around or added.
+
+typedef uint64_t Key;
+
+static const int g_num_div_bits = 7; // 128^3 cells
+static const int g_num_cell_bits = g_num_div_bits * 3;
+static const Key g_moved_bit = Key(1) << 63; // same as mpWorld
+
+struct Pairs
+{
+    std::vector<Key> keys;
+    std::vector<int> values;
+
+    int size() const { return (int)keys.size(); }
+};
+
+
+template<class Body>
+double Measure(int num_trials, const Body& body)
+{
+    double best = 1e30;
+    for (int i = 0; i < num_trials; ++i) {
+        auto begin = std::chrono::high_resolution_clock::now();
+        body();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min<double>(best, std::chrono::duration<double, std::milli>(end - begin).count());
+    }
+    return best;
+}
+
+void GenPairs(Pairs &pairs, int num, unsigned seed)
+{
+    std::mt19937 rand(seed);
+    std::uniform_int_distribution<Key> cell_dist(0, (Key(1) << g_num_cell_bits) - 1);
+    pairs.keys.resize(num);
+    pairs.values.resize(num);
+    for (int i = 0; i < num; ++i) {
+        pairs.keys[i] = cell_dist(rand);
+        pairs.values[i] = i;
+    }
+}
+
+// next frame of sorted pairs: ratio of them move to a cell next on x, y or z, and ratio of num are added at the end.
+// keys of both are marked as mpWorld::step() does.
+void NextFrame(const Pairs &sorted, Pairs &next, float ratio, unsigned seed)
+{
+    const Key steps[] = { 1, Key(1) << g_num_div_bits, Key(1) << (g_num_div_bits * 2) };
+    const Key num_cells = Key(1) << g_num_cell_bits;
+    std::mt19937 rand(seed);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::uniform_int_distribution<int> step_dist(0, 5);
+
+    next = sorted;
+    for (Key &k : next.keys) {
+        if (dist(rand) < ratio) {
+            int s = step_dist(rand);
+            k = (s < 3 ? k + steps[s] : k + num_cells - steps[s - 3]) % num_cells;
+            k |= g_moved_bit;
+        }
+    }
+    int num_added = int(sorted.size() * ratio);
+    Pairs added;
+    GenPairs(added, num_added, seed + 1);
+    for (int i = 0; i < num_added; ++i) {
+        next.keys.push_back(added.keys[i] | g_moved_bit);
+        next.values.push_back(sorted.size() + i);
+    }
+}
+
+int CountMarked(const Pairs &pairs)
+{
+    return (int)std::count_if(pairs.keys.begin(), pairs.keys.end(), [](Key k) { return (k & g_moved_bit) != 0; });
+}
+
+// stable sort by key with marks cleared. on equal keys, pairs not marked come first.
+void ReferenceSort(const Pairs &src, Pairs &dst)
+{
+    std::vector<int> order(src.size());
+    for (int i = 0; i < src.size(); ++i) { order[i] = i; }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        Key ka = src.keys[a] & ~g_moved_bit, kb = src.keys[b] & ~g_moved_bit;
+        return ka != kb ? ka < kb : (src.keys[a] & g_moved_bit) < (src.keys[b] & g_moved_bit);
+    });
+    dst.keys.resize(src.size());
+    dst.values.resize(src.size());
+    for (int i = 0; i < src.size(); ++i) {
+        dst.keys[i] = src.keys[order[i]] & ~g_moved_bit;
+        dst.values[i] = src.values[order[i]];
+    }
+}
+
+struct Sorter
+{
+    std::vector<Key> keys_tmp;
+    std::vector<int> values_tmp;
+
+    void radix(Pairs &pairs)
+    {
+        keys_tmp.resize(pairs.size());
+        values_tmp.resize(pairs.size());
+        ist::parallel_radix_sort(pairs.keys.data(), pairs.values.data(), keys_tmp.data(), values_tmp.data(), pairs.size(), g_num_cell_bits + 1);
+    }
+
+    void merge(Pairs &pairs, int num_marked)
+    {
+        keys_tmp.resize(pairs.size());
+        values_tmp.resize(pairs.size());
+        ist::parallel_merge_marked(pairs.keys.data(), pairs.values.data(), keys_tmp.data(), values_tmp.data(), pairs.size(), num_marked, g_moved_bit, g_num_cell_bits + 1);
+    }
+};
+
+bool Same(const Pairs &a, const Pairs &b)
+{
+    return a.keys == b.keys && a.values == b.values;
+}
+
+// edge cases of sizes & ratio of marked pairs. result must be same as ReferenceSort() exactly.
+bool CheckCases()
+{
+    const int counts[] = { 0, 1, 2, 100, 4096, 4097, 50000, 300000 };
+    const float ratios[] = { 0.0f, 0.001f, 0.02f, 0.5f, 1.0f };
+    Sorter sorter;
+    bool ok = true;
+    for (int num : counts) {
+        Pairs src, expected, work;
+        GenPairs(src, num, num);
+        ReferenceSort(src, expected);
+        work = src;
+        sorter.radix(work);
+        if (!Same(work, expected)) { printf("  radix failed: %d\n", num); ok = false; }
+
+        for (float ratio : ratios) {
+            Pairs next;
+            NextFrame(expected, next, ratio, num + 1);
+            // all marked: nothing is known to be in order
+            if (ratio == 1.0f) { for (Key &k : next.keys) { k |= g_moved_bit; } }
+            Pairs next_expected;
+            ReferenceSort(next, next_expected);
+            work = next;
+            sorter.merge(work, CountMarked(next));
+            if (!Same(work, next_expected)) { printf("  merge failed: %d %.3f\n", num, ratio); ok = false; }
+        }
+    }
+    return ok;
+}
+
+
+int main()
+{
+    const int num_trials = 5;
+    const int counts[] = { 10000, 100000, 1000000 };
+    const float moved_ratio = 0.02f;
+
+    bool ok = CheckCases();
+    printf("%-10s %s\n", "cases", ok ? "ok" : "ng");
+    if (!ok) { return 1; }
+
+    printf("%10s %14s %14s %14s\n", "particles", "radix", "radix(moved)", "merge(moved)");
+    for (int num : counts) {
+        Pairs src, sorted, next, work;
+        Sorter sorter;
+        GenPairs(src, num, 0);
+        sorted = src;
+        sorter.radix(sorted);
+
+        double t_radix = Measure(num_trials, [&]() { work = src; sorter.radix(work); });
+
+        // temporally coherent case: last frame's order with a few particles moved or added
+        NextFrame(sorted, next, moved_ratio, 1);
+        int num_marked = CountMarked(next);
+        double t_radix_moved = Measure(num_trials, [&]() {
+            work = next;
+            for (Key &k : work.keys) { k &= ~g_moved_bit; }
+            sorter.radix(work);
+        });
+        Pairs radix_result = work;
+        double t_merge_moved = Measure(num_trials, [&]() { work = next; sorter.merge(work, num_marked); });
+
+        // both are sorted. order on equal keys differs, as radix doesn't know which pairs were in order.
+        ok = work.keys == radix_result.keys && std::is_sorted(work.keys.begin(), work.keys.end());
+
+        // copy of input is included in every measurement
+        printf("%10d %12.3fms %12.3fms %12.3fms %s\n", num, t_radix, t_radix_moved, t_merge_moved, ok ? "ok" : "ng");
+        if (!ok) { return 1; }
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "../GraphicsInterface/giStagingRing.h"
+
+// exercises gi::StagingRing without any device. NullFence stands in for GPU queue:
+// tests decide when GPU passes a fence value, and wait() passes it immediately as real fences eventually do.
+
+class NullFence : public gi::StagingFence
+{
+public:
+    uint64_t completed = 0;
+    std::vector<uint64_t> waits;
+
+    uint64_t getCompletedValue() override { return completed; }
+    void wait(uint64_t value) override
+    {
+        waits.push_back(value);
+        completed = std::max(completed, value);
+    }
+};
+
+static bool g_ok = true;
+
+static void Check(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("  failed: %s\n", what);
+        g_ok = false;
+    }
+}
+
+static void Report(const char *name, bool ok)
+{
+    printf("%-24s %s\n", name, ok ? "ok" : "ng");
+}
+
+// allocations are aligned, packed in order, and don't wait while there is room
+static bool TestSequential()
+{
+    g_ok = true;
+    std::vector<char> memory(1024);
+    NullFence fence;
+    gi::StagingRing ring(fence);
+    ring.reset(memory.data(), memory.size());
+
+    size_t o0, o1, o2;
+    char *p0 = ring.allocate(100, 64, o0);
+    char *p1 = ring.allocate(100, 64, o1);
+    ring.submit(1);
+    char *p2 = ring.allocate(10, 256, o2);
+    ring.submit(2);
+
+    Check(p0 == memory.data() + o0 && p1 == memory.data() + o1 && p2 == memory.data() + o2, "pointer matches offset");
+    Check(o0 == 0 && o1 == 128 && o2 == 256, "aligned offsets");
+    Check(ring.getNumInFlight() == 3, "3 in flight");
+    Check(fence.waits.empty(), "no wait");
+    return g_ok;
+}
+
+// when head reaches the end, allocation wraps to 0 and waits only for the fence that protects that range
+static bool TestWraparound()
+{
+    g_ok = true;
+    std::vector<char> memory(1000);
+    NullFence fence;
+    gi::StagingRing ring(fence);
+    ring.reset(memory.data(), memory.size());
+
+    size_t offset;
+    for (uint64_t i = 1; i <= 3; ++i) {
+        ring.allocate(300, 4, offset);
+        ring.submit(i);
+    }
+    Check(offset == 600, "3rd at 600");
+    Check(fence.waits.empty(), "no wait before wrap");
+
+    // [0,300) is still read by fence 1. GPU hasn't passed anything.
+    ring.allocate(300, 4, offset);
+    Check(offset == 0, "wrapped to 0");
+    Check(fence.waits.size() == 1 && fence.waits[0] == 1, "waited only fence 1");
+    Check(ring.getNumInFlight() == 3, "oldest released");
+    ring.submit(4);
+
+    // GPU has passed fence 2. [300,600) is reused without waiting.
+    fence.completed = 2;
+    ring.allocate(300, 4, offset);
+    Check(offset == 300, "reused 300");
+    Check(fence.waits.size() == 1, "no extra wait");
+    ring.submit(5);
+    return g_ok;
+}
+
+// reclaim() releases passed allocations and never waits
+static bool TestReclaim()
+{
+    g_ok = true;
+    std::vector<char> memory(1024);
+    NullFence fence;
+    gi::StagingRing ring(fence);
+    ring.reset(memory.data(), memory.size());
+
+    size_t offset;
+    for (uint64_t i = 1; i <= 4; ++i) {
+        ring.allocate(100, 4, offset);
+        ring.submit(i);
+    }
+    ring.reclaim();
+    Check(ring.getNumInFlight() == 4, "nothing passed");
+
+    fence.completed = 2;
+    ring.reclaim();
+    Check(ring.getNumInFlight() == 2, "2 passed");
+
+    fence.completed = 4;
+    ring.reclaim();
+    Check(ring.getNumInFlight() == 0, "all passed");
+    Check(fence.waits.empty(), "no wait");
+
+    // empty ring starts from the beginning
+    ring.allocate(100, 4, offset);
+    Check(offset == 0, "restart at 0");
+    return g_ok;
+}
+
+// allocations that can never be satisfied return nullptr instead of waiting forever
+static bool TestFailures()
+{
+    g_ok = true;
+    std::vector<char> memory(1024);
+    NullFence fence;
+    gi::StagingRing ring(fence);
+
+    size_t offset;
+    Check(ring.allocate(16, 4, offset) == nullptr, "no memory");
+
+    ring.reset(memory.data(), memory.size());
+    Check(ring.allocate(2048, 4, offset) == nullptr, "larger than capacity");
+    Check(ring.allocate(0, 4, offset) == nullptr, "zero size");
+
+    // ring full of allocations not submitted. waiting would never return.
+    Check(ring.allocate(600, 4, offset) != nullptr, "1st");
+    Check(ring.allocate(600, 4, offset) == nullptr, "unsubmitted blocks the range");
+    Check(fence.waits.empty(), "no wait");
+
+    // once submitted, same allocation waits for it
+    ring.submit(1);
+    Check(ring.allocate(600, 4, offset) != nullptr && offset == 0, "after submit");
+    Check(fence.waits.size() == 1 && fence.waits[0] == 1, "waited fence 1");
+    return g_ok;
+}
+
+// waitAll() waits newest fence once. reset() to other memory drains old one.
+static bool TestWaitAll()
+{
+    g_ok = true;
+    std::vector<char> memory(1024), memory2(512);
+    NullFence fence;
+    gi::StagingRing ring(fence);
+    ring.reset(memory.data(), memory.size());
+
+    size_t offset;
+    for (uint64_t i = 1; i <= 3; ++i) {
+        ring.allocate(100, 4, offset);
+        ring.submit(i);
+    }
+    ring.allocate(100, 4, offset); // not submitted. GPU never reads it.
+    ring.waitAll();
+    Check(fence.waits.size() == 1 && fence.waits[0] == 3, "waited newest submitted");
+    Check(ring.getNumInFlight() == 0, "drained");
+
+    ring.allocate(100, 4, offset);
+    ring.submit(4);
+    ring.reset(memory2.data(), memory2.size());
+    Check(fence.waits.size() == 2 && fence.waits[1] == 4, "reset waited");
+    Check(ring.getCapacity() == 512, "new capacity");
+    Check(ring.allocate(100, 4, offset) == memory2.data(), "new memory");
+    return g_ok;
+}
+
+// random sizes, alignments and GPU progress. no allocation may overlap one GPU hasn't passed,
+// and every wait must be for a submitted fence GPU hasn't passed yet.
+static bool TestRandom()
+{
+    g_ok = true;
+    const size_t capacity = 64 * 1024;
+    std::vector<char> memory(capacity);
+    NullFence fence;
+    gi::StagingRing ring(fence);
+    ring.reset(memory.data(), capacity);
+
+    struct Live { size_t begin, end; uint64_t fence; };
+    std::vector<Live> live;
+    std::mt19937 rand;
+    uint64_t fence_value = 0;
+    size_t num_waits = 0;
+    bool pending = false;
+
+    for (int i = 0; i < 100000 && g_ok; ++i) {
+        size_t size = std::uniform_int_distribution<size_t>(1, capacity / 3)(rand);
+        size_t alignment = size_t(1) << std::uniform_int_distribution<int>(0, 9)(rand);
+
+        size_t offset;
+        uint64_t completed_before = fence.completed;
+        char *p = ring.allocate(size, alignment, offset);
+        Check(p != nullptr, "allocate");
+        if (!p) { break; }
+        Check(p == memory.data() + offset, "pointer");
+        Check(offset % alignment == 0, "alignment");
+        Check(offset + size <= capacity, "in range");
+
+        for (size_t w = num_waits; w < fence.waits.size(); ++w) {
+            Check(fence.waits[w] > completed_before && fence.waits[w] <= fence_value, "wait for submitted fence");
+        }
+        num_waits = fence.waits.size();
+
+        live.erase(std::remove_if(live.begin(), live.end(), [&](const Live& l) { return l.fence != 0 && l.fence <= fence.completed; }), live.end());
+        for (auto& l : live) {
+            Check(!(l.begin < offset + size && offset < l.end), "no overlap with live allocation");
+        }
+
+        // two writes share one submission sometimes
+        Live l = { offset, offset + size, 0 };
+        live.push_back(l);
+        if (pending || std::uniform_int_distribution<int>(0, 3)(rand) != 0) {
+            ring.submit(++fence_value);
+            for (auto& l : live) { if (l.fence == 0) { l.fence = fence_value; } }
+            pending = false;
+        }
+        else {
+            pending = true;
+        }
+
+        // GPU progresses by random steps
+        if (std::uniform_int_distribution<int>(0, 2)(rand) == 0) {
+            fence.completed = std::min<uint64_t>(fence_value, fence.completed + std::uniform_int_distribution<int>(0, 3)(rand));
+        }
+    }
+    Check(num_waits > 0, "ring has wrapped with waits");
+    return g_ok;
+}
+
+int main()
+{
+    struct Case { const char *name; bool (*proc)(); };
+    Case cases[] = {
+        { "sequential", TestSequential },
+        { "wraparound", TestWraparound },
+        { "reclaim", TestReclaim },
+        { "failures", TestFailures },
+        { "wait all", TestWaitAll },
+        { "random", TestRandom },
+    };
+
+    bool all_ok = true;
+    for (auto& c : cases) {
+        bool ok = c.proc();
+        Report(c.name, ok);
+        all_ok = all_ok && ok;
+    }
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "../MassParticle/MassParticle.h"
+
+// behavior of a world through the C API only (no Unity, no GPU). counterpart of TestMassParticle, which measures speed.
+
+static bool g_ok = true;
+
+static void Check(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("  failed: %s\n", what);
+        g_ok = false;
+    }
+}
+
+static void Report(const char *name, bool ok)
+{
+    printf("%-24s %s\n", name, ok ? "ok" : "ng");
+}
+
+static int CreateSphere(int ctx, int owner_id)
+{
+    mpColliderProperties props = { owner_id, 1500.0f, nullptr, nullptr, nullptr };
+    mpV3 center(0.0f, 0.0f, 0.0f);
+    float radius = 1.0f;
+    int handle = 0;
+    mpCreateSphereColliders(ctx, &props, &center, &radius, 1, &handle);
+    return handle;
+}
+
+static void RemoveByOwner(int ctx, int owner_id)
+{
+    mpColliderProperties props = { owner_id, 1500.0f, nullptr, nullptr, nullptr };
+    mpRemoveCollider(ctx, &props);
+}
+
+// removing a persistent collider by owner_id releases its handle, as destroying it does
+static bool TestRemoveByOwner()
+{
+    g_ok = true;
+    int ctx = mpCreateContext();
+
+    int handles[3];
+    for (int i = 0; i < 3; ++i) { handles[i] = CreateSphere(ctx, i + 1); }
+    Check(mpIsValidColliderHandle(ctx, handles[0]) && mpIsValidColliderHandle(ctx, handles[1]) && mpIsValidColliderHandle(ctx, handles[2]), "created");
+
+    // first one is erased and last one fills its place
+    RemoveByOwner(ctx, 1);
+    Check(!mpIsValidColliderHandle(ctx, handles[0]), "removed handle is invalid");
+    Check(mpIsValidColliderHandle(ctx, handles[1]) && mpIsValidColliderHandle(ctx, handles[2]), "others stay valid");
+
+    // new collider reuses the slot, but old handle doesn't refer to it
+    int reused = CreateSphere(ctx, 4);
+    Check(reused != handles[0], "new handle");
+    Check(!mpIsValidColliderHandle(ctx, handles[0]), "stale handle after reuse");
+    mpDestroyColliders(ctx, &handles[0], 1);
+    Check(mpIsValidColliderHandle(ctx, reused), "stale handle doesn't destroy new collider");
+
+    mpDestroyColliders(ctx, &handles[2], 1);
+    Check(!mpIsValidColliderHandle(ctx, handles[2]), "destroyed");
+    Check(mpIsValidColliderHandle(ctx, handles[1]) && mpIsValidColliderHandle(ctx, reused), "others after destroy");
+
+    mpDestroyContext(ctx);
+    return g_ok;
+}
+
+// while async update is running, handles of created colliders are valid right away,
+// and the changes reach the world at mpEndUpdate()
+static bool TestDeferredColliders()
+{
+    g_ok = true;
+    int ctx = mpCreateContext();
+
+    int kept = CreateSphere(ctx, 1);
+    int destroyed = CreateSphere(ctx, 2);
+    int removed = CreateSphere(ctx, 3);
+
+    mpBeginUpdate(ctx, 1.0f / 60.0f);
+    int created = CreateSphere(ctx, 4);
+    int created_destroyed = CreateSphere(ctx, 5);
+    Check(mpIsValidColliderHandle(ctx, created), "created while updating");
+    mpDestroyColliders(ctx, &destroyed, 1);
+    mpDestroyColliders(ctx, &created_destroyed, 1);
+    RemoveByOwner(ctx, 3);
+    mpEndUpdate(ctx);
+
+    Check(mpIsValidColliderHandle(ctx, kept), "kept");
+    Check(mpIsValidColliderHandle(ctx, created), "created");
+    Check(!mpIsValidColliderHandle(ctx, destroyed), "destroyed");
+    Check(!mpIsValidColliderHandle(ctx, created_destroyed), "created & destroyed");
+    Check(!mpIsValidColliderHandle(ctx, removed), "removed");
+
+    // collider created while updating is in place, so it can be removed by owner_id
+    RemoveByOwner(ctx, 4);
+    Check(!mpIsValidColliderHandle(ctx, created), "removed after update");
+
+    mpDestroyContext(ctx);
+    return g_ok;
+}
+
+// particles added while async update is running are all added, even beyond capacity of the spawn queue (16384)
+static bool TestAddOverflow()
+{
+    g_ok = true;
+    const int num = 20000;
+    int ctx = mpCreateContext();
+
+    std::vector<mpParticle> particles(num);
+    memset(particles.data(), 0, sizeof(mpParticle) * num);
+    for (int i = 0; i < num; ++i) {
+        particles[i].position = mpV3(0.01f * (i % 100), 0.01f * (i / 100 % 100), 0.01f * (i / 10000));
+        particles[i].lifetime = 100.0f;
+    }
+
+    mpBeginUpdate(ctx, 1.0f / 60.0f);
+    mpAddParticles(ctx, particles.data(), num / 2);
+    mpAddParticles(ctx, particles.data() + num / 2, num - num / 2);
+    mpEndUpdate(ctx);
+    mpUpdate(ctx, 1.0f / 60.0f);
+    Check(mpGetNumParticles(ctx) == num, "all added");
+
+    mpDestroyContext(ctx);
+    return g_ok;
+}
+
+static std::vector<mpParticle> GetParticles(int ctx)
+{
+    const mpParticle *p = mpGetParticles(ctx);
+    return std::vector<mpParticle>(p, p + mpGetNumParticles(ctx));
+}
+
+static bool SameParticles(const std::vector<mpParticle> &a, const std::vector<mpParticle> &b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), sizeof(mpParticle) * a.size()) == 0;
+}
+
+// scattered particles depend only on seed and number of particles scattered since the seed was set:
+// not on how bursts are split, nor on whether async update is running (beyond capacity of the spawn queue too)
+static bool TestScatterDeterminism()
+{
+    g_ok = true;
+    const int num = 20000;
+    const float dt = 1.0f / 60.0f;
+    mpV3 center(1.0f, 2.0f, 3.0f);
+    mpSpawnParams sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.velocity_random_diffuse = 0.5f;
+    sp.lifetime = 100.0f;
+    sp.lifetime_random_diffuse = 10.0f;
+
+    int ctx[4];
+    for (int i = 0; i < 4; ++i) {
+        ctx[i] = mpCreateContext();
+        mpSetSpawnSeed(ctx[i], i == 3 ? 456 : 123);
+    }
+    mpScatterParticlesSphere(ctx[0], &center, 2.0f, num, &sp);
+    mpScatterParticlesSphere(ctx[1], &center, 2.0f, num / 2 - 1, &sp);
+    mpScatterParticlesSphere(ctx[1], &center, 2.0f, num - (num / 2 - 1), &sp);
+    mpBeginUpdate(ctx[2], dt);
+    mpScatterParticlesSphere(ctx[2], &center, 2.0f, num, &sp);
+    mpEndUpdate(ctx[2]);
+    mpScatterParticlesSphere(ctx[3], &center, 2.0f, num, &sp);
+
+    std::vector<mpParticle> p[4];
+    for (int i = 0; i < 4; ++i) { p[i] = GetParticles(ctx[i]); }
+    Check((int)p[0].size() == num, "all scattered");
+    Check(SameParticles(p[0], p[1]), "same for split bursts");
+    Check(SameParticles(p[0], p[2]), "same while updating");
+    Check(p[3].size() == p[0].size() && !SameParticles(p[0], p[3]), "differ for other seed");
+
+    // setting seed restarts the sequence
+    mpClearParticles(ctx[1]);
+    mpSetSpawnSeed(ctx[1], 123);
+    mpScatterParticlesSphere(ctx[1], &center, 2.0f, num, &sp);
+    std::vector<mpParticle> again = GetParticles(ctx[1]);
+    bool same_shape = again.size() == p[0].size();
+    for (size_t i = 0; same_shape && i < again.size(); ++i) {
+        // ids keep increasing across clears
+        same_shape = memcmp(&again[i].position, &p[0][i].position, sizeof(mpV3)) == 0 &&
+            memcmp(&again[i].velocity, &p[0][i].velocity, sizeof(mpV3)) == 0 &&
+            again[i].lifetime == p[0][i].lifetime;
+    }
+    Check(same_shape, "same after reseed");
+
+    for (int i = 0; i < 4; ++i) { mpDestroyContext(ctx[i]); }
+    return g_ok;
+}
+
+static float MaxDistanceById(const std::vector<mpParticle> &a, const std::vector<mpParticle> &b)
+{
+    auto by_id = [](const mpParticle &p, const mpParticle &q) { return p.id < q.id; };
+    std::vector<mpParticle> sa = a, sb = b;
+    std::sort(sa.begin(), sa.end(), by_id);
+    std::sort(sb.begin(), sb.end(), by_id);
+    float r = sa.size() == sb.size() ? 0.0f : 1e30f;
+    for (size_t i = 0; i < sa.size() && i < sb.size(); ++i) {
+        if (sa[i].id != sb[i].id) { return 1e30f; }
+        const mpV3 &pa = sa[i].position, &pb = sb[i].position;
+        r = std::max<float>(r, std::max<float>(std::abs(pa.x - pb.x), std::max<float>(std::abs(pa.y - pb.y), std::abs(pa.z - pb.z))));
+    }
+    return r;
+}
+
+// impulse solver with neighbor list (default skin) moves particles same as scanning cells around,
+// up to rounding. particles are packed so that they are in contact and move across cells.
+static bool TestNeighborList()
+{
+    g_ok = true;
+    const int num = 5000;
+    const float dt = 1.0f / 60.0f;
+    mpV3 center(0.0f, 0.0f, 0.0f);
+    mpSpawnParams sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.velocity_random_diffuse = 1.0f;
+    sp.lifetime = 100.0f;
+
+    int ctx[2];
+    for (int i = 0; i < 2; ++i) {
+        ctx[i] = mpCreateContext();
+        mpKernelParams kp;
+        mpGetKernelParams(ctx[i], &kp);
+        kp.neighbor_list = i;
+        mpSetKernelParams(ctx[i], &kp);
+        mpSetSpawnSeed(ctx[i], 123);
+        mpScatterParticlesSphere(ctx[i], &center, 0.6f, num, &sp);
+    }
+    for (int f = 0; f < 10; ++f) {
+        for (int i = 0; i < 2; ++i) { mpUpdate(ctx[i], dt); }
+    }
+    std::vector<mpParticle> p[2];
+    for (int i = 0; i < 2; ++i) { p[i] = GetParticles(ctx[i]); }
+    Check((int)p[0].size() == num && (int)p[1].size() == num, "all alive");
+    Check(MaxDistanceById(p[0], p[1]) < 1e-3f, "same positions");
+
+    for (int i = 0; i < 2; ++i) { mpDestroyContext(ctx[i]); }
+    return g_ok;
+}
+
+int main()
+{
+    struct Case { const char *name; bool (*proc)(); };
+    Case cases[] = {
+        { "remove by owner", TestRemoveByOwner },
+        { "deferred colliders", TestDeferredColliders },
+        { "add overflow", TestAddOverflow },
+        { "scatter determinism", TestScatterDeterminism },
+        { "neighbor list", TestNeighborList },
+    };
+
+    bool all_ok = true;
+    for (auto& c : cases) {
+        bool ok = c.proc();
+        Report(c.name, ok);
+        all_ok = all_ok && ok;
+    }
+    return all_ok ? 0 : 1;
+}